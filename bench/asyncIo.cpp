@@ -0,0 +1,185 @@
+//I/O bound tasks on blocking executor threads against async handlers on a
+//reactor. every task sends requests one at a time over its own socketpair
+//to a simulated device that answers each after a fixed latency.
+//
+//blocking: an Executor of [threads] runs each task with blocking write and
+//read, as a run() handler does, so at most [threads] tasks wait at once.
+//async: a Reactor of [io threads] drives every task as a chain of fd
+//callbacks, as a start() handler does, so all tasks wait at once.
+//
+//usage: ./asyncIo [tasks] [requests per task] [latency ms] [threads] [io threads]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include "executor.h"
+#include "reactor.h"
+
+using namespace std;
+
+static boost::atomic<int> g_done(0);
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+//the device end of every socketpair: read a request byte, answer it after
+//the latency
+class Device {
+public:
+    Device(int latency) : m_latency(latency), m_reactor(1) {}
+
+    void serve(int fd) {
+        m_reactor.watch(fd, EPOLLIN, boost::bind(&Device::onRequest, this, fd, _1));
+    }
+
+    void stop() { m_reactor.stop(); }
+
+private:
+    void onRequest(int fd, uint32_t events) {
+        char c;
+        if (read(fd, &c, 1) != 1) {
+            return;
+        }
+        m_reactor.after(m_latency, boost::bind(&Device::reply, fd));
+        serve(fd);
+    }
+
+    static void reply(int fd) {
+        char c = 'r';
+        if (write(fd, &c, 1) != 1) {
+            perror("reply");
+        }
+    }
+
+    int m_latency;
+    Reactor m_reactor;
+};
+
+static void blockingTask(int fd, int requests, Job &) {
+    for (int i = 0; i < requests; ++i) {
+        char c = 'q';
+        if (write(fd, &c, 1) != 1 || read(fd, &c, 1) != 1) {
+            perror("blocking io");
+            return;
+        }
+    }
+    g_done.fetch_add(1);
+}
+
+//the state an async handler keeps between its callbacks
+typedef struct AsyncIo {
+    Reactor *reactor;
+    int fd;
+    int left;
+} AsyncIo;
+
+typedef boost::shared_ptr<AsyncIo> AsyncIoPtr;
+
+static void onReply(const AsyncIoPtr &io, uint32_t events);
+
+static void sendRequest(const AsyncIoPtr &io) {
+    char c = 'q';
+    if (write(io->fd, &c, 1) != 1) {
+        perror("async write");
+        return;
+    }
+    io->reactor->watch(io->fd, EPOLLIN, boost::bind(&onReply, io, _1));
+}
+
+static void onReply(const AsyncIoPtr &io, uint32_t events) {
+    char c;
+    if (read(io->fd, &c, 1) != 1) {
+        perror("async read");
+        return;
+    }
+
+    if (--io->left > 0) {
+        sendRequest(io);
+    } else {
+        io->reactor->unwatch(io->fd);
+        g_done.fetch_add(1);
+    }
+}
+
+static void waitDone(int ntask) {
+    while (g_done.load() < ntask) {
+        usleep(1000);
+    }
+}
+
+int main(int argc, char **argv) {
+    int ntask = argc > 1 ? atoi(argv[1]) : 4000;
+    int requests = argc > 2 ? atoi(argv[2]) : 4;
+    int latency = argc > 3 ? atoi(argv[3]) : 10;
+    int threads = argc > 4 ? atoi(argv[4]) : 16;
+    int ioThreads = argc > 5 ? atoi(argv[5]) : 1;
+
+    //two fds per task and the epoll sets
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if ((rlim_t)ntask * 2 + 64 > limit.rlim_cur) {
+        ntask = (limit.rlim_cur - 64) / 2;
+        printf("fd limit %d, tasks cut to %d\n", (int)limit.rlim_cur, ntask);
+    }
+
+    vector<int> clients(ntask);
+    Device device(latency);
+    for (int i = 0; i < ntask; ++i) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            perror("socketpair");
+            return 1;
+        }
+        clients[i] = fds[0];
+        device.serve(fds[1]);
+    }
+
+    printf("tasks:%d requests:%d latency:%dms, at least %dms per task\n",
+            ntask, requests, latency, requests * latency);
+
+    {
+        Executor executor(threads);
+        g_done.store(0);
+        double start = now();
+        for (int i = 0; i < ntask; ++i) {
+            executor.submit(i, boost::bind(&blockingTask, clients[i], requests, _1));
+        }
+        waitDone(ntask);
+        double elapsed = now() - start;
+        printf("blocking  threads:%3d  %.3fs  %.0f tasks/s\n", threads, elapsed, ntask / elapsed);
+    }
+
+    {
+        Reactor reactor(ioThreads);
+        g_done.store(0);
+        double start = now();
+        for (int i = 0; i < ntask; ++i) {
+            AsyncIoPtr io(new AsyncIo());
+            io->reactor = &reactor;
+            io->fd = clients[i];
+            io->left = requests;
+            reactor.post(boost::bind(&sendRequest, io));
+        }
+        waitDone(ntask);
+        double elapsed = now() - start;
+        printf("async  io threads:%3d  %.3fs  %.0f tasks/s\n", ioThreads, elapsed, ntask / elapsed);
+    }
+
+    device.stop();
+    return 0;
+}
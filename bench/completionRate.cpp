@@ -0,0 +1,101 @@
+//completions per second of the master cleanup path: removing the task,
+//assignment and status znodes of each finished task one request at a time
+//against MULTI_BATCH tasks per multi request.
+//
+//usage: ./completionRate host [tasks] [batch]
+//nodes are created under /bench-completion, which is removed afterwards
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "zookeeper.h"
+#include "common.h"
+#include "clog.h"
+
+using namespace std;
+
+static const string ROOT = "/bench-completion";
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static string taskName(int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "task-%010d", i);
+    return buf;
+}
+
+static void taskOps(int i, ZooOp::Type type, vector<ZooOp> *ops) {
+    string task = taskName(i);
+    string paths[3] = { ROOT+TASKPATH+"/"+task, ROOT+ASSIGNPATH+"/work-0000000000/"+task,
+        ROOT+STATUSPATH+"/"+task };
+
+    for (int j = 0; j < 3; ++j) {
+        if (type == ZooOp::CREATE) {
+            ops->push_back(ZooOp::create(paths[j], "done", 0));
+        } else {
+            ops->push_back(ZooOp::remove(paths[j]));
+        }
+    }
+}
+
+static bool runBatches(ZooKeeper &zk, int ntask, int batch, ZooOp::Type type) {
+    for (int i = 0; i < ntask; i += batch) {
+        vector<ZooOp> ops;
+        for (int j = i; j < ntask && j < i + batch; ++j) {
+            taskOps(j, type, &ops);
+        }
+
+        int code = zk.multi(ops, NULL);
+        if (code != ZOK) {
+            printf("multi failed: %s\n", zerror(code));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: ./completionRate host [tasks] [batch]\n");
+        return 1;
+    }
+
+    int ntask = argc > 2 ? atoi(argv[2]) : 10000;
+    int batch = argc > 3 ? atoi(argv[3]) : MULTI_BATCH;
+
+    //the client logs its retries and errors
+    log_init(CLOG_LEVEL_WARN, "/dev/stderr");
+
+    ZooKeeper zk(argv[1], 10000);
+    zk.create(ROOT+ASSIGNPATH+"/work-0000000000", "", ZOO_OPEN_ACL_UNSAFE, 0, NULL, true);
+    zk.create(ROOT+TASKPATH, "", ZOO_OPEN_ACL_UNSAFE, 0, NULL, true);
+    zk.create(ROOT+STATUSPATH, "", ZOO_OPEN_ACL_UNSAFE, 0, NULL, true);
+
+    //one remove per node
+    if (!runBatches(zk, ntask, MULTI_BATCH, ZooOp::CREATE)) return 1;
+    double start = now();
+    for (int i = 0; i < ntask; ++i) {
+        vector<ZooOp> ops;
+        taskOps(i, ZooOp::REMOVE, &ops);
+        for (int j = 0; j < ops.size(); ++j) {
+            zk.remove(ops[j].path, -1);
+        }
+    }
+    double single = now() - start;
+    printf("single removes: %d tasks %.3fs %.0f completions/s\n", ntask, single, ntask / single);
+
+    //batched multi
+    if (!runBatches(zk, ntask, MULTI_BATCH, ZooOp::CREATE)) return 1;
+    start = now();
+    if (!runBatches(zk, ntask, batch, ZooOp::REMOVE)) return 1;
+    double multi = now() - start;
+    printf("multi batch %d: %d tasks %.3fs %.0f completions/s\n", batch, ntask, multi, ntask / multi);
+
+    zk.removeDir(ROOT);
+    return 0;
+}
@@ -0,0 +1,96 @@
+//worker restart cost with the task journal: time to replay a journal of
+//in-flight tasks and read their data back, against the time to compact it.
+//the zookeeper side is not simulated, every journal hit is one payload
+//read less on the ensemble.
+//
+//usage: ./journalRecovery [tasks] [payload bytes] [percent done]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <string>
+#include "task_journal.h"
+#include "clog.h"
+
+using namespace std;
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static string taskName(int seq) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "task-%010d", seq);
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    int ntask = argc > 1 ? atoi(argv[1]) : 100000;
+    int size = argc > 2 ? atoi(argv[2]) : 1024;
+    int done = argc > 3 ? atoi(argv[3]) : 50;
+
+    //the journal logs its replay and compactions, only problems are shown
+    log_init(CLOG_LEVEL_WARN, "/dev/stderr");
+
+    char path[] = "/tmp/journalRecovery.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    unlink(path);
+
+    string payload(size, 'p');
+    string checkpoint(64, 'c');
+
+    //a run that fetched every task, checkpointed each, finished some
+    double start = now();
+    {
+        TaskJournal journal;
+        journal.open(path);
+        for (int i = 0; i < ntask; ++i) {
+            string task = taskName(i);
+            journal.recordFetched(task, i, i, payload);
+            journal.recordCheckpoint(task, checkpoint);
+            if (i % 100 < done) {
+                journal.recordDone(task);
+            }
+        }
+        journal.sync();
+    }
+    double write = now() - start;
+
+    //restart: replay, then every surviving task reads its data back
+    TaskJournal journal;
+    start = now();
+    journal.open(path);
+    double replay = now() - start;
+
+    start = now();
+    size_t hits = 0;
+    string data;
+    for (int i = 0; i < ntask; ++i) {
+        if (journal.fetched(taskName(i), i, i, &data)) {
+            ++hits;
+        }
+    }
+    double read = now() - start;
+
+    size_t before = journal.fileSize();
+    start = now();
+    journal.compact(NULL);
+    double compact = now() - start;
+
+    printf("tasks %d payload %d done %d%%: write %.3fs\n", ntask, size, done, write);
+    printf("replay %.3fs  read back %zu tasks %.3fs  recovery %.1fus/task\n",
+            replay, hits, read, (replay + read) * 1e6 / (hits ? hits : 1));
+    printf("compact %zu -> %zu bytes in %.3fs\n", before, journal.fileSize(), compact);
+
+    journal.close();
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,75 @@
+//nanoseconds per LOG_INFO line of the old clog formatting against the
+//current text and binary ones, all writing to /dev/null on the synchronous path.
+//
+//old: format_log_message into a thread buffer, then fprintf of a strftime
+//timestamp, a gettid syscall and that buffer, then fflush.
+//current: cached timestamp and tid, header and message formatted in place
+//into one buffer, then fwrite and fflush.
+//binary: the record header and the raw arguments, then fwrite and fflush.
+//
+//usage: ./logFormat [lines]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include "clog.h"
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+//the log_message of before, with its own stream
+static FILE *g_stream = NULL;
+
+static void legacyMessage(CLogLevel level, int line, const char *file, const char *message) {
+    static const char *levels[] = {"LOG_INVALID", "LOG_ERROR", "LOG_WARN", "LOG_INFO", "LOG_DEBUG"};
+    char now[1024];
+    struct timeval tv;
+    struct tm lt;
+    gettimeofday(&tv, 0);
+    time_t sec = tv.tv_sec;
+    localtime_r(&sec, &lt);
+    strftime(now, sizeof(now), "%Y-%m-%d %H:%M:%S", &lt);
+
+    fprintf(g_stream, "%s [%d:%d][%s][%s:%d] %s\n", now, (int)getpid(), (int)syscall(__NR_gettid),
+            levels[level], file, line, message);
+    fflush(g_stream);
+}
+
+int main(int argc, char **argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    log_init(CLOG_LEVEL_INFO, "/dev/null");
+    g_stream = fopen("/dev/null", "a");
+
+    double start = now();
+    for (int i = 0; i < lines; ++i) {
+        legacyMessage(CLOG_LEVEL_INFO, __LINE__, __FILE__,
+                format_log_message("add task task-%010d to worker work-%010d", i, i % 64));
+    }
+    double legacy = now() - start;
+
+    start = now();
+    for (int i = 0; i < lines; ++i) {
+        LOG_INFO("add task task-%010d to worker work-%010d", i, i % 64);
+    }
+    double current = now() - start;
+
+    log_set_binary();
+    start = now();
+    for (int i = 0; i < lines; ++i) {
+        LOG_INFO("add task task-%010d to worker work-%010d", i, i % 64);
+    }
+    double binary = now() - start;
+
+    printf("lines:%d\n", lines);
+    printf("old      ns/line:%6.0f\n", legacy * 1e9 / lines);
+    printf("current  ns/line:%6.0f\n", current * 1e9 / lines);
+    printf("binary   ns/line:%6.0f\n", binary * 1e9 / lines);
+    return 0;
+}
@@ -0,0 +1,90 @@
+//LOG_INFO throughput of the synchronous clog path against async mode with
+//the block and drop overflow policies, and against async binary records.
+//
+//every thread logs its lines as fast as it can into one log file. the
+//caller time is how long the threads took to log, the total time also
+//waits until the lines are written. each mode runs in its own process,
+//async mode can not be switched off again.
+//
+//usage: ./logThroughput [threads] [lines per thread] [ring KB] [log file]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include "clog.h"
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void logLines(int index, int lines) {
+    for (int i = 0; i < lines; ++i) {
+        LOG_INFO("add task task-%010d to worker work-%010d", i, index);
+    }
+}
+
+static int run(const char *name, int async, CLogOverflow overflow, bool binary, int threads, int lines,
+        int ringKb, const char *file) {
+    unlink(file);
+    if (!log_init(CLOG_LEVEL_INFO, file)) {
+        return 1;
+    }
+    if (binary && !log_set_binary()) {
+        return 1;
+    }
+    if (async && !log_set_async(ringKb << 10, overflow)) {
+        return 1;
+    }
+
+    double start = now();
+    boost::thread_group group;
+    for (int i = 0; i < threads; ++i) {
+        group.create_thread(boost::bind(&logLines, i, lines));
+    }
+    group.join_all();
+    double logged = now() - start;
+    log_flush();
+    double written = now() - start;
+
+    //dropped lines are logged by the caller but never written
+    double total = (double)threads * lines;
+    unsigned long long dropped = log_dropped();
+    printf("%-7s caller %.3fs %.0f lines/s  written %.3fs %.0f lines/s  dropped:%llu\n", name,
+            logged, total / logged, written, (total - dropped) / written, dropped);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    int lines = argc > 2 ? atoi(argv[2]) : 200000;
+    int ringKb = argc > 3 ? atoi(argv[3]) : 256;
+    const char *file = argc > 4 ? argv[4] : "/tmp/logThroughput.log";
+
+    printf("threads:%d lines/thread:%d ring:%dKB file:%s\n", threads, lines, ringKb, file);
+    fflush(stdout);
+
+    const char *names[] = {"sync", "block", "drop", "binary"};
+    for (int mode = 0; mode < 4; ++mode) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            return run(names[mode], mode > 0, mode == 2 ? CLOG_OVERFLOW_DROP : CLOG_OVERFLOW_BLOCK,
+                    mode == 3, threads, lines, ringKb, file);
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("%s failed\n", names[mode]);
+            return 1;
+        }
+    }
+
+    unlink(file);
+    return 0;
+}
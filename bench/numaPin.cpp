@@ -0,0 +1,92 @@
+//throughput of a memory bandwidth bound task on floating executor threads
+//against threads pinned per node and per core.
+//
+//every executor thread owns a buffer it touches first, so the kernel puts
+//its pages on the node the thread runs on at that moment. a task streams
+//over the buffer of its thread, reading and writing every cache line. a
+//floating thread that the scheduler moves to the other socket keeps
+//reading its pages across the interconnect, a pinned one never moves.
+//
+//usage: ./numaPin [tasks] [threads] [buffer MB]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include "executor.h"
+#include "topology.h"
+
+static boost::atomic<int> g_done(0);
+static boost::atomic<uint64_t> g_sum(0);
+
+static __thread char *t_buffer = NULL;
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void streamTask(size_t size, Job &) {
+    if (t_buffer == NULL) {
+        t_buffer = (char *)malloc(size);
+        memset(t_buffer, 1, size);
+    }
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; i += 64) {
+        sum += t_buffer[i];
+        t_buffer[i] = (char)sum;
+    }
+    g_sum.fetch_add(sum, boost::memory_order_relaxed);
+    g_done.fetch_add(1);
+}
+
+static void run(const char *name, PinMode pin, int ntask, int threads, size_t size) {
+    //buffers are left to process exit, t_buffer dies with its thread
+    Executor executor(threads, pin);
+    g_done.store(0);
+
+    //one untimed task per thread places the buffers
+    for (int i = 0; i < executor.threads(); ++i) {
+        executor.submit(i, boost::bind(&streamTask, size, _1));
+    }
+    while (g_done.load() < executor.threads()) {
+        usleep(1000);
+    }
+
+    g_done.store(0);
+    double start = now();
+    for (int i = 0; i < ntask; ++i) {
+        executor.submit(i, boost::bind(&streamTask, size, _1), i % executor.nodes());
+    }
+    while (g_done.load() < ntask) {
+        usleep(1000);
+    }
+    double elapsed = now() - start;
+
+    ExecutorStats stats = executor.stats();
+    printf("%-5s %.3fs  %.0f tasks/s  %.2f GB/s  steals:%llu\n", name, elapsed, ntask / elapsed,
+            (double)ntask * size / elapsed / 1e9, (unsigned long long)stats.steals);
+}
+
+int main(int argc, char **argv) {
+    int ntask = argc > 1 ? atoi(argv[1]) : 2000;
+    int threads = argc > 2 ? atoi(argv[2]) : 0;
+    size_t size = (size_t)(argc > 3 ? atoi(argv[3]) : 64) << 20;
+
+    Topology topology = Topology::detect();
+    printf("nodes:%d cpus:%d tasks:%d buffer:%dMB\n", topology.nodes(), topology.cpuCount(),
+            ntask, (int)(size >> 20));
+    for (int i = 0; i < topology.nodes(); ++i) {
+        printf("node %d: %d cpus\n", i, (int)topology.cpus(i).size());
+    }
+
+    run("none", PIN_NONE, ntask, threads, size);
+    run("node", PIN_NODE, ntask, threads, size);
+    run("core", PIN_CORE, ntask, threads, size);
+    return 0;
+}
@@ -0,0 +1,299 @@
+//end to end assignment throughput of master push against worker pull.
+//
+//push: one master session creates /assign/<worker>/<task> per task, round
+//robin, and every worker reacts to its child watch with a getChildren and
+//reports the new tasks with multi status creates that also remove the
+//assignments.
+//pull: the master publishes tasks to the READY_SHARDS queues with
+//MULTI_BATCH creates per multi, and every worker claims up to batch tasks
+//per multi (remove ready node + create assignment), then reports them with
+//multi status creates that also remove the assignments.
+//
+//tasks do nothing and their data is not read, which costs both modes the
+//same. every worker has its own session.
+//
+//usage: ./pullVsPush host [workers] [tasks] [batch]
+//nodes are created under /bench-pull, which is removed afterwards
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <set>
+#include <boost/atomic.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include "zookeeper.h"
+#include "watcher.h"
+#include "common.h"
+#include "clog.h"
+
+using namespace std;
+
+static const string ROOT = "/bench-pull";
+
+static boost::atomic<int> g_done(0);
+static boost::atomic<int> g_requests(0);
+static boost::atomic<int> g_conflicts(0);
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static string seqName(const char *prefix, int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%010d", prefix, i);
+    return buf;
+}
+
+static string assignDir(int worker) {
+    return ROOT+ASSIGNPATH+"/"+seqName("work-", worker);
+}
+
+//multi in chunks of MULTI_BATCH ops
+static bool multiAll(ZooKeeper *zk, const vector<ZooOp> &ops) {
+    for (size_t i = 0; i < ops.size(); i += MULTI_BATCH) {
+        vector<ZooOp> chunk(ops.begin() + i, ops.begin() + min(ops.size(), i + MULTI_BATCH));
+        g_requests.fetch_add(1);
+        int code = zk->multi(chunk, NULL);
+        if (code != ZOK) {
+            printf("multi failed: %s\n", zerror(code));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+class BenchWorker : public Watcher {
+public:
+    BenchWorker(ZooKeeper *zk, int index, bool pull, int batch)
+        : Watcher(zk), m_index(index), m_pull(pull), m_batch(batch), m_next(index % READY_SHARDS),
+        m_stopped(false) {
+        m_dir = assignDir(index);
+    }
+
+    void start() {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        if (m_pull) {
+            claim();
+        } else {
+            take();
+        }
+    }
+
+    void stop() {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        m_stopped = true;
+    }
+
+protected:
+    void childChange(const string &path) {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        if (m_stopped) {
+            return;
+        }
+
+        if (m_pull) {
+            m_next = atoi(path.c_str() + path.rfind('-') + 1) % READY_SHARDS;
+            claim();
+        } else if (path == m_dir) {
+            take();
+        }
+    }
+
+private:
+    //push: report the tasks assigned since the last event
+    void take() {
+        vector<string> children;
+        g_requests.fetch_add(1);
+        if (zk->getChildren(m_dir, true, &children) != ZOK) {
+            return;
+        }
+
+        //remove the assignments with the status creates, as pull does, so
+        //the dir does not grow and every listing stays short
+        vector<ZooOp> ops;
+        int reported = 0;
+        for (int i = 0; i < children.size(); ++i) {
+            if (m_seen.insert(children[i]).second) {
+                ops.push_back(ZooOp::create(ROOT+STATUSPATH+"/"+children[i], "done", 0));
+                ops.push_back(ZooOp::remove(m_dir+"/"+children[i]));
+                ++reported;
+            }
+        }
+
+        if (multiAll(zk, ops)) {
+            g_done.fetch_add(reported);
+        }
+    }
+
+    //pull: claim and report batches until every shard is empty, the empty
+    //shards keep a watch for the next publish
+    void claim() {
+        int empty = 0;
+        while (empty < READY_SHARDS && !m_stopped) {
+            int shard = m_next;
+            int claimed = claimFrom(shard);
+            if (claimed == 0) {
+                ++empty;
+                m_next = (m_next + 1) % READY_SHARDS;
+            } else {
+                empty = 0;
+            }
+        }
+    }
+
+    int claimFrom(int shard) {
+        string dir = ROOT+ready_shard(shard);
+        vector<string> children;
+        g_requests.fetch_add(1);
+        if (zk->getChildren(dir, true, &children) != ZOK || children.empty()) {
+            return 0;
+        }
+
+        sort(children.begin(), children.end());
+        size_t offset = 0;
+        if (children.size() > m_batch) {
+            offset = (size_t)m_index * 7919 % (children.size() - m_batch + 1);
+        }
+        vector<string> batch(children.begin() + offset,
+                children.begin() + offset + min(children.size(), (size_t)m_batch));
+
+        while (!batch.empty()) {
+            vector<ZooOp> ops;
+            for (int i = 0; i < batch.size(); ++i) {
+                ops.push_back(ZooOp::remove(dir+"/"+batch[i]));
+                ops.push_back(ZooOp::create(m_dir+"/"+batch[i], "", 0));
+            }
+
+            vector<int> results;
+            g_requests.fetch_add(1);
+            int code = zk->multi(ops, &results);
+            if (code == ZOK) {
+                break;
+            }
+
+            int failed = ZooKeeper::failedOp(results);
+            if (failed < 0) {
+                printf("claim failed: %s\n", zerror(code));
+                return 0;
+            }
+            g_conflicts.fetch_add(1);
+            batch.erase(batch.begin() + failed / 2);
+        }
+
+        vector<ZooOp> ops;
+        for (int i = 0; i < batch.size(); ++i) {
+            ops.push_back(ZooOp::create(ROOT+STATUSPATH+"/"+batch[i], "done", 0));
+            ops.push_back(ZooOp::remove(m_dir+"/"+batch[i]));
+        }
+        if (multiAll(zk, ops)) {
+            g_done.fetch_add(batch.size());
+        }
+
+        return batch.size();
+    }
+
+private:
+    int m_index;
+    bool m_pull;
+    int m_batch;
+    string m_dir;
+    int m_next;
+    bool m_stopped;
+    set<string> m_seen;
+    boost::mutex m_mutex;
+};
+
+static void publishPush(ZooKeeper *zk, int nworker, int ntask) {
+    for (int i = 0; i < ntask; ++i) {
+        g_requests.fetch_add(1);
+        int code = zk->create(assignDir(i % nworker)+"/"+seqName("task-", i), "", ZOO_OPEN_ACL_UNSAFE, 0, NULL);
+        if (code != ZOK) {
+            printf("assign failed: %s\n", zerror(code));
+            return;
+        }
+    }
+}
+
+static void publishPull(ZooKeeper *zk, int ntask) {
+    vector<ZooOp> ops;
+    for (int i = 0; i < ntask; ++i) {
+        ops.push_back(ZooOp::create(ROOT+ready_shard(i % READY_SHARDS)+"/"+seqName("task-", i), "", 0));
+    }
+    multiAll(zk, ops);
+}
+
+static bool run(const string &host, bool pull, int nworker, int ntask, int batch) {
+    ZooKeeper master(host, 10000);
+    master.removeDir(ROOT);
+    master.create(ROOT+STATUSPATH, "", ZOO_OPEN_ACL_UNSAFE, 0, NULL, true);
+    for (int i = 0; i < nworker; ++i) {
+        master.create(assignDir(i), "", ZOO_OPEN_ACL_UNSAFE, 0, NULL, true);
+    }
+    for (int i = 0; i < READY_SHARDS; ++i) {
+        master.create(ROOT+ready_shard(i), "", ZOO_OPEN_ACL_UNSAFE, 0, NULL, true);
+    }
+
+    //sessions and watch threads are left to process exit
+    vector<BenchWorker*> workers;
+    for (int i = 0; i < nworker; ++i) {
+        BenchWorker *w = new BenchWorker(new ZooKeeper(host, 10000), i, pull, batch);
+        w->startWatchThread();
+        while (!w->isConnected()) {
+            usleep(1000);
+        }
+        w->start();
+        workers.push_back(w);
+    }
+
+    g_done.store(0);
+    g_requests.store(0);
+    g_conflicts.store(0);
+
+    double start = now();
+    if (pull) {
+        publishPull(&master, ntask);
+    } else {
+        publishPush(&master, nworker, ntask);
+    }
+
+    while (g_done.load() < ntask && now() - start < 300) {
+        usleep(1000);
+    }
+    double elapsed = now() - start;
+
+    for (int i = 0; i < workers.size(); ++i) {
+        workers[i]->stop();
+    }
+
+    bool ok = g_done.load() >= ntask;
+    printf("%s: %d workers %d/%d tasks %.3fs %.0f tasks/s %.2f requests/task %d claim conflicts\n",
+            pull ? "pull" : "push", nworker, g_done.load(), ntask, elapsed, g_done.load() / elapsed,
+            (double)g_requests.load() / ntask, g_conflicts.load());
+
+    master.removeDir(ROOT);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: ./pullVsPush host [workers] [tasks] [batch]\n");
+        return 1;
+    }
+
+    int nworker = argc > 2 ? atoi(argv[2]) : 32;
+    int ntask = argc > 3 ? atoi(argv[3]) : 20000;
+    int batch = argc > 4 ? atoi(argv[4]) : 32;
+
+    //the client logs its retries and errors, watchers their events
+    log_init(CLOG_LEVEL_WARN, "/dev/stderr");
+
+    bool ok = run(argv[1], false, nworker, ntask, batch);
+    ok = run(argv[1], true, nworker, ntask, batch) && ok;
+    return ok ? 0 : 1;
+}
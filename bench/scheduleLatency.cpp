@@ -0,0 +1,533 @@
+//end to end scheduling latency of the real master and workers against a
+//live server. masters and workers run as child processes of this one,
+//each with the code of master/main.cpp and work/main.cpp, and the tasks
+//are stamp tasks (type 3, built with BENCH_HANDLERS) that write the
+//monotonic time they started to a pipe back to this process.
+//this process watches /assign/<worker> and /status, and measures per task
+//
+//  created:  the create request is sent
+//  assigned: the task shows up under an assign dir of a worker
+//  started:  the time the handler wrote to a pipe from the worker
+//  done:     the status shows up, or the assignment is cleaned up
+//
+//then kills the active master and times how long a new task waits to be
+//assigned by the next one. the children run on this host, so all times
+//are on one monotonic clock. the results go to stdout as one JSON object,
+//progress goes to stderr.
+//
+//the master and worker use the real /tasks, /assign, ... paths, so run it
+//against a scratch server: the trees are removed before and afterwards.
+//
+//usage: ./scheduleLatency host [workers] [tasks] [masters] [window]
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <map>
+#include <set>
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include "zookeeper.h"
+#include "watcher.h"
+#include "common.h"
+#include "histogram.h"
+#include "task_format.h"
+#include "master.h"
+#include "worker.h"
+#include "handlers.h"
+
+using namespace std;
+
+//same as master/main.cpp and work/main.cpp, it bounds the failover time
+static const int SESSION_TIMEOUT = 10000;
+
+//ms to wait for children to register, and for tasks that make no progress
+static const int START_TIMEOUT = 30000;
+static const int STALL_TIMEOUT = 30000;
+
+static const char *TASK_PREFIX = "bench-";
+
+static const string ROOTS[] = {MASTERPATH, WORKERPATH, ASSIGNPATH, TASKPATH, STATUSPATH, LEASEPATH,
+    READYPATH};
+
+typedef struct TaskTimes {
+    int64_t created;   //us, 0 until it happened
+    int64_t assigned;
+    int64_t started;
+    int64_t done;
+
+    TaskTimes() : created(0), assigned(0), started(0), done(0) {}
+} TaskTimes;
+
+static string taskName(int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%010d", TASK_PREFIX, i);
+    return buf;
+}
+
+//index of a task of this run, -1 for any other node
+static int taskIndex(const string &name) {
+    size_t len = strlen(TASK_PREFIX);
+    return name.compare(0, len, TASK_PREFIX) == 0 ? atoi(name.c_str() + len) : -1;
+}
+
+//sees the tasks through the same watches a worker and the master use, and
+//reads the start times the workers write to a pipe
+class Probe : public Watcher {
+public:
+    Probe(ZooKeeper *zk, int ntask) : Watcher(zk), m_times(ntask), m_inflight(0), m_assigned(0),
+        m_started(0), m_done(0), m_lastAssigned(0) {}
+
+    void start() {
+        listWorkers();
+        listStatus();
+    }
+
+    //send the create of task i once fewer than window creates are in flight
+    bool create(int i, int window) {
+        string name = taskName(i);
+        string data;
+        encode_task(stampHeader(), Slice(name.data(), name.size()), Slice("", 0), &data);
+
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        while (m_inflight >= window) {
+            m_cond.wait(lock);
+        }
+        ++m_inflight;
+        m_times[i].created = now_us();
+        lock.unlock();
+
+        int code = zk->acreate(TASKPATH+"/"+name, data, 0, boost::bind(&Probe::onCreated, this, _1, _2));
+        if (code != ZOK) {
+            fprintf(stderr, "create %s failed: %s\n", name.c_str(), zerror(code));
+            lock.lock();
+            --m_inflight;
+            return false;
+        }
+        return true;
+    }
+
+    //"<task> <us>" lines of StampHandler until every writer closed the pipe
+    void readStamps(int fd) {
+        string buf;
+        char chunk[4096];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0 || (n < 0 && errno == EINTR)) {
+            buf.append(chunk, n > 0 ? n : 0);
+            size_t pos = 0;
+            size_t eol;
+            while ((eol = buf.find('\n', pos)) != string::npos) {
+                string line = buf.substr(pos, eol - pos);
+                pos = eol + 1;
+
+                size_t space = line.find(' ');
+                int task = space == string::npos ? -1 : taskIndex(line.substr(0, space));
+                if (task >= 0 && task < m_times.size()) {
+                    boost::lock_guard<boost::mutex> guard(m_mutex);
+                    if (m_times[task].started == 0) {
+                        m_times[task].started = strtoll(line.c_str() + space + 1, NULL, 10);
+                        ++m_started;
+                    }
+                }
+            }
+            buf.erase(0, pos);
+        }
+    }
+
+    TaskTimes times(int i) {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        return m_times[i];
+    }
+
+    int assigned() {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        return m_assigned;
+    }
+
+    int started() {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        return m_started;
+    }
+
+    int done() {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        return m_done;
+    }
+
+    int64_t lastAssigned() {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        return m_lastAssigned;
+    }
+
+protected:
+    //the lists are read without m_mutex: the completions that take it run
+    //on the thread that also completes these synchronous reads
+    void childChange(const string &path) {
+        if (path == ASSIGNPATH) {
+            listWorkers();
+        } else if (path == STATUSPATH) {
+            listStatus();
+        } else {
+            listTasks(path);
+        }
+    }
+
+private:
+    static TaskHeader stampHeader() {
+        TaskHeader header;
+        header.type = 3;
+        return header;
+    }
+
+    void listWorkers() {
+        vector<string> children;
+        if (zk->getChildren(ASSIGNPATH, true, &children) != ZOK) {
+            return;
+        }
+
+        for (int i = 0; i < children.size(); ++i) {
+            string dir = ASSIGNPATH+"/"+children[i];
+            bool added;
+            {
+                boost::lock_guard<boost::mutex> guard(m_mutex);
+                added = m_dirs.insert(make_pair(dir, set<int>())).second;
+            }
+            if (added) {
+                listTasks(dir);
+            }
+        }
+    }
+
+    //a task that leaves its dir was cleaned up, and so is done even if
+    //its status was gone before it was listed
+    void listTasks(const string &dir) {
+        vector<string> children;
+        if (zk->getChildren(dir, true, &children) != ZOK) {
+            return;
+        }
+
+        set<int> listed;
+        for (int i = 0; i < children.size(); ++i) {
+            int task = taskIndex(children[i]);
+            if (task >= 0 && task < m_times.size()) {
+                listed.insert(task);
+            }
+        }
+
+        int64_t now = now_us();
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        for (set<int>::iterator it = listed.begin(); it != listed.end(); ++it) {
+            if (m_times[*it].assigned == 0) {
+                m_times[*it].assigned = now;
+                m_lastAssigned = now;
+                ++m_assigned;
+            }
+        }
+
+        set<int> &before = m_dirs[dir];
+        for (set<int>::iterator it = before.begin(); it != before.end(); ++it) {
+            if (!listed.count(*it)) {
+                finish(*it, now);
+            }
+        }
+        before.swap(listed);
+    }
+
+    void listStatus() {
+        vector<string> children;
+        if (zk->getChildren(STATUSPATH, true, &children) != ZOK) {
+            return;
+        }
+
+        int64_t now = now_us();
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        for (int i = 0; i < children.size(); ++i) {
+            int task = taskIndex(children[i]);
+            if (task >= 0 && task < m_times.size()) {
+                finish(task, now);
+            }
+        }
+    }
+
+    //m_mutex held
+    void finish(int task, int64_t now) {
+        if (m_times[task].done == 0) {
+            m_times[task].done = now;
+            ++m_done;
+        }
+    }
+
+    //runs on the zookeeper completion thread
+    void onCreated(int code, const char *path) {
+        if (code != ZOK) {
+            fprintf(stderr, "create task failed: %s\n", zerror(code));
+        }
+
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        --m_inflight;
+        m_cond.notify_one();
+    }
+
+private:
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+    vector<TaskTimes> m_times;
+    map<string, set<int> > m_dirs; //assign dir -> tasks listed there last
+    int m_inflight;
+    int m_assigned;
+    int m_started;
+    int m_done;
+    int64_t m_lastAssigned;
+};
+
+//master/main.cpp without the daemon and the config file
+static int runMaster(const string &host, int index) {
+    char log[64];
+    snprintf(log, sizeof(log), "log-bench-master-%d", index);
+    log_init(CLOG_LEVEL_WARN, log);
+
+    ZooKeeper zk(host, SESSION_TIMEOUT);
+    Master m(&zk);
+    m.startWatchThread();
+    while (!m.isConnected()) {
+        usleep(1000);
+    }
+
+    m.createMaster();
+    m.checkMaster();
+    while (!m.isExpired()) {
+        sleep(1);
+        m.tick();
+    }
+    return 0;
+}
+
+//work/main.cpp without the daemon, the config file and draining. the
+//stamp tasks write to fd
+static int runWorker(const string &host, int index, int fd) {
+    char log[64];
+    snprintf(log, sizeof(log), "log-bench-worker-%d", index);
+    log_init(CLOG_LEVEL_WARN, log);
+    StampHandler::setOutput(fd);
+
+    ZooKeeper zk(host, SESSION_TIMEOUT);
+    Worker w(&zk);
+    w.startWatchThread();
+    while (!w.isConnected()) {
+        usleep(1000);
+    }
+
+    w.createWorkspace();
+    w.createWorker();
+    w.getTasks();
+    while (!w.isExpired()) {
+        sleep(1);
+        w.tick();
+    }
+    return 0;
+}
+
+//run this program again as a master or worker, it dies with its parent
+static pid_t spawn(const char *role, const string &host, int index, int fd) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    char arg[16];
+    char out[16];
+    snprintf(arg, sizeof(arg), "%d", index);
+    snprintf(out, sizeof(out), "%d", fd);
+    execl("/proc/self/exe", "scheduleLatency", role, host.c_str(), arg, out, (char *)NULL);
+    _exit(127);
+}
+
+//wait until path has count children
+static bool waitChildren(ZooKeeper &zk, const string &path, int count) {
+    int64_t deadline = now_ms() + START_TIMEOUT;
+    while (now_ms() < deadline) {
+        vector<string> children;
+        if (zk.getChildren(path, false, &children) == ZOK && children.size() >= count) {
+            return true;
+        }
+        usleep(10000);
+    }
+
+    fprintf(stderr, "%s did not reach %d children\n", path.c_str(), count);
+    return false;
+}
+
+static void clear(ZooKeeper &zk) {
+    for (int i = 0; i < sizeof(ROOTS) / sizeof(ROOTS[0]); ++i) {
+        int code = zk.removeDir(ROOTS[i]);
+        if (code != ZOK && code != ZNONODE) {
+            fprintf(stderr, "clear %s failed: %s\n", ROOTS[i].c_str(), zerror(code));
+        }
+    }
+}
+
+static void printLatency(const char *name, const Histogram &h) {
+    printf("  \"%s\": {\"count\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu},\n",
+            name, (unsigned long long)h.count(), (unsigned long long)h.percentile(0.5),
+            (unsigned long long)h.percentile(0.9), (unsigned long long)h.percentile(0.99),
+            (unsigned long long)h.percentile(0.999), (unsigned long long)h.max());
+}
+
+int main(int argc, char **argv) {
+    if (argc == 5 && !strcmp(argv[1], "-master")) {
+        return runMaster(argv[2], atoi(argv[3]));
+    }
+    if (argc == 5 && !strcmp(argv[1], "-worker")) {
+        return runWorker(argv[2], atoi(argv[3]), atoi(argv[4]));
+    }
+    if (argc < 2) {
+        printf("usage: ./scheduleLatency host [workers] [tasks] [masters] [window]\n");
+        return 1;
+    }
+
+    string host = argv[1];
+    int nworker = argc > 2 ? atoi(argv[2]) : 4;
+    int ntask = argc > 3 ? atoi(argv[3]) : 10000;
+    int nmaster = argc > 4 ? atoi(argv[4]) : 2;
+    int window = argc > 5 ? atoi(argv[5]) : 64;
+    nworker = nworker > 0 ? nworker : 1;
+    nmaster = nmaster > 0 ? nmaster : 1;
+    window = window > 0 ? window : 1;
+
+    log_init(CLOG_LEVEL_WARN, "log-bench");
+    ZooKeeper &zk = *new ZooKeeper(host, SESSION_TIMEOUT);
+    clear(zk);
+    //the workers would race each other to create them
+    for (int i = 0; i < sizeof(ROOTS) / sizeof(ROOTS[0]); ++i) {
+        zk.create(ROOTS[i], "", ZOO_OPEN_ACL_UNSAFE, 0, NULL);
+    }
+
+    //one more task slot for the failover probe. the session and the watch
+    //thread are left to process exit
+    Probe &probe = *new Probe(&zk, ntask + 1);
+    probe.startWatchThread();
+    while (!probe.isConnected()) {
+        usleep(1000);
+    }
+    probe.start();
+
+    //masters one by one, so the first one is the active master
+    vector<pid_t> masters;
+    vector<pid_t> workers;
+    bool ok = true;
+    for (int i = 0; i < nmaster && ok; ++i) {
+        masters.push_back(spawn("-master", host, i, -1));
+        ok = waitChildren(zk, MASTERPATH, i + 1);
+    }
+
+    //only the workers hold the write end, it reads EOF once they are gone
+    int stamps[2];
+    if (pipe(stamps) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    fcntl(stamps[0], F_SETFD, FD_CLOEXEC);
+    for (int i = 0; i < nworker && ok; ++i) {
+        workers.push_back(spawn("-worker", host, i, stamps[1]));
+    }
+    close(stamps[1]);
+    boost::thread reader(boost::bind(&Probe::readStamps, &probe, stamps[0]));
+    ok = ok && waitChildren(zk, WORKERPATH, nworker);
+
+    //the active master reads the new workers from its watch
+    sleep(1);
+
+    int64_t start = now_us();
+    int64_t injected = start;
+    int64_t end = start;
+    if (ok) {
+        for (int i = 0; i < ntask && ok; ++i) {
+            ok = probe.create(i, window);
+        }
+        injected = now_us();
+
+        int last = -1;
+        int64_t progress = now_ms();
+        while (ok && probe.done() < ntask && now_ms() - progress < STALL_TIMEOUT) {
+            usleep(100000);
+            int done = probe.done();
+            if (done != last) {
+                last = done;
+                progress = now_ms();
+                fprintf(stderr, "assigned:%d started:%d done:%d %.1fs\n", probe.assigned(), probe.started(), done,
+                        (now_us() - start) / 1e6);
+            }
+        }
+        end = now_us();
+    }
+
+    //a task created right after the active master dies waits for its
+    //session to expire and the next master to take over
+    int64_t failover = -1;
+    if (ok && nmaster > 1) {
+        kill(masters[0], SIGKILL);
+        int64_t killed = now_us();
+        ok = probe.create(ntask, 1);
+        while (ok && probe.times(ntask).assigned == 0 && now_us() - killed < 6LL * SESSION_TIMEOUT * 1000) {
+            usleep(10000);
+        }
+        if (probe.times(ntask).assigned != 0) {
+            failover = probe.times(ntask).assigned - killed;
+            fprintf(stderr, "failover:%.3fs\n", failover / 1e6);
+        }
+    }
+
+    //every stamp is in once the workers are gone
+    for (int i = 0; i < masters.size(); ++i) kill(masters[i], SIGKILL);
+    for (int i = 0; i < workers.size(); ++i) kill(workers[i], SIGKILL);
+    while (wait(NULL) > 0) {
+    }
+    reader.join();
+
+    Histogram toAssigned;
+    Histogram toStarted;
+    Histogram assignedToStarted;
+    Histogram toDone;
+    for (int i = 0; i < ntask; ++i) {
+        TaskTimes t = probe.times(i);
+        if (t.assigned != 0) toAssigned.add(max(t.assigned - t.created, (int64_t)0));
+        if (t.started != 0) toStarted.add(max(t.started - t.created, (int64_t)0));
+        if (t.started != 0 && t.assigned != 0) assignedToStarted.add(max(t.started - t.assigned, (int64_t)0));
+        if (t.done != 0) toDone.add(max(t.done - t.created, (int64_t)0));
+    }
+
+    int64_t lastAssigned = probe.lastAssigned();
+    double assignSeconds = (min(lastAssigned, end) - start) / 1e6;
+    printf("{\n");
+    printf("  \"masters\": %d,\n  \"workers\": %d,\n  \"tasks\": %d,\n  \"window\": %d,\n", nmaster, nworker,
+            ntask, window);
+    printf("  \"assigned\": %d,\n  \"started\": %d,\n  \"done\": %d,\n", (int)toAssigned.count(),
+            (int)toStarted.count(), (int)toDone.count());
+    printf("  \"inject_seconds\": %.3f,\n  \"elapsed_seconds\": %.3f,\n", (injected - start) / 1e6,
+            (end - start) / 1e6);
+    printf("  \"assigned_per_second\": %.0f,\n", assignSeconds > 0 ? toAssigned.count() / assignSeconds : 0.0);
+    printLatency("created_to_assigned_us", toAssigned);
+    printLatency("assigned_to_started_us", assignedToStarted);
+    printLatency("created_to_started_us", toStarted);
+    printLatency("created_to_done_us", toDone);
+    if (failover >= 0) {
+        printf("  \"failover_ms\": %lld\n", (long long)(failover / 1000));
+    } else {
+        printf("  \"failover_ms\": null\n");
+    }
+    printf("}\n");
+    fflush(stdout);
+
+    clear(zk);
+
+    return ok && toDone.count() == ntask ? 0 : 1;
+}
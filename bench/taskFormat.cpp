@@ -0,0 +1,76 @@
+//parse and serialize cost of the task envelope for a few payload sizes,
+//against the old fetch path that copied the data into a heap struct.
+//
+//usage: ./taskFormat [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <string>
+#include "task_format.h"
+
+using namespace std;
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+//what Worker::getTaskInfo did before the envelope
+typedef struct OldTask {
+    char info[20];
+} OldTask;
+
+static void run(size_t size, int iterations) {
+    string payload(size, 'p');
+    string key = "user-42";
+    TaskHeader header;
+    header.type = 7;
+    header.priority = 3;
+
+    string buf;
+    double start = now();
+    for (int i = 0; i < iterations; ++i) {
+        buf.clear();
+        encode_task(header, key, payload, &buf);
+    }
+    double encode = now() - start;
+
+    TaskView view;
+    size_t check = 0;
+    start = now();
+    for (int i = 0; i < iterations; ++i) {
+        if (view.parse(buf) != TASK_OK) {
+            printf("parse failed\n");
+            exit(1);
+        }
+        check += view.payload().size + view.type();
+    }
+    double parse = now() - start;
+
+    start = now();
+    for (int i = 0; i < iterations; ++i) {
+        OldTask *task = new OldTask();
+        memcpy(task, payload.data(), min(payload.size(), sizeof(OldTask)));
+        check += task->info[0];
+        delete task;
+    }
+    double old = now() - start;
+
+    printf("payload %7zu: encode %8.1fns  parse %8.1fns (%6.2f GB/s)  old copy %6.1fns  (%zu)\n",
+            size, encode * 1e9 / iterations, parse * 1e9 / iterations,
+            (double)buf.size() * iterations / parse / 1e9, old * 1e9 / iterations, check);
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+    size_t sizes[] = {20, 256, 4096, 65536};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        run(sizes[i], sizes[i] > 4096 ? iterations / 20 : iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+//heap allocations per task of the worker task tables under steady churn:
+//new TaskInfo + shared_ptr + map<string,...>/set<string> against
+//TaskPool + intrusive TaskInfoPtr + FlatMap keyed by interned ids.
+//
+//every round assigns one task and completes the oldest of the live ones,
+//the first rounds warm both layouts up and are not counted.
+//
+//usage: ./taskPoolAlloc [rounds] [live] [payload bytes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <map>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "flat_map.h"
+#include "name_table.h"
+#include "task_format.h"
+#include "task_pool.h"
+
+using namespace std;
+
+static size_t g_allocs = 0;
+
+void *operator new(size_t size) {
+    void *p = malloc(size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    ++g_allocs;
+    return p;
+}
+
+void operator delete(void *p) throw() {
+    free(p);
+}
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static string seqName(int seq) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "task-%010d", seq);
+    return buf;
+}
+
+//the layout the worker had before the pool
+typedef struct LegacyTask {
+    string data;
+    TaskView view;
+    PayloadPtr blob;
+    int64_t requested;
+    string checkpoint;
+    int handler;
+} LegacyTask;
+
+typedef boost::shared_ptr<LegacyTask> LegacyTaskPtr;
+
+static void legacy(int rounds, int live, const string &data) {
+    map<string, LegacyTaskPtr> tasks;
+    set<string> running;
+    vector<string> order(live); //ring of the live tasks, oldest first
+
+    size_t allocs = 0;
+    double start = 0;
+    for (int i = 0; i < rounds + live; ++i) {
+        if (i == live) {
+            allocs = g_allocs;
+            start = now();
+        }
+
+        //fetched
+        string task = seqName(i);
+        string value(data.data(), data.size());
+        LegacyTaskPtr info(new LegacyTask());
+        info->data.swap(value);
+        info->view.parse(info->data);
+        tasks[task] = info;
+        running.insert(task);
+
+        //completed and deleted
+        string &oldest = order[i % live];
+        if (i >= live) {
+            running.erase(oldest);
+            tasks.erase(oldest);
+        }
+        oldest.swap(task);
+    }
+
+    double elapsed = now() - start;
+    printf("legacy  allocs/task:%6.2f  ns/task:%6.0f\n",
+            (double)(g_allocs - allocs) / rounds, elapsed * 1e9 / rounds);
+}
+
+static void pooled(int rounds, int live, const string &data) {
+    TaskPool pool;
+    NameTable names;
+    FlatMap<NameId, TaskInfoPtr> tasks;
+    FlatMap<NameId, char> running;
+    vector<NameId> order(live);
+
+    size_t allocs = 0;
+    double start = 0;
+    for (int i = 0; i < rounds + live; ++i) {
+        if (i == live) {
+            allocs = g_allocs;
+            start = now();
+        }
+
+        //fetched, the znode name comes from getChildren in the worker and
+        //is formatted into a stack buffer here
+        char task[32];
+        snprintf(task, sizeof(task), "task-%010d", i);
+        NameId id = names.intern(task);
+        TaskInfoPtr info = pool.acquire();
+        info->id = id;
+        info->name = task;
+        info->data.assign(data.data(), data.size());
+        info->view.parse(info->data);
+        tasks[id] = info;
+        running[id] = 1;
+
+        //completed and deleted
+        NameId &oldest = order[i % live];
+        if (i >= live) {
+            running.erase(oldest);
+            tasks.erase(oldest);
+            names.release(oldest);
+        }
+        oldest = id;
+    }
+
+    double elapsed = now() - start;
+    printf("pooled  allocs/task:%6.2f  ns/task:%6.0f  pool:%d objects\n",
+            (double)(g_allocs - allocs) / rounds, elapsed * 1e9 / rounds, (int)pool.allocated());
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 1000000;
+    int live = argc > 2 ? atoi(argv[2]) : 1000;
+    int size = argc > 3 ? atoi(argv[3]) : 512;
+
+    TaskHeader header;
+    header.type = 1;
+    string data;
+    encode_task(header, Slice("key"), Slice(string(size, 'x')), &data);
+
+    printf("rounds:%d live:%d task:%d bytes\n", rounds, live, (int)data.size());
+    legacy(rounds, live, data);
+    pooled(rounds, live, data);
+    return 0;
+}
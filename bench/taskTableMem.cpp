@@ -0,0 +1,111 @@
+//memory per task of the master assignment tables, before and after
+//interning: the old map<string,string>/map<string,int> layout against
+//NameTable + FlatMap + WorkerTable.
+//
+//usage: ./taskTableMem [tasks] [workers]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <sys/time.h>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include "name_table.h"
+#include "worker_table.h"
+
+using namespace std;
+
+static size_t g_live = 0;
+
+void *operator new(size_t size) {
+    void *p = malloc(size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    g_live += malloc_usable_size(p);
+    return p;
+}
+
+void operator delete(void *p) throw() {
+    if (p != NULL) {
+        g_live -= malloc_usable_size(p);
+        free(p);
+    }
+}
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static string seqName(const char *prefix, int seq) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%010d", prefix, seq);
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    int ntask = argc > 1 ? atoi(argv[1]) : 1000000;
+    int nworker = argc > 2 ? atoi(argv[2]) : 100;
+
+    vector<string> tasks;
+    vector<string> workers;
+    for (int i = 0; i < ntask; ++i) tasks.push_back(seqName("task-", i));
+    for (int i = 0; i < nworker; ++i) workers.push_back(seqName("work-", i));
+
+    //before
+    size_t base = g_live;
+    double start = now();
+    map<string, string> *assign = new map<string, string>();
+    map<string, int> *load = new map<string, int>();
+    for (int i = 0; i < nworker; ++i) (*load)[workers[i]] = 0;
+    for (int i = 0; i < ntask; ++i) {
+        const string &w = workers[i % nworker];
+        (*assign)[tasks[i]] = w;
+        (*load)[w]++;
+    }
+    double fill = now() - start;
+    size_t before = g_live - base;
+
+    start = now();
+    size_t hit = 0;
+    for (int i = 0; i < ntask; ++i) hit += assign->count(tasks[i]);
+    double lookup = now() - start;
+
+    printf("before: %8.1f bytes/task  fill %.3fs  lookup %.1fns/task (%zu)\n",
+            (double)before / ntask, fill, lookup * 1e9 / ntask, hit);
+    delete assign;
+    delete load;
+
+    //after
+    base = g_live;
+    start = now();
+    NameTable *names = new NameTable();
+    FlatMap<NameId, int> *table = new FlatMap<NameId, int>();
+    WorkerTable *wt = new WorkerTable();
+    vector<int> slots(nworker);
+    for (int i = 0; i < nworker; ++i) slots[i] = wt->add(names->intern(workers[i]));
+    for (int i = 0; i < ntask; ++i) {
+        int slot = slots[i % nworker];
+        (*table)[names->intern(tasks[i])] = slot;
+        wt->addLoad(slot, 1);
+    }
+    fill = now() - start;
+    size_t after = g_live - base;
+
+    start = now();
+    hit = 0;
+    for (int i = 0; i < ntask; ++i) hit += table->contains(names->find(tasks[i]));
+    lookup = now() - start;
+
+    printf("after:  %8.1f bytes/task  fill %.3fs  lookup %.1fns/task (%zu)\n",
+            (double)after / ntask, fill, lookup * 1e9 / ntask, hit);
+    delete wt;
+    delete table;
+    delete names;
+
+    return 0;
+}
@@ -6,6 +6,9 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
 #include "daemon.h"
 
 using std::cout;
@@ -16,10 +19,56 @@ static const std::string MASTERPATH = "/masters";
 static const std::string WORKERPATH = "/workers";
 static const std::string ASSIGNPATH = "/assign";
 static const std::string TASKPATH = "/tasks";
+static const std::string STATUSPATH = "/status";
+static const std::string LEASEPATH = "/leases";
+static const std::string READYPATH = "/ready";
 
-typedef struct Task {
-    char info[20];
-}Task;
+//pull mode spreads unclaimed tasks over this many READYPATH/shard-NN
+//queues, so claiming workers rarely race for the same znodes
+static const int READY_SHARDS = 16;
+
+//most tasks finished or cleaned up in one multi request
+static const int MULTI_BATCH = 128;
+
+//a worker rewrites LEASEPATH/<worker> with its running tasks this often,
+//and the master backs up a task whose lease was not renewed for LEASE_TIMEOUT_MS
+static const int LEASE_RENEW_MS = 2000;
+static const int LEASE_TIMEOUT_MS = 10000;
+
+//final state a worker reports in STATUSPATH/<task>
+enum TaskState {
+    TASK_DONE,
+    TASK_FAILED
+};
+
+//status znode data: state word, then the result on the next line if any
+inline std::string encode_status(TaskState state, const std::string &result) {
+    std::string data = state == TASK_DONE ? "done" : "failed";
+    if (!result.empty()) {
+        data += "\n" + result;
+    }
+    return data;
+}
+
+inline std::string ready_shard(int shard) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "/shard-%02d", shard);
+    return READYPATH + buf;
+}
+
+//monotonic clock in milliseconds
+inline int64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//monotonic clock in microseconds
+inline int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
 //copy String_vector to stl vector
 inline void copy_vector(const struct String_vector *vector, std::vector<std::string> &vs) {
@@ -52,7 +101,8 @@ inline std::string get_dir_name(const std::string &path) {
     return false; \
 }
 
-inline bool process(int argc, char **argv) {
+//-drain is for a worker only, whose SIGTERM handler drains it
+inline bool process(int argc, char **argv, bool drain = false) {
     if (argc == 2) {
         if (!strcmp(argv[1],"-stop")) {
             ifstream ifs(".daemon.pid");
@@ -64,8 +114,20 @@ inline bool process(int argc, char **argv) {
             } else {
                 cout << "stop failed, check if the process is running" << endl;
             }
+        } else if (drain && !strcmp(argv[1], "-drain")) {
+            //a worker stops taking tasks, finishes the running ones and exits
+            ifstream ifs(".daemon.pid");
+            int pid;
+            ifs >> pid;
+            cout << "process id :" << pid << endl;
+            if (!kill(pid, SIGTERM)) {
+                cout << "drain requested" << endl;
+            } else {
+                cout << "drain failed, check if the process is running" << endl;
+            }
         } else {
-            cout << "usage:./master -stop" << endl;
+            cout << "usage: " << argv[0] << (drain ? " [-stop|-drain]" : " [-stop]") << endl;
+            cout << "\t -drain: workers only, finish the running tasks and exit" << endl;
         }
         return true;
     }
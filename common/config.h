@@ -0,0 +1,52 @@
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include <stdlib.h>
+#include <fstream>
+#include <map>
+#include <string>
+#include "strings.h"
+
+//key=value settings read from a file in the working directory, lines
+//starting with # are comments. a missing file leaves every default.
+class Config {
+public:
+    bool load(const std::string &file) {
+        std::ifstream ifs(file.c_str());
+        if (!ifs) {
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(ifs, line)) {
+            line = strings::trim(line);
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            size_t index = line.find('=');
+            if (index == std::string::npos) {
+                continue;
+            }
+
+            m_values[strings::trim(line.substr(0, index))] = strings::trim(line.substr(index + 1));
+        }
+
+        return true;
+    }
+
+    std::string get(const std::string &key, const std::string &def) const {
+        std::map<std::string, std::string>::const_iterator it = m_values.find(key);
+        return it == m_values.end() ? def : it->second;
+    }
+
+    int getInt(const std::string &key, int def) const {
+        std::map<std::string, std::string>::const_iterator it = m_values.find(key);
+        return it == m_values.end() ? def : atoi(it->second.c_str());
+    }
+
+private:
+    std::map<std::string, std::string> m_values;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "clog.h"
+#include "clog_binary.h"
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -7,9 +8,25 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <spawn.h>
 
-#define TIME_BUF_SIZE 1024
 #define FORMAT_BUF_SIZE 4096
+#define LINE_BUF_SIZE (FORMAT_BUF_SIZE + 256)
+
+/* smallest async ring, it holds a few of the longest lines */
+#define MIN_RING_SIZE (4 * LINE_BUF_SIZE)
+
+/* the writer looks at the rings at least this often */
+#define WRITER_IDLE_MS 10
+
+/* the rotator looks at the size and age of the file this often */
+#define ROTATE_CHECK_MS 100
 
 #define THREADED
 
@@ -18,16 +35,16 @@
 #include <syscall.h>
 #include <stdlib.h>
 
-static pthread_key_t time_buffer;
 static pthread_key_t format_msg_buffer;
+static pthread_key_t line_buffer;
 
 void freeBuffer(void* p){
     if(p) free(p);
 }
 
 void prepareTSDKeys() {
-    pthread_key_create (&time_buffer, freeBuffer);
     pthread_key_create (&format_msg_buffer, freeBuffer);
+    pthread_key_create (&line_buffer, freeBuffer);
 }
 
 char* getTSData(pthread_key_t key,int size){
@@ -43,66 +60,575 @@ char* getTSData(pthread_key_t key,int size){
     return p;
 }
 
-char* get_time_buffer(){
-    return getTSData(time_buffer,TIME_BUF_SIZE);
-}
-
 char* get_format_log_buffer(){  
     return getTSData(format_msg_buffer,FORMAT_BUF_SIZE);
 }
-#else
-char* get_time_buffer(){
-    static char buf[TIME_BUF_SIZE];
-    return buf;    
-}
 
+char* get_line_buffer(){
+    return getTSData(line_buffer,LINE_BUF_SIZE);
+}
+#else
 char* get_format_log_buffer(){
     static char buf[FORMAT_BUF_SIZE];
     return buf;
 }
+
+char* get_line_buffer(){
+    static char buf[LINE_BUF_SIZE];
+    return buf;
+}
 #endif
 
 CLogLevel logLevel = CLOG_LEVEL_INFO;
 
 static FILE* logStream = NULL;
+static char* logFileName = NULL;
 FILE* getLogStream(){
     if(logStream == 0)
         logStream = stderr;
     return logStream;
 }
 
-static const char* time_now(char* now_str){
+/* "2026-01-02 15:04:05.123456", the part up to the seconds is formatted
+   again only when the second changes */
+#define TIME_LEN 26
+#define SECOND_LEN 19
+
+static __thread time_t cachedSecond = -1;
+static __thread char cachedTime[SECOND_LEN + 1];
+static __thread int cachedTid = 0;
+static pid_t cachedPid = 0;
+
+static void time_now(char* buf){
     struct timeval tv;
-    struct tm lt;
-    time_t now = 0;
-    
     gettimeofday(&tv,0);
-    now = tv.tv_sec;
-    localtime_r(&now, &lt);
+    if(tv.tv_sec != cachedSecond){
+        struct tm lt;
+        localtime_r(&tv.tv_sec, &lt);
+        strftime(cachedTime, sizeof(cachedTime), "%Y-%m-%d %H:%M:%S", &lt);
+        cachedSecond = tv.tv_sec;
+    }
 
-    strftime(now_str, TIME_BUF_SIZE, "%Y-%m-%d %H:%M:%S", &lt);
+    memcpy(buf, cachedTime, SECOND_LEN);
+    buf[SECOND_LEN] = '.';
+    long us = tv.tv_usec;
+    for(int i = TIME_LEN - 1; i > SECOND_LEN; --i){
+        buf[i] = '0' + us % 10;
+        us /= 10;
+    }
+}
 
-    return now_str;
+static int thread_id(){
+    if(cachedTid == 0)
+        cachedTid = (int) syscall(__NR_gettid);
+    return cachedTid;
 }
 
-void log_message(CLogLevel curLevel,int line,const char* funcName,
-    const char* message)
+/* the forked child is a new process whose only thread is the forking one */
+static void reset_ids(){
+    cachedTid = 0;
+    cachedPid = getpid();
+}
+
+/*
+ * async mode. a ring has one producer, the thread it belongs to, and one
+ * consumer, the writer thread. head and tail count bytes ever written and
+ * ever consumed; the producer copies a whole line before it publishes the
+ * new head, so the writer never sees half a line.
+ */
+typedef struct LogRing {
+    char* buf;
+    unsigned long size;              /* power of two */
+    unsigned long long head;         /* written by the producer */
+    unsigned long long tail;         /* written by the writer */
+    int dead;                        /* its thread exited */
+    struct LogRing* next;
+} LogRing;
+
+static int asyncMode = 0;
+static CLogOverflow asyncOverflow = CLOG_OVERFLOW_BLOCK;
+static unsigned long asyncRingSize = 0;
+static unsigned long long droppedLines = 0;
+
+static pthread_key_t ring_key;
+static pthread_mutex_t ringsMutex = PTHREAD_MUTEX_INITIALIZER;
+static LogRing* rings = NULL;        /* every ring, under ringsMutex */
+
+static pthread_mutex_t writerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writerCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t spaceCond = PTHREAD_COND_INITIALIZER;
+static int writerWaiting = 0;         /* threads blocked on a full ring */
+static pthread_t writerThread;
+
+static void ringExit(void* p){
+    __atomic_store_n(&((LogRing*)p)->dead, 1, __ATOMIC_RELEASE);
+}
+
+static LogRing* get_ring(){
+    LogRing* ring = (LogRing*)pthread_getspecific(ring_key);
+    if(ring != 0)
+        return ring;
+
+    ring = (LogRing*)calloc(1, sizeof(LogRing));
+    ring->buf = (char*)malloc(asyncRingSize);
+    if(ring->buf == 0){
+        free(ring);
+        return 0;
+    }
+    ring->size = asyncRingSize;
+    pthread_setspecific(ring_key, ring);
+
+    pthread_mutex_lock(&ringsMutex);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&ringsMutex);
+    return ring;
+}
+
+static void wake_writer(){
+    pthread_mutex_lock(&writerMutex);
+    pthread_cond_signal(&writerCond);
+    pthread_mutex_unlock(&writerMutex);
+}
+
+/* copy a line into the ring of the calling thread, false if it is dropped */
+static int ring_push(const char* line, unsigned long len){
+    LogRing* ring = get_ring();
+    if(ring == 0)
+        return 0;
+
+    unsigned long long head = ring->head;
+    for(;;){
+        unsigned long long tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if(ring->size - (head - tail) >= len)
+            break;
+
+        if(asyncOverflow == CLOG_OVERFLOW_DROP){
+            __atomic_add_fetch(&droppedLines, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+
+        /* the writer broadcasts spaceCond after every pass while someone
+           waits, the timeout only covers a missed broadcast */
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += WRITER_IDLE_MS * 1000000L;
+        if(ts.tv_nsec >= 1000000000L){
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&writerMutex);
+        writerWaiting++;
+        pthread_cond_signal(&writerCond);
+        pthread_cond_timedwait(&spaceCond, &writerMutex, &ts);
+        writerWaiting--;
+        pthread_mutex_unlock(&writerMutex);
+    }
+
+    unsigned long pos = head & (ring->size - 1);
+    unsigned long first = ring->size - pos;
+    if(first >= len){
+        memcpy(ring->buf + pos, line, len);
+    }else{
+        memcpy(ring->buf + pos, line, first);
+        memcpy(ring->buf, line + first, len - first);
+    }
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+
+    /* a ring past half full gets written now instead of at the next pass */
+    if(head + len - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) > ring->size / 2)
+        wake_writer();
+    return 1;
+}
+
+/*
+ * binary mode. a call site is registered at its first line: it gets an id
+ * and the argument types of its format, and a SITE record with the file,
+ * line and format goes out once. every line after is the record header
+ * and the raw argument bytes.
+ */
+struct ClogSite {
+    uint32_t id;
+    int nargs;                           /* -1 if written as text */
+    unsigned char types[CLOG_MAX_ARGS];
+    char* record;                        /* its SITE record, written again to a rotated file */
+    int recordLen;
+    struct ClogSite* next;
+};
+
+static int binaryMode = 0;
+static pthread_mutex_t sitesMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t nextSite = 0;
+static ClogSite* sites = NULL;           /* sites with a record, under sitesMutex */
+
+static void emit(const char* buf, int len){
+    if(__atomic_load_n(&asyncMode, __ATOMIC_ACQUIRE)){
+        ring_push(buf, len);
+        return;
+    }
+
+    fwrite(buf, 1, len, LOGSTREAM);
+    fflush(LOGSTREAM);
+}
+
+static void record_header(char* buf, int kind, CLogLevel level, uint32_t site){
+    struct timeval tv;
+    gettimeofday(&tv,0);
+
+    ClogRecord* record = (ClogRecord*)buf;
+    record->size = sizeof(ClogRecord);
+    record->kind = kind;
+    record->level = level;
+    record->reserved = 0;
+    record->site = site;
+    record->tid = thread_id();
+    record->time = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* u32 line, u16 file len, file, returns the bytes written */
+static int put_location(char* p, int line, const char* file){
+    uint32_t line32 = line;
+    uint16_t len = strlen(file) < 1024 ? strlen(file) : 1024;
+    memcpy(p, &line32, 4);
+    memcpy(p + 4, &len, 2);
+    memcpy(p + 6, file, len);
+    return 6 + len;
+}
+
+/* a TEXT record of a message formatted here, size bytes at most */
+static int text_record(char* buf, int size, CLogLevel level, int line, const char* funcName,
+    const char* format, va_list va){
+    record_header(buf, CLOG_RECORD_TEXT, level, 0);
+    int len = sizeof(ClogRecord);
+    len += put_location(buf + len, line, funcName);
+
+    int n = vsnprintf(buf + len, size - len, format, va);
+    if(n > 0)
+        len += n < size - len ? n : size - len - 1;
+    ((ClogRecord*)buf)->size = len;
+    return len;
+}
+
+static ClogSite* register_site(ClogSite** site, int line, const char* funcName, const char* format){
+    pthread_mutex_lock(&sitesMutex);
+    ClogSite* s = *site;
+    if(s != 0){
+        pthread_mutex_unlock(&sitesMutex);
+        return s;
+    }
+
+    s = (ClogSite*)calloc(1, sizeof(ClogSite));
+    s->id = ++nextSite;
+
+    ClogSpec spec;
+    const char* p = format;
+    while(s->nargs >= 0 && clog_next_spec(p, &spec)){
+        if(spec.type == 0 || s->nargs + spec.stars + 1 > CLOG_MAX_ARGS){
+            s->nargs = -1;
+            break;
+        }
+        for(int i = 0; i < spec.stars; ++i)
+            s->types[s->nargs++] = CLOG_ARG_INT;
+        s->types[s->nargs++] = spec.type;
+        p = spec.end;
+    }
+
+    if(s->nargs >= 0){
+        uint16_t fmtLen = strlen(format) < 4096 ? strlen(format) : 4096;
+        int size = sizeof(ClogRecord) + 8 + 1024 + fmtLen;
+        char* buf = (char*)malloc(size);
+        if(buf != 0){
+            record_header(buf, CLOG_RECORD_SITE, (CLogLevel)0, s->id);
+            int len = sizeof(ClogRecord);
+            len += put_location(buf + len, line, funcName);
+            memcpy(buf + len, &fmtLen, 2);
+            memcpy(buf + len + 2, format, fmtLen);
+            len += 2 + fmtLen;
+            ((ClogRecord*)buf)->size = len;
+            emit(buf, len);
+            s->record = buf;
+            s->recordLen = len;
+            s->next = sites;
+            sites = s;
+        }
+    }
+
+    __atomic_store_n(site, s, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&sitesMutex);
+    return s;
+}
+
+#define START_RECORD_LEN (sizeof(ClogRecord) + CLOG_BINARY_MAGIC_LEN)
+
+/* the START record a process writes first to every file */
+static void start_record(char* buf){
+    record_header(buf, CLOG_RECORD_START, (CLogLevel)0, 0);
+    ((ClogRecord*)buf)->tid = cachedPid;
+    ((ClogRecord*)buf)->size = START_RECORD_LEN;
+    memcpy(buf + sizeof(ClogRecord), CLOG_BINARY_MAGIC, CLOG_BINARY_MAGIC_LEN);
+}
+
+static int format_dropped(char* buf, int size, unsigned long long dropped){
+    if(binaryMode){
+        record_header(buf, CLOG_RECORD_TEXT, CLOG_LEVEL_WARN, 0);
+        int len = sizeof(ClogRecord);
+        len += put_location(buf + len, 0, "clog");
+        len += snprintf(buf + len, size - len, "dropped %llu lines", dropped);
+        ((ClogRecord*)buf)->size = len;
+        return len;
+    }
+
+    time_now(buf);
+    return TIME_LEN + snprintf(buf + TIME_LEN, size - TIME_LEN,
+            " [%d][LOG_WARN][clog] dropped %llu lines\n", (int)cachedPid, dropped);
+}
+
+static void write_all(int fd, struct iovec* iov, int count){
+    while(count > 0){
+        ssize_t n = writev(fd, iov, count);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "clog writev failed:%s\n", strerror(errno));
+            return;
+        }
+
+        while(count > 0 && (size_t)n >= iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/* one writev for the pending bytes of as many rings as fit in IOV_MAX
+   iovecs, after the dropped line. returns the bytes written */
+static unsigned long long write_rings(){
+    static struct iovec iov[IOV_MAX];
+    static LogRing* taken[IOV_MAX];
+    static unsigned long long heads[IOV_MAX];
+    static unsigned long long reported = 0;
+    static char dropLine[128];
+
+    int count = 0;
+    int ntaken = 0;
+    unsigned long long bytes = 0;
+
+    unsigned long long dropped = __atomic_load_n(&droppedLines, __ATOMIC_RELAXED);
+    if(dropped != reported){
+        int len = format_dropped(dropLine, sizeof(dropLine), dropped - reported);
+        reported = dropped;
+        iov[count].iov_base = dropLine;
+        iov[count].iov_len = len;
+        count++;
+    }
+
+    pthread_mutex_lock(&ringsMutex);
+    LogRing** prev = &rings;
+    /* a wrapped ring takes two iovecs */
+    while(*prev != 0 && count + 2 <= IOV_MAX){
+        LogRing* ring = *prev;
+        unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if(head == ring->tail){
+            /* a dead ring is empty for good once its head is read after
+               the dead flag */
+            if(__atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE) &&
+                    __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail){
+                *prev = ring->next;
+                free(ring->buf);
+                free(ring);
+                continue;
+            }
+            prev = &ring->next;
+            continue;
+        }
+
+        unsigned long pos = ring->tail & (ring->size - 1);
+        unsigned long len = head - ring->tail;
+        unsigned long first = ring->size - pos;
+        if(first >= len){
+            iov[count].iov_base = ring->buf + pos;
+            iov[count].iov_len = len;
+            count++;
+        }else{
+            iov[count].iov_base = ring->buf + pos;
+            iov[count].iov_len = first;
+            iov[count + 1].iov_base = ring->buf;
+            iov[count + 1].iov_len = len - first;
+            count += 2;
+        }
+        taken[ntaken] = ring;
+        heads[ntaken] = head;
+        ntaken++;
+        bytes += len;
+        prev = &ring->next;
+    }
+    pthread_mutex_unlock(&ringsMutex);
+
+    if(count == 0)
+        return 0;
+
+    /* rings are only freed by this thread, the taken ones stay valid */
+    write_all(fileno(LOGSTREAM), iov, count);
+    for(int i = 0; i < ntaken; ++i)
+        __atomic_store_n(&taken[i]->tail, heads[i], __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&writerMutex);
+    if(writerWaiting > 0)
+        pthread_cond_broadcast(&spaceCond);
+    pthread_mutex_unlock(&writerMutex);
+    return bytes;
+}
+
+static void* writer_loop(void*){
+    for(;;){
+        if(write_rings() > 0)
+            continue;
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += WRITER_IDLE_MS * 1000000L;
+        if(ts.tv_nsec >= 1000000000L){
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&writerMutex);
+        pthread_cond_timedwait(&writerCond, &writerMutex, &ts);
+        pthread_mutex_unlock(&writerMutex);
+    }
+    return 0;
+}
+
+/* the whole line, header and message, is formatted in place into one
+   buffer, then written or copied into the ring once */
+void log_vprintf(CLogLevel curLevel, int line, const char* funcName,
+    const char* format, va_list va)
 {
     static const char* dbgLevelStr[]={"LOG_INVALID","LOG_ERROR","LOG_WARN",
             "LOG_INFO","LOG_DEBUG"};
 
-    static pid_t pid=0;
-    if(pid==0)pid=getpid();
+    if(cachedPid==0)cachedPid=getpid();
 
-#ifndef THREADED
-    fprintf(LOGSTREAM, "%s [%d][%s][%s:%d] %s\n", time_now(get_time_buffer()),pid,
-            dbgLevelStr[curLevel],funcName,line,message);
-#else
-    fprintf(LOGSTREAM, "%s [%d:%d][%s][%s:%d] %s\n", time_now(get_time_buffer()),pid,
-            (int) syscall(__NR_gettid),
-            dbgLevelStr[curLevel],funcName,line,message);      
-#endif
-    fflush(LOGSTREAM);
+    char* buf = get_line_buffer();
+    if(!buf)
+        return;
+
+    if(binaryMode){
+        emit(buf, text_record(buf, LINE_BUF_SIZE, curLevel, line, funcName, format, va));
+        return;
+    }
+
+    time_now(buf);
+    int len = TIME_LEN;
+    len += snprintf(buf + len, LINE_BUF_SIZE - len, " [%d:%d][%s][%s:%d] ", (int)cachedPid,
+            thread_id(), dbgLevelStr[curLevel], funcName, line);
+    if(len > LINE_BUF_SIZE - 2)
+        len = LINE_BUF_SIZE - 2;
+
+    int n = vsnprintf(buf + len, LINE_BUF_SIZE - 1 - len, format, va);
+    if(n > 0)
+        len += n < LINE_BUF_SIZE - 1 - len ? n : LINE_BUF_SIZE - 2 - len;
+    buf[len++] = '\n';
+    emit(buf, len);
+}
+
+void log_printf(CLogLevel curLevel, int line, const char* funcName,
+    const char* format, ...)
+{
+    va_list va;
+    va_start(va, format);
+    log_vprintf(curLevel, line, funcName, format, va);
+    va_end(va);
+}
+
+void log_message(CLogLevel curLevel,int line,const char* funcName,
+    const char* message)
+{
+    log_printf(curLevel, line, funcName, "%s", message);
+}
+
+/* binary mode copies the arguments and formats nothing */
+void log_site(ClogSite** site, CLogLevel curLevel, int line, const char* funcName,
+    const char* format, ...)
+{
+    va_list va;
+    va_start(va, format);
+    ClogSite* s = 0;
+    if(binaryMode){
+        s = __atomic_load_n(site, __ATOMIC_ACQUIRE);
+        if(s == 0)
+            s = register_site(site, line, funcName, format);
+    }
+    if(s == 0 || s->nargs < 0){
+        log_vprintf(curLevel, line, funcName, format, va);
+        va_end(va);
+        return;
+    }
+
+    char* buf = get_line_buffer();
+    if(!buf){
+        va_end(va);
+        return;
+    }
+
+    record_header(buf, CLOG_RECORD_LOG, curLevel, s->id);
+    char* p = buf + sizeof(ClogRecord);
+    char* end = buf + LINE_BUF_SIZE;
+    for(int i = 0; i < s->nargs; ++i){
+        switch(s->types[i]){
+        case CLOG_ARG_INT: {
+            int v = va_arg(va, int);
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+        }
+        case CLOG_ARG_LONG: {
+            long long v = va_arg(va, long long);
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+        }
+        case CLOG_ARG_DOUBLE: {
+            double v = va_arg(va, double);
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+        }
+        case CLOG_ARG_LDOUBLE: {
+            long double v = va_arg(va, long double);
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+        }
+        case CLOG_ARG_PTR: {
+            uint64_t v = (uint64_t)(uintptr_t)va_arg(va, void*);
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+        }
+        case CLOG_ARG_STRING: {
+            const char* str = va_arg(va, const char*);
+            if(str == 0)
+                str = "(null)";
+            /* the fixed size arguments fit, the strings share the rest */
+            long room = (end - p) - 2 - (long)((s->nargs - i - 1) * sizeof(long double));
+            size_t n = strnlen(str, room < 0 ? 0 : (room < 0xffff ? room : 0xffff));
+            uint16_t n16 = n;
+            memcpy(p, &n16, 2);
+            memcpy(p + 2, str, n);
+            p += 2 + n;
+            break;
+        }
+        }
+    }
+    va_end(va);
+
+    ((ClogRecord*)buf)->size = p - buf;
+    emit(buf, p - buf);
 }
 
 const char* format_log_message(const char* format,...)
@@ -136,10 +662,303 @@ bool log_init(CLogLevel level, const char* log_filename) {
 #ifdef THREADED
     prepareTSDKeys();
 #endif
+    cachedPid = getpid();
+    pthread_atfork(NULL, NULL, reset_ids);
 
     logStream = fopen(log_filename, "a+");
     if (logStream == NULL) {
         fprintf(stderr,"Failed to open log file:%s", strerror(errno));
+        return false;
     }
+    free(logFileName);
+    logFileName = strdup(log_filename);
+    return true;
 }
 
+int log_every_n(unsigned long* count, unsigned long n, unsigned long* suppressed) {
+    unsigned long seen = __atomic_fetch_add(count, 1, __ATOMIC_RELAXED);
+    if (n <= 1) {
+        *suppressed = 0;
+        return 1;
+    }
+    if (seen % n != 0) {
+        return 0;
+    }
+    *suppressed = seen == 0 ? 0 : n - 1;
+    return 1;
+}
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int log_every_ms(ClogEvery* every, long long ms, unsigned long* suppressed) {
+    //+1 keeps a real time apart from the unset 0
+    long long now = now_us() / 1000 + 1;
+    long long last = __atomic_load_n(&every->last, __ATOMIC_RELAXED);
+    if ((last != 0 && now - last < ms)
+            || !__atomic_compare_exchange_n(&every->last, &last, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&every->suppressed, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    *suppressed = __atomic_exchange_n(&every->suppressed, 0, __ATOMIC_RELAXED);
+    return 1;
+}
+
+int log_rate(ClogBucket* bucket, double rate, int burst, unsigned long* suppressed) {
+    long long now = now_us();
+    while (__atomic_exchange_n(&bucket->lock, 1, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    if (bucket->last == 0) {
+        bucket->tokens = burst;
+    } else {
+        bucket->tokens += (now - bucket->last) * rate / 1e6;
+        if (bucket->tokens > burst) {
+            bucket->tokens = burst;
+        }
+    }
+    bucket->last = now;
+
+    int allowed = bucket->tokens >= 1;
+    if (allowed) {
+        bucket->tokens -= 1;
+        *suppressed = bucket->suppressed;
+        bucket->suppressed = 0;
+    } else {
+        bucket->suppressed++;
+    }
+
+    __atomic_store_n(&bucket->lock, 0, __ATOMIC_RELEASE);
+    return allowed;
+}
+
+bool log_set_binary() {
+    if (binaryMode) {
+        return true;
+    }
+    if (cachedPid == 0) {
+        cachedPid = getpid();
+    }
+
+    char buf[START_RECORD_LEN];
+    start_record(buf);
+    emit(buf, sizeof(buf));
+
+    binaryMode = 1;
+    return true;
+}
+
+static void flush_at_exit(){
+    log_flush();
+}
+
+bool log_set_async(int ring_size, CLogOverflow overflow) {
+    if (asyncMode) {
+        return true;
+    }
+
+    unsigned long size = 4096;
+    while (size < MIN_RING_SIZE || size < (unsigned long)ring_size) {
+        size <<= 1;
+    }
+    asyncRingSize = size;
+    asyncOverflow = overflow;
+
+    if (pthread_key_create(&ring_key, ringExit) != 0) {
+        return false;
+    }
+    if (pthread_create(&writerThread, NULL, writer_loop, NULL) != 0) {
+        fprintf(stderr, "Failed to start log writer:%s", strerror(errno));
+        return false;
+    }
+    pthread_detach(writerThread);
+
+    fflush(LOGSTREAM);
+    __atomic_store_n(&asyncMode, 1, __ATOMIC_RELEASE);
+    atexit(flush_at_exit);
+    return true;
+}
+
+void log_flush() {
+    if (!__atomic_load_n(&asyncMode, __ATOMIC_ACQUIRE)) {
+        fflush(LOGSTREAM);
+        return;
+    }
+
+    //the head of every ring now, later lines do not hold the flush up.
+    //a ring in the list is freed only once written out, under ringsMutex
+    pthread_mutex_lock(&ringsMutex);
+    int count = 0;
+    for (LogRing* ring = rings; ring != NULL; ring = ring->next) {
+        count++;
+    }
+    LogRing** targets = (LogRing**)malloc(count * sizeof(LogRing*) + 1);
+    unsigned long long* heads = (unsigned long long*)malloc(count * sizeof(unsigned long long) + 1);
+    count = 0;
+    for (LogRing* ring = rings; ring != NULL; ring = ring->next) {
+        targets[count] = ring;
+        heads[count] = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        count++;
+    }
+    pthread_mutex_unlock(&ringsMutex);
+
+    for (int i = 0; i < count; ++i) {
+        for (;;) {
+            pthread_mutex_lock(&ringsMutex);
+            int found = 0;
+            for (LogRing* ring = rings; ring != NULL; ring = ring->next) {
+                if (ring == targets[i]) {
+                    found = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) < heads[i];
+                    break;
+                }
+            }
+            pthread_mutex_unlock(&ringsMutex);
+            if (!found) {
+                break;
+            }
+
+            wake_writer();
+            usleep(1000);
+        }
+    }
+
+    free(targets);
+    free(heads);
+}
+
+unsigned long long log_dropped() {
+    return __atomic_load_n(&droppedLines, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * rotation. the rotator thread renames the file to file.1 and opens a new
+ * one under the old name, then moves it under the fd the stream and the
+ * async writer already use with dup2. a write goes whole to the old or the
+ * new file, so no logging thread waits for a rotation.
+ */
+static long long rotateBytes = 0;
+static int rotateSeconds = 0;
+static int rotateKeep = 1;
+static int rotateCompress = 0;
+static pthread_t rotatorThread;
+
+extern char** environ;
+
+static void segment_name(char* buf, int size, int index, int gz){
+    snprintf(buf, size, "%s.%d%s", logFileName, index, gz ? ".gz" : "");
+}
+
+/* gzip file.1 in a child, file.1.gz replaces it */
+static void compress_segment(){
+    char name[PATH_MAX];
+    segment_name(name, sizeof(name), 1, 0);
+    char* argv[] = {(char*)"gzip", (char*)"-f", name, 0};
+
+    pid_t pid;
+    int err = posix_spawnp(&pid, "gzip", NULL, NULL, argv, environ);
+    if(err != 0){
+        fprintf(stderr, "clog gzip %s failed:%s\n", name, strerror(err));
+        return;
+    }
+    while(waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+        ;
+}
+
+/* the records a binary file needs before any LOG record of this process */
+static int write_preamble(int fd){
+    char buf[START_RECORD_LEN];
+    start_record(buf);
+    if(write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf))
+        return 0;
+
+    for(ClogSite* s = sites; s != 0; s = s->next){
+        if(write(fd, s->record, s->recordLen) != s->recordLen)
+            return 0;
+    }
+    return 1;
+}
+
+static void rotate(){
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+    for(int gz = 0; gz < 2; ++gz){
+        segment_name(from, sizeof(from), rotateKeep, gz);
+        unlink(from);
+    }
+    for(int i = rotateKeep - 1; i > 0; --i){
+        for(int gz = 0; gz < 2; ++gz){
+            segment_name(from, sizeof(from), i, gz);
+            segment_name(to, sizeof(to), i + 1, gz);
+            rename(from, to);
+        }
+    }
+    segment_name(to, sizeof(to), 1, 0);
+    if(rename(logFileName, to) != 0){
+        fprintf(stderr, "clog rotate %s failed:%s\n", logFileName, strerror(errno));
+        return;
+    }
+
+    int fd = open(logFileName, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if(fd < 0){
+        fprintf(stderr, "clog open %s failed:%s\n", logFileName, strerror(errno));
+        return;
+    }
+
+    /* a site registered now waits, so its record reaches the new file
+       either from the preamble or after the swap */
+    pthread_mutex_lock(&sitesMutex);
+    if(binaryMode && !write_preamble(fd))
+        fprintf(stderr, "clog write %s failed:%s\n", logFileName, strerror(errno));
+    if(dup2(fd, fileno(LOGSTREAM)) < 0)
+        fprintf(stderr, "clog swap %s failed:%s\n", logFileName, strerror(errno));
+    pthread_mutex_unlock(&sitesMutex);
+    close(fd);
+
+    if(rotateCompress)
+        compress_segment();
+}
+
+static void* rotator_loop(void*){
+    time_t opened = time(0);
+    for(;;){
+        usleep(ROTATE_CHECK_MS * 1000);
+
+        struct stat st;
+        if(fstat(fileno(LOGSTREAM), &st) != 0 || st.st_size == 0)
+            continue;
+
+        time_t now = time(0);
+        if((rotateBytes > 0 && st.st_size >= rotateBytes)
+                || (rotateSeconds > 0 && now - opened >= rotateSeconds)){
+            rotate();
+            opened = now;
+        }
+    }
+    return 0;
+}
+
+bool log_set_rotate(long long max_bytes, int max_seconds, int keep, int compress) {
+    if (logFileName == NULL) {
+        return false;
+    }
+    if (rotateBytes > 0 || rotateSeconds > 0 || (max_bytes <= 0 && max_seconds <= 0)) {
+        return true;
+    }
+
+    rotateBytes = max_bytes;
+    rotateSeconds = max_seconds;
+    rotateKeep = keep > 0 ? keep : 1;
+    rotateCompress = compress;
+    if (pthread_create(&rotatorThread, NULL, rotator_loop, NULL) != 0) {
+        fprintf(stderr, "Failed to start log rotator:%s", strerror(errno));
+        return false;
+    }
+    pthread_detach(rotatorThread);
+    return true;
+}
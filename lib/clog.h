@@ -1,6 +1,8 @@
 #ifndef _CLOG_H_
 #define _CLOG_H_
 
+#include <stdarg.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -12,36 +14,145 @@ enum CLogLevel {
    CLOG_LEVEL_DEBUG
 };
 
+/* what a thread does when its async ring is full */
+enum CLogOverflow {
+   CLOG_OVERFLOW_BLOCK = 0,  /* wait for the writer thread */
+   CLOG_OVERFLOW_DROP        /* drop the line and count it */
+};
+
 extern CLogLevel logLevel;
+
+/* a LOG_* call site, registered at its first line in binary mode */
+struct ClogSite;
+
+/* state of a LOG_*_EVERY_MS site */
+struct ClogEvery {
+    long long last;          /* ms of the last line written */
+    unsigned long suppressed;
+};
+
+/* state of a LOG_*_RATE site */
+struct ClogBucket {
+    int lock;
+    double tokens;
+    long long last;          /* us of the last refill */
+    unsigned long suppressed;
+};
 #define LOGSTREAM getLogStream()
 
-#define LOG_ERROR(format, ARG...) do { \
-    if(logLevel>=CLOG_LEVEL_ERROR) \
-    log_message(CLOG_LEVEL_ERROR,__LINE__,__FILE__,format_log_message(format, ##ARG)); \
+/* levels above this are compiled out, build with -DCLOG_COMPILED_LEVEL=3
+   to drop every LOG_DEBUG. 1 error, 2 warn, 3 info, 4 debug */
+#ifndef CLOG_COMPILED_LEVEL
+#define CLOG_COMPILED_LEVEL 4
+#endif
+
+#define CLOG_ENABLED(level) (CLOG_COMPILED_LEVEL >= (level) && logLevel >= (level))
+
+#define CLOG_EMIT(level, format, ARG...) do { \
+    static struct ClogSite* clogSite = 0; \
+    log_site(&clogSite,level,__LINE__,__FILE__,format, ##ARG); \
 } while(0)
 
-#define LOG_WARN(format, ARG...) do { \
-    if(logLevel>=CLOG_LEVEL_WARN) \
-    log_message(CLOG_LEVEL_WARN,__LINE__,__FILE__,format_log_message(format, ##ARG)); \
+/* a line of a limited site, with the lines left out since the last one */
+#define CLOG_EMIT_SUPPRESSED(level, suppressed, format, ARG...) do { \
+    if((suppressed) == 0) CLOG_EMIT(level, format, ##ARG); \
+    else CLOG_EMIT(level, format " (%lu suppressed)", ##ARG, (unsigned long)(suppressed)); \
 } while(0)
 
-#define LOG_INFO(format, ARG...) do { \
-    if(logLevel>=CLOG_LEVEL_INFO) \
-    log_message(CLOG_LEVEL_INFO,__LINE__,__FILE__,format_log_message(format, ##ARG)); \
+#define LOG_AT(level, format, ARG...) do { \
+    if(CLOG_ENABLED(level)) CLOG_EMIT(level, format, ##ARG); \
 } while(0)
 
-#define LOG_DEBUG(format, ARG...) do { \
-    if(logLevel==CLOG_LEVEL_DEBUG) \
-    log_message(CLOG_LEVEL_DEBUG,__LINE__,__FILE__,format_log_message(format, ##ARG)); \
+/* the 1st, n+1th, 2n+1th... line of the site */
+#define LOG_EVERY_N(level, n, format, ARG...) do { \
+    static unsigned long clogCount = 0; \
+    unsigned long clogSuppressed; \
+    if(CLOG_ENABLED(level) && log_every_n(&clogCount, n, &clogSuppressed)) \
+        CLOG_EMIT_SUPPRESSED(level, clogSuppressed, format, ##ARG); \
 } while(0)
 
+/* at most one line of the site per ms */
+#define LOG_EVERY_MS(level, ms, format, ARG...) do { \
+    static struct ClogEvery clogEvery = {0, 0}; \
+    unsigned long clogSuppressed; \
+    if(CLOG_ENABLED(level) && log_every_ms(&clogEvery, ms, &clogSuppressed)) \
+        CLOG_EMIT_SUPPRESSED(level, clogSuppressed, format, ##ARG); \
+} while(0)
+
+/* token bucket: rate lines per second on average, bursts of up to burst */
+#define LOG_RATE(level, rate, burst, format, ARG...) do { \
+    static struct ClogBucket clogBucket = {0, 0, 0, 0}; \
+    unsigned long clogSuppressed; \
+    if(CLOG_ENABLED(level) && log_rate(&clogBucket, rate, burst, &clogSuppressed)) \
+        CLOG_EMIT_SUPPRESSED(level, clogSuppressed, format, ##ARG); \
+} while(0)
+
+#define LOG_ERROR(format, ARG...) LOG_AT(CLOG_LEVEL_ERROR, format, ##ARG)
+#define LOG_ERROR_EVERY_N(n, format, ARG...) LOG_EVERY_N(CLOG_LEVEL_ERROR, n, format, ##ARG)
+#define LOG_ERROR_EVERY_MS(ms, format, ARG...) LOG_EVERY_MS(CLOG_LEVEL_ERROR, ms, format, ##ARG)
+#define LOG_ERROR_RATE(rate, burst, format, ARG...) LOG_RATE(CLOG_LEVEL_ERROR, rate, burst, format, ##ARG)
+
+#define LOG_WARN(format, ARG...) LOG_AT(CLOG_LEVEL_WARN, format, ##ARG)
+#define LOG_WARN_EVERY_N(n, format, ARG...) LOG_EVERY_N(CLOG_LEVEL_WARN, n, format, ##ARG)
+#define LOG_WARN_EVERY_MS(ms, format, ARG...) LOG_EVERY_MS(CLOG_LEVEL_WARN, ms, format, ##ARG)
+#define LOG_WARN_RATE(rate, burst, format, ARG...) LOG_RATE(CLOG_LEVEL_WARN, rate, burst, format, ##ARG)
+
+#define LOG_INFO(format, ARG...) LOG_AT(CLOG_LEVEL_INFO, format, ##ARG)
+#define LOG_INFO_EVERY_N(n, format, ARG...) LOG_EVERY_N(CLOG_LEVEL_INFO, n, format, ##ARG)
+#define LOG_INFO_EVERY_MS(ms, format, ARG...) LOG_EVERY_MS(CLOG_LEVEL_INFO, ms, format, ##ARG)
+#define LOG_INFO_RATE(rate, burst, format, ARG...) LOG_RATE(CLOG_LEVEL_INFO, rate, burst, format, ##ARG)
+
+#define LOG_DEBUG(format, ARG...) LOG_AT(CLOG_LEVEL_DEBUG, format, ##ARG)
+#define LOG_DEBUG_EVERY_N(n, format, ARG...) LOG_EVERY_N(CLOG_LEVEL_DEBUG, n, format, ##ARG)
+#define LOG_DEBUG_EVERY_MS(ms, format, ARG...) LOG_EVERY_MS(CLOG_LEVEL_DEBUG, ms, format, ##ARG)
+#define LOG_DEBUG_RATE(rate, burst, format, ARG...) LOG_RATE(CLOG_LEVEL_DEBUG, rate, burst, format, ##ARG)
+
+/* format the header and the message into one line and write it */
+void log_printf(CLogLevel curLevel, int line, const char* funcName,
+    const char* format, ...);
+void log_vprintf(CLogLevel curLevel, int line, const char* funcName,
+    const char* format, va_list va);
+
 void log_message(CLogLevel curLevel, int line,const char* funcName,
     const char* message);
 
+/* log_printf of a LOG_* call site, which binary mode writes as the raw
+   arguments of a format registered once */
+void log_site(struct ClogSite** site, CLogLevel curLevel, int line, const char* funcName,
+    const char* format, ...);
+
 const char* format_log_message(const char* format,...);
 
 bool log_init(CLogLevel level, const char* log_filename);
 
+/* after log_init: every thread formats its lines into its own ring of
+   ring_size bytes, and a background thread writes them out in batches
+   with writev. call it after daemonizing, the thread does not survive a
+   fork */
+bool log_set_async(int ring_size, CLogOverflow overflow);
+
+/* whether a limited site writes this line. suppressed gets the lines left
+   out since the one written before */
+int log_every_n(unsigned long* count, unsigned long n, unsigned long* suppressed);
+int log_every_ms(struct ClogEvery* every, long long ms, unsigned long* suppressed);
+int log_rate(struct ClogBucket* bucket, double rate, int burst, unsigned long* suppressed);
+
+/* after log_init and before log_set_async: write binary records, see
+   clog_binary.h, to be expanded by tools/clogDecode */
+bool log_set_binary();
+
+/* after log_init: a background thread moves the file to
+   file.1 once it reaches max_bytes or was opened max_seconds ago, 0 for no
+   limit, and starts a new one. file.1 moves on to file.2 and so on, keep
+   of them are retained, gzipped with compress. call it after daemonizing */
+bool log_set_rotate(long long max_bytes, int max_seconds, int keep, int compress);
+
+/* wait until every line logged before the call is written */
+void log_flush();
+
+/* lines dropped by CLOG_OVERFLOW_DROP so far */
+unsigned long long log_dropped();
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,114 @@
+/**
+ * Record layout of the binary clog format, shared by clog and the decoder.
+ *
+ * author: lucusfly
+ */
+#ifndef _CLOG_BINARY_H_
+#define _CLOG_BINARY_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/* payload of the START record every process writes first */
+#define CLOG_BINARY_MAGIC "CLOGBIN1"
+#define CLOG_BINARY_MAGIC_LEN 8
+
+/* most arguments of a format kept as raw bytes, a call site with more is
+   written as text */
+#define CLOG_MAX_ARGS 32
+
+enum ClogRecordKind {
+   CLOG_RECORD_START = 1,  /* tid holds the pid, payload is the magic */
+   CLOG_RECORD_SITE,       /* u32 line, u16 file len, file, u16 format len, format */
+   CLOG_RECORD_LOG,        /* the raw arguments of the format of site */
+   CLOG_RECORD_TEXT        /* u32 line, u16 file len, file, formatted message */
+};
+
+/* how an argument is stored: INT 4 bytes, LONG, DOUBLE and PTR 8 bytes,
+   LDOUBLE sizeof(long double), STRING u16 length then the bytes */
+enum ClogArgType {
+   CLOG_ARG_INT = 1,
+   CLOG_ARG_LONG,
+   CLOG_ARG_DOUBLE,
+   CLOG_ARG_LDOUBLE,
+   CLOG_ARG_STRING,
+   CLOG_ARG_PTR
+};
+
+/* every record starts with this header, size counts the header too */
+typedef struct ClogRecord {
+    uint32_t size;
+    uint8_t kind;
+    uint8_t level;
+    uint16_t reserved;
+    uint32_t site;  /* id of the call site, 0 if none */
+    uint32_t tid;
+    uint64_t time;  /* us since the epoch */
+} ClogRecord;
+
+/* one conversion of a printf format */
+typedef struct ClogSpec {
+    const char* start;  /* the '%' */
+    const char* end;    /* past the conversion char */
+    int stars;          /* '*' width and precision, each takes an int first */
+    int type;           /* ClogArgType, 0 if the conversion is not supported */
+} ClogSpec;
+
+/* find the next conversion at or after p, "%%" is skipped. returns 0 at
+   the end of the format */
+static inline int clog_next_spec(const char* p, ClogSpec* spec) {
+    for (;;) {
+        p = strchr(p, '%');
+        if (p == NULL) {
+            return 0;
+        }
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+        break;
+    }
+
+    spec->start = p++;
+    spec->stars = 0;
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL) p++;
+    if (*p == '*') {
+        spec->stars++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->stars++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') p++;
+    }
+
+    int longs = 0;
+    int ldouble = 0;
+    while (*p != '\0' && strchr("hlLqjzt", *p) != NULL) {
+        if (*p == 'l' || *p == 'q' || *p == 'j' || *p == 'z' || *p == 't') longs++;
+        if (*p == 'L') ldouble = 1;
+        p++;
+    }
+
+    spec->type = 0;
+    if (*p != '\0') {
+        if (strchr("diouxXc", *p) != NULL) {
+            spec->type = longs > 0 ? CLOG_ARG_LONG : CLOG_ARG_INT;
+        } else if (strchr("fFeEgGaA", *p) != NULL) {
+            spec->type = ldouble ? CLOG_ARG_LDOUBLE : CLOG_ARG_DOUBLE;
+        } else if (*p == 's' && longs == 0) {
+            spec->type = CLOG_ARG_STRING;
+        } else if (*p == 'p') {
+            spec->type = CLOG_ARG_PTR;
+        }
+        p++;
+    }
+    spec->end = p;
+    return 1;
+}
+
+#endif /*_CLOG_BINARY_H_*/
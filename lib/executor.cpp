@@ -0,0 +1,253 @@
+/**
+ * Work-stealing thread pool.
+ *
+ * author: lucusfly
+ */
+
+#include "executor.h"
+
+#include <time.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include "clog.h"
+
+static __thread int t_node = -1;
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+Executor::Executor(int threads, PinMode pin) : m_queued(0), m_running(0), m_next(0), m_stop(false) {
+    Topology topology = Topology::detect();
+    if (threads <= 0) {
+        threads = topology.cpuCount();
+    }
+    if (threads <= 0) {
+        threads = 1;
+    }
+
+    //thread i goes to node i % nodes, so round robin submits spread over
+    //the nodes too
+    m_nodes.resize(topology.nodes());
+    for (int i = 0; i < threads; ++i) {
+        Slot *slot = new Slot();
+        slot->node = i % topology.nodes();
+        const std::vector<int> &cpus = topology.cpus(slot->node);
+        if (pin == PIN_NODE) {
+            slot->cpus = cpus;
+        } else if (pin == PIN_CORE) {
+            slot->cpus.push_back(cpus[m_nodes[slot->node].size() % cpus.size()]);
+        }
+        m_nodes[slot->node].push_back(i);
+        m_slots.push_back(slot);
+    }
+
+    for (int i = 0; i < threads; ++i) {
+        Slot &slot = *m_slots[i];
+        const std::vector<int> &local = m_nodes[slot.node];
+        int first = std::find(local.begin(), local.end(), i) - local.begin();
+        for (int j = 0; j < local.size(); ++j) {
+            slot.order.push_back(local[(first + j) % local.size()]);
+        }
+        for (int j = 1; j < m_nodes.size(); ++j) {
+            const std::vector<int> &remote = m_nodes[(slot.node + j) % m_nodes.size()];
+            slot.order.insert(slot.order.end(), remote.begin(), remote.end());
+        }
+    }
+
+    if (pin != PIN_NONE) {
+        LOG_INFO("executor pins %d threads %s over %d nodes", threads,
+                pin == PIN_CORE ? "per core" : "per node", topology.nodes());
+    }
+
+    for (int i = 0; i < threads; ++i) {
+        m_threads.create_thread(boost::bind(&Executor::loop, this, i));
+    }
+}
+
+Executor::~Executor() {
+    stop();
+
+    for (int i = 0; i < m_slots.size(); ++i) {
+        delete m_slots[i];
+    }
+}
+
+JobPtr Executor::submit(uint64_t key, const JobFunc &func, int node) {
+    JobPtr job(new Job(key, func));
+    job->m_enqueued = now_us();
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_jobs_mutex);
+        JobPtr &old = m_jobs[key];
+        if (old) {
+            old->cancel();
+        }
+        old = job;
+    }
+
+    unsigned next = m_next.fetch_add(1, boost::memory_order_relaxed);
+    int index = next % m_slots.size();
+    if (node >= 0 && node < m_nodes.size() && !m_nodes[node].empty()) {
+        index = m_nodes[node][next % m_nodes[node].size()];
+    }
+
+    Slot &slot = *m_slots[index];
+    {
+        boost::lock_guard<boost::mutex> guard(slot.mutex);
+        slot.jobs.push_back(job);
+    }
+    m_queued.fetch_add(1);
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_idle_mutex);
+    }
+    m_idle_cond.notify_one();
+
+    return job;
+}
+
+bool Executor::cancel(uint64_t key) {
+    boost::lock_guard<boost::mutex> guard(m_jobs_mutex);
+    JobPtr *job = m_jobs.find(key);
+    if (job == NULL) {
+        return false;
+    }
+
+    (*job)->cancel();
+    m_jobs.erase(key);
+    return true;
+}
+
+void Executor::stop() {
+    {
+        boost::lock_guard<boost::mutex> guard(m_idle_mutex);
+        if (m_stop) {
+            return;
+        }
+        m_stop = true;
+    }
+    m_idle_cond.notify_all();
+
+    m_threads.join_all();
+}
+
+int Executor::currentNode() {
+    return t_node;
+}
+
+//own deque first, then steal from the back of the others, those of the
+//same node first
+bool Executor::take(int index, JobPtr *job) {
+    const std::vector<int> &order = m_slots[index]->order;
+    for (int i = 0; i < order.size(); ++i) {
+        Slot &slot = *m_slots[order[i]];
+        {
+            boost::lock_guard<boost::mutex> guard(slot.mutex);
+            if (slot.jobs.empty()) {
+                continue;
+            }
+
+            if (i == 0) {
+                *job = slot.jobs.front();
+                slot.jobs.pop_front();
+            } else {
+                *job = slot.jobs.back();
+                slot.jobs.pop_back();
+            }
+        }
+        m_queued.fetch_sub(1);
+
+        if (i != 0) {
+            boost::lock_guard<boost::mutex> guard(m_slots[index]->mutex);
+            m_slots[index]->steals++;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void Executor::loop(int index) {
+    Slot &slot = *m_slots[index];
+    t_node = slot.node;
+    if (!slot.cpus.empty()) {
+        pin_thread(slot.cpus);
+    }
+
+    for (;;) {
+        JobPtr job;
+        if (take(index, &job)) {
+            execute(slot, job);
+            continue;
+        }
+
+        boost::mutex::scoped_lock lock(m_idle_mutex);
+        while (m_queued.load() == 0 && !m_stop) {
+            m_idle_cond.wait(lock);
+        }
+
+        if (m_queued.load() == 0 && m_stop) {
+            return;
+        }
+    }
+}
+
+void Executor::execute(Slot &slot, const JobPtr &job) {
+    int64_t start = now_us();
+
+    if (!job->cancelled()) {
+        m_running.fetch_add(1);
+        try {
+            job->m_func(*job);
+        } catch (const std::exception &e) {
+            LOG_ERROR("job %llu threw:%s", (unsigned long long)job->key(), e.what());
+        } catch (...) {
+            LOG_ERROR("job %llu threw", (unsigned long long)job->key());
+        }
+        m_running.fetch_sub(1);
+    }
+
+    int64_t end = now_us();
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_jobs_mutex);
+        JobPtr *current = m_jobs.find(job->key());
+        if (current != NULL && *current == job) {
+            m_jobs.erase(job->key());
+        }
+    }
+
+    boost::lock_guard<boost::mutex> guard(slot.mutex);
+    if (job->cancelled()) {
+        slot.cancelled++;
+    } else {
+        slot.done++;
+    }
+    slot.wait.add(start - job->m_enqueued);
+    slot.run.add(end - start);
+}
+
+ExecutorStats Executor::stats() const {
+    ExecutorStats stats;
+    stats.threads = m_slots.size();
+    stats.queued = m_queued.load();
+    stats.running = m_running.load();
+    stats.done = 0;
+    stats.cancelled = 0;
+    stats.steals = 0;
+
+    for (int i = 0; i < m_slots.size(); ++i) {
+        const Slot &slot = *m_slots[i];
+        boost::lock_guard<boost::mutex> guard(slot.mutex);
+        stats.done += slot.done;
+        stats.cancelled += slot.cancelled;
+        stats.steals += slot.steals;
+        stats.wait.merge(slot.wait);
+        stats.run.merge(slot.run);
+    }
+
+    return stats;
+}
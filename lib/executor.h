@@ -0,0 +1,129 @@
+/**
+ * Work-stealing thread pool.
+ *
+ * author: lucusfly
+ */
+#ifndef _EXECUTOR_H_
+#define _EXECUTOR_H_
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+#include "flat_map.h"
+#include "histogram.h"
+#include "topology.h"
+
+class Job;
+typedef boost::shared_ptr<Job> JobPtr;
+typedef boost::function<void (Job &)> JobFunc;
+
+//one submitted job. a cancelled job still queued is dropped, a running one
+//is expected to poll cancelled() and return early
+class Job : boost::noncopyable {
+public:
+    Job(uint64_t key, const JobFunc &func) : m_key(key), m_func(func), m_cancelled(false), m_enqueued(0) {}
+
+    uint64_t key() const { return m_key; }
+    bool cancelled() const { return m_cancelled.load(boost::memory_order_relaxed); }
+    void cancel() { m_cancelled.store(true, boost::memory_order_relaxed); }
+
+private:
+    friend class Executor;
+
+    uint64_t m_key;
+    JobFunc m_func;
+    boost::atomic<bool> m_cancelled;
+    int64_t m_enqueued; //us
+};
+
+typedef struct ExecutorStats {
+    int threads;
+    int queued;
+    int running;
+    uint64_t done;
+    uint64_t cancelled;
+    uint64_t steals;
+    Histogram wait; //us from submit to start
+    Histogram run;  //us from start to end
+} ExecutorStats;
+
+//every thread owns a deque of jobs. submit spreads jobs round robin, a
+//thread pops its own deque from the front and, when it runs dry, steals
+//from the back of the others, so one long job never strands the jobs
+//queued behind it. idle threads sleep until something is submitted.
+//
+//the threads are spread over the numa nodes in turn. with pinning a thread
+//stays on the cpus of its node, so the memory its jobs touch first is
+//allocated on that node, and it steals from the threads of its own node
+//before crossing to another.
+class Executor : boost::noncopyable {
+public:
+    //threads <= 0 uses one thread per usable cpu
+    explicit Executor(int threads = 0, PinMode pin = PIN_NONE);
+    ~Executor();
+
+    //queue func under key, a key still queued or running is replaced.
+    //node >= 0 queues it to the threads of that node
+    JobPtr submit(uint64_t key, const JobFunc &func, int node = -1);
+
+    //cancel the job of key, false if it is not queued or running
+    bool cancel(uint64_t key);
+
+    //finish queued jobs and join the threads
+    void stop();
+
+    int threads() const { return m_slots.size(); }
+    int nodes() const { return m_nodes.size(); }
+
+    //node of the calling executor thread, -1 outside the executor
+    static int currentNode();
+    int queued() const { return m_queued.load(); }
+    int running() const { return m_running.load(); }
+
+    ExecutorStats stats() const;
+
+private:
+    struct Slot {
+        mutable boost::mutex mutex;
+        std::deque<JobPtr> jobs;
+        Histogram wait;
+        Histogram run;
+        uint64_t done;
+        uint64_t cancelled;
+        uint64_t steals;
+        int node;
+        std::vector<int> cpus; //pinned to, empty if floating
+        std::vector<int> order; //slots to take from, own node first
+
+        Slot() : done(0), cancelled(0), steals(0), node(0) {}
+    };
+
+    void loop(int index);
+    bool take(int index, JobPtr *job);
+    void execute(Slot &slot, const JobPtr &job);
+
+private:
+    std::vector<Slot*> m_slots;
+    std::vector<std::vector<int> > m_nodes; //node -> its slots
+    boost::thread_group m_threads;
+
+    boost::atomic<int> m_queued;
+    boost::atomic<int> m_running;
+    boost::atomic<unsigned> m_next;
+    bool m_stop;
+
+    boost::mutex m_idle_mutex;
+    boost::condition_variable m_idle_cond;
+
+    mutable boost::mutex m_jobs_mutex;
+    FlatMap<uint64_t, JobPtr> m_jobs; //key -> queued or running job
+};
+
+#endif
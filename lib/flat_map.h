@@ -0,0 +1,179 @@
+/**
+ * Open addressing hash map for integer keys.
+ *
+ * author: lucusfly
+ */
+#ifndef _FLAT_MAP_H_
+#define _FLAT_MAP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+//keys and values live in two parallel arrays probed linearly, so a lookup
+//touches one or two cache lines and an entry costs sizeof(Key)+sizeof(Value)
+//instead of a tree node. erase uses backward shift, so there are no
+//tombstones and the table never degrades under insert/erase churn.
+//
+//EmptyKey marks a free slot and must never be inserted.
+template<typename Key, typename Value, Key EmptyKey = Key(-1)>
+class FlatMap {
+public:
+    FlatMap() : m_size(0) {}
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    //number of slots, used with occupied()/keyAt()/valueAt() to iterate
+    size_t capacity() const { return m_keys.size(); }
+
+    bool occupied(size_t slot) const { return m_keys[slot] != EmptyKey; }
+    Key keyAt(size_t slot) const { return m_keys[slot]; }
+    Value &valueAt(size_t slot) { return m_values[slot]; }
+    const Value &valueAt(size_t slot) const { return m_values[slot]; }
+
+    Value *find(Key key) {
+        size_t slot;
+        return lookup(key, &slot) ? &m_values[slot] : NULL;
+    }
+
+    const Value *find(Key key) const {
+        size_t slot;
+        return lookup(key, &slot) ? &m_values[slot] : NULL;
+    }
+
+    bool contains(Key key) const {
+        size_t slot;
+        return lookup(key, &slot);
+    }
+
+    //insert a default value if key is absent
+    Value &operator[](Key key) {
+        size_t slot;
+        if (lookup(key, &slot)) {
+            return m_values[slot];
+        }
+
+        if ((m_size + 1) * 4 > m_keys.size() * 3) {
+            grow();
+            lookup(key, &slot);
+        }
+
+        m_keys[slot] = key;
+        m_values[slot] = Value();
+        ++m_size;
+        return m_values[slot];
+    }
+
+    bool erase(Key key) {
+        size_t hole;
+        if (!lookup(key, &hole)) {
+            return false;
+        }
+
+        //shift following entries of the probe run back into the hole
+        size_t mask = m_keys.size() - 1;
+        size_t next = (hole + 1) & mask;
+        while (m_keys[next] != EmptyKey) {
+            size_t home = hash(m_keys[next]) & mask;
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                m_keys[hole] = m_keys[next];
+                m_values[hole] = m_values[next];
+                hole = next;
+            }
+            next = (next + 1) & mask;
+        }
+
+        m_keys[hole] = EmptyKey;
+        m_values[hole] = Value();
+        --m_size;
+        return true;
+    }
+
+    void clear() {
+        m_keys.assign(m_keys.size(), EmptyKey);
+        m_values.assign(m_values.size(), Value());
+        m_size = 0;
+    }
+
+    //size the table so that n entries fit without rehashing
+    void reserve(size_t n) {
+        size_t cap = 16;
+        while (cap * 3 < n * 4) {
+            cap <<= 1;
+        }
+
+        if (cap > m_keys.size()) {
+            rehash(cap);
+        }
+    }
+
+    //bytes held by the table itself
+    size_t memoryUsage() const {
+        return m_keys.capacity() * sizeof(Key) + m_values.capacity() * sizeof(Value);
+    }
+
+private:
+    static size_t hash(Key key) {
+        uint64_t x = (uint64_t)key;
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return (size_t)x;
+    }
+
+    //return true and the slot of key, or false and the free slot to use
+    bool lookup(Key key, size_t *slot) const {
+        if (m_keys.empty()) {
+            *slot = 0;
+            return false;
+        }
+
+        size_t mask = m_keys.size() - 1;
+        size_t i = hash(key) & mask;
+        while (m_keys[i] != EmptyKey) {
+            if (m_keys[i] == key) {
+                *slot = i;
+                return true;
+            }
+            i = (i + 1) & mask;
+        }
+
+        *slot = i;
+        return false;
+    }
+
+    void grow() {
+        rehash(m_keys.empty() ? 16 : m_keys.size() * 2);
+    }
+
+    void rehash(size_t cap) {
+        std::vector<Key> keys(cap, EmptyKey);
+        std::vector<Value> values(cap);
+        keys.swap(m_keys);
+        values.swap(m_values);
+
+        size_t mask = cap - 1;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (keys[i] == EmptyKey) {
+                continue;
+            }
+
+            size_t j = hash(keys[i]) & mask;
+            while (m_keys[j] != EmptyKey) {
+                j = (j + 1) & mask;
+            }
+            m_keys[j] = keys[i];
+            m_values[j] = values[i];
+        }
+    }
+
+private:
+    std::vector<Key> m_keys;
+    std::vector<Value> m_values;
+    size_t m_size;
+};
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * Fixed size log-linear histogram.
+ *
+ * author: lucusfly
+ */
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+//counts values in log-linear buckets: exact below 16, then 8 buckets per
+//power of two, so any percentile is within 12.5% of the true value. it
+//never allocates and adding a value is a few shifts.
+class Histogram {
+public:
+    static const int LINEAR = 16;
+    static const int SUB_BITS = 3;
+    static const int BUCKETS = LINEAR + (64 - 4) * (1 << SUB_BITS);
+
+    Histogram() { reset(); }
+
+    void reset() {
+        memset(m_counts, 0, sizeof(m_counts));
+        m_count = 0;
+        m_sum = 0;
+        m_max = 0;
+    }
+
+    void add(uint64_t value) {
+        ++m_counts[bucket(value)];
+        ++m_count;
+        m_sum += value;
+        if (value > m_max) m_max = value;
+    }
+
+    void merge(const Histogram &that) {
+        for (int i = 0; i < BUCKETS; ++i) {
+            m_counts[i] += that.m_counts[i];
+        }
+        m_count += that.m_count;
+        m_sum += that.m_sum;
+        if (that.m_max > m_max) m_max = that.m_max;
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_count == 0 ? 0 : (double)m_sum / m_count; }
+
+    //upper bound of the bucket holding the q quantile, q in [0, 1]
+    uint64_t percentile(double q) const {
+        if (m_count == 0) {
+            return 0;
+        }
+
+        uint64_t rank = (uint64_t)(q * m_count);
+        if (rank >= m_count) rank = m_count - 1;
+
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += m_counts[i];
+            if (seen > rank) {
+                uint64_t upper = upperBound(i);
+                return upper < m_max ? upper : m_max;
+            }
+        }
+
+        return m_max;
+    }
+
+private:
+    static int bucket(uint64_t value) {
+        if (value < LINEAR) {
+            return (int)value;
+        }
+
+        int msb = 63 - __builtin_clzll(value);
+        int sub = (int)(value >> (msb - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+        return LINEAR + (msb - 4) * (1 << SUB_BITS) + sub;
+    }
+
+    static uint64_t upperBound(int index) {
+        if (index < LINEAR) {
+            return index;
+        }
+
+        int msb = (index - LINEAR) / (1 << SUB_BITS) + 4;
+        uint64_t sub = (index - LINEAR) % (1 << SUB_BITS);
+        uint64_t base = (uint64_t)1 << msb;
+        return base + ((sub + 1) << (msb - SUB_BITS)) - 1;
+    }
+
+private:
+    uint32_t m_counts[BUCKETS];
+    uint64_t m_count;
+    uint64_t m_sum;
+    uint64_t m_max;
+};
+
+#endif
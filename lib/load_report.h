@@ -0,0 +1,67 @@
+/**
+ * Load report a worker publishes in WORKERPATH/<worker>.
+ *
+ * author: lucusfly
+ */
+#ifndef _LOAD_REPORT_H_
+#define _LOAD_REPORT_H_
+
+#include <stdint.h>
+#include <string>
+
+//a worker whose machine is this busy is only picked if every worker is
+static const int LOAD_BUSY_CPU = 90;
+static const int LOAD_BUSY_MEM = 95;
+
+static const uint8_t LOAD_REPORT_VERSION = 1;
+
+//flags byte: the worker takes no new tasks and exits once its running
+//tasks are done
+static const uint8_t LOAD_FLAG_DRAINING = 0x01;
+static const size_t LOAD_REPORT_SIZE = 10;
+
+typedef struct LoadReport {
+    uint16_t queued;  //tasks waiting for a thread
+    uint16_t running; //tasks on a thread
+    uint16_t threads; //executor threads
+    uint8_t cpu;      //percent of the machine busy since the last sample
+    uint8_t mem;      //percent of memory in use
+    bool draining;
+
+    LoadReport() : queued(0), running(0), threads(0), cpu(0), mem(0), draining(false) {}
+
+    bool busy() const { return cpu >= LOAD_BUSY_CPU || mem >= LOAD_BUSY_MEM; }
+} LoadReport;
+
+//10 bytes, little endian: version, cpu, mem, flags, queued, running, threads.
+//flags was a zero reserved byte before draining, so old reports decode as
+//not draining
+inline std::string encode_load(const LoadReport &report) {
+    char buf[LOAD_REPORT_SIZE] = {
+        (char)LOAD_REPORT_VERSION, (char)report.cpu, (char)report.mem,
+        (char)(report.draining ? LOAD_FLAG_DRAINING : 0),
+        (char)report.queued, (char)(report.queued >> 8),
+        (char)report.running, (char)(report.running >> 8),
+        (char)report.threads, (char)(report.threads >> 8)
+    };
+    return std::string(buf, sizeof(buf));
+}
+
+//false for data that is not a report, e.g. the empty node of an old worker.
+//a longer report of a newer worker is read up to the fields known here
+inline bool decode_load(const std::string &data, LoadReport *report) {
+    if (data.size() < LOAD_REPORT_SIZE || (uint8_t)data[0] < LOAD_REPORT_VERSION) {
+        return false;
+    }
+
+    const uint8_t *p = (const uint8_t *)data.data();
+    report->cpu = p[1];
+    report->mem = p[2];
+    report->draining = (p[3] & LOAD_FLAG_DRAINING) != 0;
+    report->queued = p[4] | p[5] << 8;
+    report->running = p[6] | p[7] << 8;
+    report->threads = p[8] | p[9] << 8;
+    return true;
+}
+
+#endif
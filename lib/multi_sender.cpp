@@ -0,0 +1,106 @@
+/**
+ * Windowed multi requests over several ZooKeeper sessions.
+ *
+ * author: lucusfly
+ */
+
+#include "multi_sender.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+using namespace std;
+
+MultiSender::MultiSender(const vector<ZooKeeper*> &sessions, int window, int tolerated)
+    : m_sessions(sessions), m_next(0), m_window(window > 0 ? window : 1), m_tolerated(tolerated),
+    m_interval(0), m_inflight(0), m_error(ZOK), m_applied(0), m_dropped(0), m_batches(NULL) {}
+
+void MultiSender::setTick(const Tick &tick, int intervalMs) {
+    m_tick = tick;
+    m_interval = intervalMs > 0 ? intervalMs : 1000;
+}
+
+ZooKeeper *MultiSender::next() {
+    return m_sessions[m_next++ % m_sessions.size()];
+}
+
+int MultiSender::send(deque<vector<ZooOp> > &batches) {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_error = ZOK;
+    m_batches = &batches;
+
+    for (;;) {
+        while (m_error == ZOK && m_inflight < m_window && !batches.empty()) {
+            vector<ZooOp> ops;
+            ops.swap(batches.front());
+            batches.pop_front();
+            ++m_inflight;
+
+            lock.unlock();
+            int ret = next()->amulti(ops, boost::bind(&MultiSender::onMulti, this, ops, _1, _2));
+            lock.lock();
+            if (ret != ZOK) {
+                --m_inflight;
+                if (m_error == ZOK) {
+                    m_error = ret;
+                }
+            }
+        }
+
+        if (m_inflight == 0 && (batches.empty() || m_error != ZOK)) {
+            break;
+        }
+
+        if (!m_tick) {
+            m_cond.wait(lock);
+        } else {
+            m_cond.timed_wait(lock, boost::posix_time::milliseconds(m_interval));
+            lock.unlock();
+            m_tick();
+            lock.lock();
+        }
+    }
+
+    batches.clear();
+    m_batches = NULL;
+    return m_error;
+}
+
+uint64_t MultiSender::applied() {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    return m_applied;
+}
+
+uint64_t MultiSender::dropped() {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    return m_dropped;
+}
+
+void MultiSender::reset() {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    m_applied = 0;
+    m_dropped = 0;
+}
+
+void MultiSender::onMulti(const vector<ZooOp> &ops, int code, const vector<int> &results) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    --m_inflight;
+
+    if (code == ZOK) {
+        m_applied += ops.size();
+    } else {
+        int failed = ZooKeeper::failedOp(results);
+        if (failed >= 0 && results[failed] == m_tolerated) {
+            ++m_dropped;
+            vector<ZooOp> rest(ops);
+            rest.erase(rest.begin() + failed);
+            if (!rest.empty()) {
+                m_batches->push_front(rest);
+            }
+        } else if (m_error == ZOK) {
+            m_error = code;
+        }
+    }
+
+    m_cond.notify_one();
+}
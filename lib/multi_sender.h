@@ -0,0 +1,66 @@
+/**
+ * Windowed multi requests over several ZooKeeper sessions.
+ *
+ * author: lucusfly
+ */
+#ifndef _MULTI_SENDER_H_
+#define _MULTI_SENDER_H_
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+#include "zookeeper.h"
+
+//sends multis with up to window in flight, round robin over the sessions.
+//a multi is all or nothing, so one that fails on an op with the tolerated
+//code, e.g. ZNONODE for removes, is sent again without that op. any other
+//error stops the sends.
+class MultiSender : boost::noncopyable {
+public:
+    typedef boost::function<void ()> Tick;
+
+    //the sessions are borrowed and must outlive the sender
+    MultiSender(const std::vector<ZooKeeper*> &sessions, int window, int tolerated);
+
+    //called on the thread of send, without the lock, about every
+    //intervalMs while it waits
+    void setTick(const Tick &tick, int intervalMs);
+
+    //send every batch and wait for them, batches is empty afterwards.
+    //returns the first error that is not tolerated, ZOK if none
+    int send(std::deque<std::vector<ZooOp> > &batches);
+
+    //ops applied and ops dropped for the tolerated code, since reset
+    uint64_t applied();
+    uint64_t dropped();
+    void reset();
+
+private:
+    ZooKeeper *next();
+
+    //callback, on the zookeeper completion threads
+    void onMulti(const std::vector<ZooOp> &ops, int code, const std::vector<int> &results);
+
+private:
+    std::vector<ZooKeeper*> m_sessions;
+    size_t m_next;
+    int m_window;
+    int m_tolerated;
+
+    Tick m_tick;
+    int m_interval;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+    int m_inflight;
+    int m_error;                                 //first error, ZOK if none
+    uint64_t m_applied;
+    uint64_t m_dropped;
+    std::deque<std::vector<ZooOp> > *m_batches;  //of the running send
+};
+
+#endif
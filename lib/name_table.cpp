@@ -0,0 +1,209 @@
+/**
+ * Interning of znode names to integer ids.
+ *
+ * author: lucusfly
+ */
+
+#include "name_table.h"
+
+#include <stdio.h>
+
+using std::string;
+using std::vector;
+
+const NameId NameTable::SPILL_BIT;
+const int NameTable::SEQUENCE_DIGITS;
+
+static const uint32_t SPILL_NONE = (uint32_t)-1;
+
+bool NameTable::parseSequence(const string &name, string *prefix, uint32_t *seq) {
+    if (name.size() < (size_t)SEQUENCE_DIGITS) {
+        return false;
+    }
+
+    size_t start = name.size() - SEQUENCE_DIGITS;
+    uint64_t value = 0;
+    for (size_t i = start; i < name.size(); ++i) {
+        char c = name[i];
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + (c - '0');
+    }
+
+    //zookeeper counters are signed 32 bit, anything larger is not ours
+    if (value > 0xffffffffULL) {
+        return false;
+    }
+
+    if (prefix != NULL) {
+        prefix->assign(name, 0, start);
+    }
+    *seq = (uint32_t)value;
+    return true;
+}
+
+NameId NameTable::findPrefix(const string &name, size_t len) const {
+    for (size_t i = 0; i < m_prefixes.size(); ++i) {
+        if (m_prefixes[i].size() == len && name.compare(0, len, m_prefixes[i]) == 0) {
+            return i;
+        }
+    }
+
+    return INVALID_NAME;
+}
+
+uint64_t NameTable::hash(const string &name) {
+    //FNV-1a, kept away from the FlatMap empty key
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < name.size(); ++i) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h == (uint64_t)-1 ? h - 1 : h;
+}
+
+NameId NameTable::findSpilled(const string &name, uint64_t h) const {
+    const uint32_t *head = m_spill_index.find(h);
+    if (head == NULL) {
+        return INVALID_NAME;
+    }
+
+    for (uint32_t i = *head; i != SPILL_NONE; i = m_spill_next[i]) {
+        if (m_spilled[i] == name) {
+            return SPILL_BIT | i;
+        }
+    }
+
+    return INVALID_NAME;
+}
+
+//the prefix is compared in place, so a known sequential name costs no allocation
+NameId NameTable::intern(const string &name) {
+    uint32_t seq;
+    if (parseSequence(name, NULL, &seq)) {
+        size_t len = name.size() - SEQUENCE_DIGITS;
+        NameId index = findPrefix(name, len);
+        if (index == INVALID_NAME) {
+            index = m_prefixes.size();
+            m_prefixes.push_back(name.substr(0, len));
+        }
+
+        return (index << 32) | seq;
+    }
+
+    uint64_t h = hash(name);
+    NameId id = findSpilled(name, h);
+    if (id != INVALID_NAME) {
+        return id;
+    }
+
+    uint32_t index;
+    if (!m_spill_free.empty()) {
+        index = m_spill_free.back();
+        m_spill_free.pop_back();
+        m_spilled[index] = name;
+    } else {
+        index = m_spilled.size();
+        m_spilled.push_back(name);
+        m_spill_next.push_back(SPILL_NONE);
+    }
+
+    uint32_t *head = m_spill_index.find(h);
+    if (head != NULL) {
+        m_spill_next[index] = *head;
+        *head = index;
+    } else {
+        m_spill_next[index] = SPILL_NONE;
+        m_spill_index[h] = index;
+    }
+
+    return SPILL_BIT | index;
+}
+
+NameId NameTable::find(const string &name) const {
+    uint32_t seq;
+    if (parseSequence(name, NULL, &seq)) {
+        NameId index = findPrefix(name, name.size() - SEQUENCE_DIGITS);
+        return index == INVALID_NAME ? INVALID_NAME : ((index << 32) | seq);
+    }
+
+    return findSpilled(name, hash(name));
+}
+
+string NameTable::name(NameId id) const {
+    if (id & SPILL_BIT) {
+        uint32_t index = (uint32_t)(id & ~SPILL_BIT);
+        return index < m_spilled.size() ? m_spilled[index] : string();
+    }
+
+    uint32_t index = (uint32_t)(id >> 32);
+    if (index >= m_prefixes.size()) {
+        return string();
+    }
+
+    char seq[SEQUENCE_DIGITS + 1];
+    snprintf(seq, sizeof(seq), "%010u", (uint32_t)id);
+    return m_prefixes[index] + seq;
+}
+
+void NameTable::release(NameId id) {
+    if (!(id & SPILL_BIT)) {
+        return;
+    }
+
+    uint32_t index = (uint32_t)(id & ~SPILL_BIT);
+    if (index >= m_spilled.size()) {
+        return;
+    }
+
+    uint64_t h = hash(m_spilled[index]);
+    uint32_t *head = m_spill_index.find(h);
+    if (head == NULL) {
+        return;
+    }
+
+    //unlink index from its hash chain
+    if (*head == index) {
+        if (m_spill_next[index] == SPILL_NONE) {
+            m_spill_index.erase(h);
+        } else {
+            *head = m_spill_next[index];
+        }
+    } else {
+        uint32_t i = *head;
+        while (i != SPILL_NONE && m_spill_next[i] != index) {
+            i = m_spill_next[i];
+        }
+        if (i == SPILL_NONE) {
+            return;
+        }
+        m_spill_next[i] = m_spill_next[index];
+    }
+
+    string().swap(m_spilled[index]);
+    m_spill_next[index] = SPILL_NONE;
+    m_spill_free.push_back(index);
+}
+
+void NameTable::clear() {
+    m_prefixes.clear();
+    m_spilled.clear();
+    m_spill_free.clear();
+    m_spill_index.clear();
+    m_spill_next.clear();
+}
+
+size_t NameTable::memoryUsage() const {
+    size_t bytes = m_spill_index.memoryUsage()
+        + m_spill_next.capacity() * sizeof(uint32_t)
+        + m_spill_free.capacity() * sizeof(uint32_t)
+        + (m_prefixes.capacity() + m_spilled.capacity()) * sizeof(string);
+
+    for (size_t i = 0; i < m_spilled.size(); ++i) {
+        bytes += m_spilled[i].capacity();
+    }
+
+    return bytes;
+}
@@ -0,0 +1,75 @@
+/**
+ * Interning of znode names to integer ids.
+ *
+ * author: lucusfly
+ */
+#ifndef _NAME_TABLE_H_
+#define _NAME_TABLE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "flat_map.h"
+
+typedef uint64_t NameId;
+
+static const NameId INVALID_NAME = (NameId)-1;
+
+//maps znode names like "task-0000000012" to 64 bit ids and back.
+//
+//sequential znodes end with a 10 digit counter, so such a name is encoded
+//as (prefix index << 32 | counter) and nothing is stored per name: the
+//prefix ("task-", "work-") is kept once and the name is rebuilt on demand.
+//any other name is spilled into a string table and its id has the top bit
+//set; spilled names are released with release().
+class NameTable {
+public:
+    NameTable() {}
+
+    //return the id of name, adding it if needed
+    NameId intern(const std::string &name);
+
+    //return the id of name or INVALID_NAME, never adds
+    NameId find(const std::string &name) const;
+
+    //rebuild the name of id
+    std::string name(NameId id) const;
+
+    //forget a spilled name, sequential ids need no release
+    void release(NameId id);
+
+    //forget every name
+    void clear();
+
+    //stable 64 bit hash of a name, never the FlatMap empty key
+    static uint64_t hash(const std::string &name);
+
+    //parse the sequence counter of a znode name, false if it has none
+    static bool parseSequence(const std::string &name, std::string *prefix, uint32_t *seq);
+
+    //bytes held by the table, excluding the NameTable object itself
+    size_t memoryUsage() const;
+
+private:
+    static const NameId SPILL_BIT = (NameId)1 << 63;
+    static const int SEQUENCE_DIGITS = 10;
+
+    //index of the first len bytes of name among the prefixes
+    NameId findPrefix(const std::string &name, size_t len) const;
+    NameId findSpilled(const std::string &name, uint64_t h) const;
+
+    NameTable(const NameTable &that);
+    NameTable &operator = (const NameTable &that);
+
+private:
+    std::vector<std::string> m_prefixes;
+
+    std::vector<std::string> m_spilled;
+    std::vector<uint32_t> m_spill_free;
+    //name hash -> first spilled index with that hash; the rare collisions
+    //are chained through m_spill_next
+    FlatMap<uint64_t, uint32_t> m_spill_index;
+    std::vector<uint32_t> m_spill_next;
+};
+
+#endif
@@ -0,0 +1,201 @@
+/**
+ * Out-of-band storage for task payloads too big for a znode.
+ *
+ * author: lucusfly
+ */
+
+#include "payload_store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "clog.h"
+
+using std::string;
+
+const string FilePayloadStore::SCHEME = "file:";
+
+class MappedPayload : public Payload {
+public:
+    MappedPayload(void *addr, size_t size) : m_addr(addr), m_size(size) {}
+
+    ~MappedPayload() {
+        if (m_size > 0) {
+            munmap(m_addr, m_size);
+        }
+    }
+
+    Slice data() const { return Slice((const char *)m_addr, m_size); }
+
+private:
+    void *m_addr;
+    size_t m_size;
+};
+
+//fnv-1a 64 and crc32 of the content plus its size, in hex
+static string digest(const Slice &data) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < data.size; ++i) {
+        h ^= (uint8_t)data.data[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%016llx%08x-%llu", (unsigned long long)h,
+            crc32(data.data, data.size), (unsigned long long)data.size);
+    return buf;
+}
+
+static bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+FilePayloadStore::FilePayloadStore(const string &dir) : m_dir(dir) {
+    if (mkdir(m_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        LOG_ERROR("create payload dir %s failed:%s", m_dir.c_str(), strerror(errno));
+    }
+}
+
+string FilePayloadStore::pathOf(const string &ref) const {
+    if (ref.compare(0, SCHEME.size(), SCHEME) != 0) {
+        return "";
+    }
+
+    string id = ref.substr(SCHEME.size());
+    if (id.size() < 3 || id.find('/') != string::npos || id[0] == '.') {
+        return "";
+    }
+
+    //fan out over 256 subdirectories by the first digest byte
+    return m_dir + "/" + id.substr(0, 2) + "/" + id;
+}
+
+bool FilePayloadStore::put(const Slice &data, string *ref) {
+    string id = digest(data);
+    string path = pathOf(SCHEME + id);
+
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && (size_t)st.st_size == data.size) {
+        //same digest and size, the content is already stored. touch it so
+        //collection by age keeps it as long as its newest task
+        if (utimes(path.c_str(), NULL) != 0) {
+            LOG_WARN("touch %s failed:%s", path.c_str(), strerror(errno));
+        }
+        *ref = SCHEME + id;
+        return true;
+    }
+
+    string subdir = m_dir + "/" + id.substr(0, 2);
+    if (mkdir(subdir.c_str(), 0755) != 0 && errno != EEXIST) {
+        LOG_ERROR("create %s failed:%s", subdir.c_str(), strerror(errno));
+        return false;
+    }
+
+    //write a temporary file and rename it, so readers never see a partial blob.
+    //the host keeps the name unique across the clients sharing the dir
+    char host[64];
+    if (gethostname(host, sizeof(host)) != 0) {
+        strcpy(host, "unknown");
+    }
+    host[sizeof(host) - 1] = '\0';
+    char tmp[128];
+    snprintf(tmp, sizeof(tmp), ".tmp-%s-%d-%lx", host, (int)getpid(), (unsigned long)pthread_self());
+    string tmpPath = subdir + "/" + tmp;
+
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("open %s failed:%s", tmpPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = writeAll(fd, data.data, data.size) && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        LOG_ERROR("write %s failed:%s", path.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    *ref = SCHEME + id;
+    return true;
+}
+
+PayloadPtr FilePayloadStore::get(const string &ref) {
+    string path = pathOf(ref);
+    if (path.empty()) {
+        return PayloadPtr();
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("open %s failed:%s", path.c_str(), strerror(errno));
+        return PayloadPtr();
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        LOG_ERROR("stat %s failed:%s", path.c_str(), strerror(errno));
+        close(fd);
+        return PayloadPtr();
+    }
+
+    //mmap of an empty file fails, an empty payload needs no mapping
+    size_t size = st.st_size;
+    void *addr = NULL;
+    if (size > 0) {
+        addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            LOG_ERROR("mmap %s failed:%s", path.c_str(), strerror(errno));
+            close(fd);
+            return PayloadPtr();
+        }
+    }
+    close(fd);
+
+    return PayloadPtr(new MappedPayload(addr, size));
+}
+
+bool FilePayloadStore::remove(const string &ref) {
+    string path = pathOf(ref);
+    if (path.empty()) {
+        return false;
+    }
+
+    if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+        LOG_ERROR("remove %s failed:%s", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool encode_task_payload(PayloadStore *store, TaskHeader header, const Slice &key,
+        const Slice &payload, string *out) {
+    if (store == NULL || payload.size <= PAYLOAD_INLINE_LIMIT) {
+        return encode_task(header, key, payload, out);
+    }
+
+    string ref;
+    if (!store->put(payload, &ref)) {
+        return false;
+    }
+
+    header.flags |= TASK_FLAG_PAYLOAD_REF;
+    return encode_task(header, key, ref, out);
+}
@@ -0,0 +1,71 @@
+/**
+ * Out-of-band storage for task payloads too big for a znode.
+ *
+ * author: lucusfly
+ */
+#ifndef _PAYLOAD_STORE_H_
+#define _PAYLOAD_STORE_H_
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+#include "task_format.h"
+
+//set in the envelope flags when the payload is a store reference
+static const uint8_t TASK_FLAG_PAYLOAD_REF = 0x01;
+
+//payloads up to this size stay inline in the task znode
+static const size_t PAYLOAD_INLINE_LIMIT = 64 * 1024;
+
+//bytes of one stored payload, valid as long as the object lives
+class Payload : boost::noncopyable {
+public:
+    virtual ~Payload() {}
+    virtual Slice data() const = 0;
+};
+
+typedef boost::shared_ptr<Payload> PayloadPtr;
+
+//blob storage addressed by references of the form "<scheme>:<id>"
+class PayloadStore : boost::noncopyable {
+public:
+    virtual ~PayloadStore() {}
+
+    //store data and return its reference
+    virtual bool put(const Slice &data, std::string *ref) = 0;
+
+    //NULL if ref is not in this store
+    virtual PayloadPtr get(const std::string &ref) = 0;
+
+    //only once no live task refers to ref, which another task may share
+    virtual bool remove(const std::string &ref) = 0;
+};
+
+//content addressed blobs in a directory shared by producers and workers.
+//the id is a digest of the content, so storing the same payload twice
+//keeps one file that both tasks read. blobs are collected by age, put
+//touches a blob it finds already stored. reads mmap the file and never
+//copy it.
+class FilePayloadStore : public PayloadStore {
+public:
+    explicit FilePayloadStore(const std::string &dir);
+
+    bool put(const Slice &data, std::string *ref);
+    PayloadPtr get(const std::string &ref);
+    bool remove(const std::string &ref);
+
+    static const std::string SCHEME;
+
+private:
+    //file of ref, empty if ref is not ours or malformed
+    std::string pathOf(const std::string &ref) const;
+
+private:
+    std::string m_dir;
+};
+
+//encode a task, moving a payload over PAYLOAD_INLINE_LIMIT into store
+bool encode_task_payload(PayloadStore *store, TaskHeader header, const Slice &key,
+        const Slice &payload, std::string *out);
+
+#endif
@@ -0,0 +1,271 @@
+/**
+ * Epoll event loop with timers.
+ *
+ * author: lucusfly
+ */
+
+#include "reactor.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include "clog.h"
+
+//most events taken by one epoll_wait
+static const int EPOLL_BATCH = 64;
+
+//most timers and posted callbacks run before looking at the fds again
+static const int RUN_BATCH = 64;
+
+static int64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+Reactor::Reactor(int threads) : m_thread_count(threads > 0 ? threads : 1), m_stop(false), m_next_timer(0) {
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epoll < 0 || m_wakeup < 0) {
+        LOG_ERROR("create reactor failed:%s", strerror(errno));
+    }
+
+    //level triggered, so a wakeup left unread reaches every thread
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = m_wakeup;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+
+    for (int i = 0; i < m_thread_count; ++i) {
+        m_threads.create_thread(boost::bind(&Reactor::loop, this));
+    }
+}
+
+Reactor::~Reactor() {
+    stop();
+
+    close(m_wakeup);
+    close(m_epoll);
+}
+
+bool Reactor::watch(int fd, uint32_t events, const IoCallback &cb) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLONESHOT;
+    ev.data.fd = fd;
+
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    m_watches[fd] = cb;
+    int op = m_registered.contains(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(m_epoll, op, fd, &ev) != 0) {
+        LOG_ERROR("watch fd %d failed:%s", fd, strerror(errno));
+        m_watches.erase(fd);
+        return false;
+    }
+
+    m_registered[fd] = 1;
+    return true;
+}
+
+void Reactor::unwatch(int fd) {
+    IoCallback cb;
+    {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        if (m_registered.erase(fd)) {
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, NULL);
+        }
+
+        IoCallback *found = m_watches.find(fd);
+        if (found != NULL) {
+            cb.swap(*found);
+            m_watches.erase(fd);
+        }
+    }
+    //cb is released here, outside the lock
+}
+
+uint64_t Reactor::after(int64_t ms, const Callback &cb) {
+    int64_t deadline = now_ms() + (ms > 0 ? ms : 0);
+    bool earliest;
+    uint64_t id;
+    {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        id = m_next_timer++;
+        earliest = m_timers.empty() || deadline < m_timers.begin()->first.first;
+        m_timers[std::make_pair(deadline, id)] = cb;
+        m_deadlines[id] = deadline;
+    }
+
+    //the loops sleep until the old first deadline
+    if (earliest) {
+        wake();
+    }
+    return id;
+}
+
+bool Reactor::cancel(uint64_t timer) {
+    Callback cb;
+    {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        int64_t *deadline = m_deadlines.find(timer);
+        if (deadline == NULL) {
+            return false;
+        }
+
+        std::map<std::pair<int64_t, uint64_t>, Callback>::iterator it =
+            m_timers.find(std::make_pair(*deadline, timer));
+        cb.swap(it->second);
+        m_timers.erase(it);
+        m_deadlines.erase(timer);
+    }
+    return true;
+}
+
+void Reactor::post(const Callback &cb) {
+    {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        m_posted.push_back(cb);
+    }
+    wake();
+}
+
+void Reactor::stop() {
+    {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        if (m_stop) {
+            return;
+        }
+        m_stop = true;
+    }
+    wake();
+
+    m_threads.join_all();
+
+    //drop what never ran outside the lock, the callbacks may own objects
+    //whose destructors call back in
+    FlatMap<int, IoCallback> watches;
+    std::map<std::pair<int64_t, uint64_t>, Callback> timers;
+    std::deque<Callback> posted;
+    {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        std::swap(watches, m_watches);
+        timers.swap(m_timers);
+        posted.swap(m_posted);
+        m_deadlines.clear();
+    }
+}
+
+size_t Reactor::watches() const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    return m_watches.size();
+}
+
+size_t Reactor::timers() const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    return m_timers.size();
+}
+
+void Reactor::wake() {
+    uint64_t one = 1;
+    if (write(m_wakeup, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_ERROR("wake reactor failed:%s", strerror(errno));
+    }
+}
+
+void Reactor::run(const Callback &cb) {
+    try {
+        cb();
+    } catch (const std::exception &e) {
+        LOG_ERROR("reactor callback threw:%s", e.what());
+    } catch (...) {
+        LOG_ERROR("reactor callback threw");
+    }
+}
+
+int Reactor::runPending() {
+    for (int i = 0; i < RUN_BATCH; ++i) {
+        Callback cb;
+        int64_t now = now_ms();
+        {
+            boost::lock_guard<boost::mutex> guard(m_mutex);
+            if (m_stop) {
+                return 0;
+            }
+
+            if (!m_posted.empty()) {
+                cb.swap(m_posted.front());
+                m_posted.pop_front();
+            } else if (!m_timers.empty() && m_timers.begin()->first.first <= now) {
+                std::map<std::pair<int64_t, uint64_t>, Callback>::iterator it = m_timers.begin();
+                cb.swap(it->second);
+                m_deadlines.erase(it->first.second);
+                m_timers.erase(it);
+            } else {
+                return m_timers.empty() ? -1 : (int)(m_timers.begin()->first.first - now);
+            }
+        }
+        run(cb);
+    }
+
+    return 0;
+}
+
+void Reactor::loop() {
+    struct epoll_event events[EPOLL_BATCH];
+
+    for (;;) {
+        int timeout = runPending();
+        {
+            boost::lock_guard<boost::mutex> guard(m_mutex);
+            if (m_stop) {
+                return;
+            }
+        }
+
+        int n = epoll_wait(m_epoll, events, EPOLL_BATCH, timeout);
+        if (n < 0) {
+            if (errno != EINTR) {
+                LOG_ERROR("epoll_wait failed:%s", strerror(errno));
+            }
+            continue;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == m_wakeup) {
+                //left readable once stopping, so every thread sees it
+                boost::lock_guard<boost::mutex> guard(m_mutex);
+                uint64_t count;
+                if (!m_stop && read(m_wakeup, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    LOG_ERROR("read reactor wakeup failed:%s", strerror(errno));
+                }
+                continue;
+            }
+
+            IoCallback cb;
+            {
+                boost::lock_guard<boost::mutex> guard(m_mutex);
+                IoCallback *found = m_watches.find(fd);
+                if (found == NULL) {
+                    continue;
+                }
+                cb.swap(*found);
+                m_watches.erase(fd);
+            }
+
+            try {
+                cb(events[i].events);
+            } catch (const std::exception &e) {
+                LOG_ERROR("fd %d callback threw:%s", fd, e.what());
+            } catch (...) {
+                LOG_ERROR("fd %d callback threw", fd);
+            }
+        }
+    }
+}
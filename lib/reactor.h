@@ -0,0 +1,83 @@
+/**
+ * Epoll event loop with timers.
+ *
+ * author: lucusfly
+ */
+#ifndef _REACTOR_H_
+#define _REACTOR_H_
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <utility>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+#include "flat_map.h"
+
+//a few threads wait in one epoll set and run the callbacks of ready file
+//descriptors, due timers and posted work. a callback must not block: a
+//task waiting on I/O costs a registered fd or a timer instead of a thread,
+//so a handful of threads carry thousands of waiting tasks.
+//
+//fd watches are one shot, a callback that wants more events watches again.
+class Reactor : boost::noncopyable {
+public:
+    typedef boost::function<void ()> Callback;
+    typedef boost::function<void (uint32_t events)> IoCallback;
+
+    explicit Reactor(int threads = 1);
+    ~Reactor();
+
+    //call cb once fd is ready for events (EPOLLIN, EPOLLOUT), false if
+    //epoll refuses the fd
+    bool watch(int fd, uint32_t events, const IoCallback &cb);
+
+    //drop the watch of fd, call before closing it
+    void unwatch(int fd);
+
+    //call cb after ms, the returned id cancels it
+    uint64_t after(int64_t ms, const Callback &cb);
+
+    //false if the timer already ran or was cancelled
+    bool cancel(uint64_t timer);
+
+    //run cb on a reactor thread
+    void post(const Callback &cb);
+
+    //join the threads, pending callbacks are dropped
+    void stop();
+
+    int threads() const { return m_thread_count; }
+
+    //fds watched and timers pending
+    size_t watches() const;
+    size_t timers() const;
+
+private:
+    void loop();
+    void wake();
+
+    //run due timers and posted callbacks, return ms to the next timer or -1
+    int runPending();
+
+    void run(const Callback &cb);
+
+private:
+    int m_epoll;
+    int m_wakeup;    //eventfd, readable while the loops must look again
+    int m_thread_count;
+    boost::thread_group m_threads;
+
+    mutable boost::mutex m_mutex;
+    bool m_stop;
+    FlatMap<int, IoCallback> m_watches;   //fd -> callback of its next event
+    FlatMap<int, char> m_registered;      //fds in the epoll set
+    std::map<std::pair<int64_t, uint64_t>, Callback> m_timers; //(deadline ms, id) -> callback
+    FlatMap<uint64_t, int64_t> m_deadlines; //timer id -> deadline ms
+    uint64_t m_next_timer;
+    std::deque<Callback> m_posted;
+};
+
+#endif
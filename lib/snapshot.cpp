@@ -0,0 +1,378 @@
+/**
+ * Compact snapshot of ZooKeeper trees in one mappable file.
+ *
+ * author: lucusfly
+ */
+
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include "clog.h"
+
+using namespace std;
+
+//child created and deleted again to raise the sequence counter of a parent
+static const char *SEQUENCE_PLACEHOLDER = "zksnapshot-sequence";
+
+//number of a sequential node, the 10 digits zookeeper appends, or -1
+static int64_t sequenceOf(const Slice &name) {
+    if (name.size <= 10) {
+        return -1;
+    }
+
+    int64_t seq = 0;
+    for (size_t i = name.size - 10; i < name.size; ++i) {
+        if (name.data[i] < '0' || name.data[i] > '9') {
+            return -1;
+        }
+        seq = seq * 10 + (name.data[i] - '0');
+    }
+    return seq <= 0x7fffffff ? seq : -1;
+}
+
+static bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+uint32_t SnapshotWriter::add(uint32_t parent, const Slice &name, const Slice &data, uint16_t flags) {
+    SnapshotNode node;
+    memset(&node, 0, sizeof(node));
+    node.offset = m_blob.size();
+    node.parent = parent;
+    node.dataLength = data.size;
+    node.nameLength = name.size;
+    node.depth = parent == SNAPSHOT_NO_PARENT ? 0 : m_nodes[parent].depth + 1;
+    node.flags = flags;
+
+    m_blob.append(name.data, name.size);
+    m_blob.append(data.data, data.size);
+    m_nodes.push_back(node);
+    return m_nodes.size() - 1;
+}
+
+bool SnapshotWriter::write(const string &file) const {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.count = m_nodes.size();
+    header.blobSize = m_blob.size();
+    const char *table = m_nodes.empty() ? "" : (const char *)&m_nodes[0];
+    size_t tableSize = m_nodes.size() * sizeof(SnapshotNode);
+    header.tableCrc = crc32(table, tableSize);
+    header.blobCrc = crc32(m_blob.data(), m_blob.size());
+
+    string tmp = file + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("create snapshot %s failed:%s", tmp.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = writeAll(fd, (const char *)&header, sizeof(header)) && writeAll(fd, table, tableSize)
+        && writeAll(fd, m_blob.data(), m_blob.size()) && fsync(fd) == 0;
+    if (!ok) {
+        LOG_ERROR("write snapshot %s failed:%s", tmp.c_str(), strerror(errno));
+    }
+    ::close(fd);
+
+    if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SnapshotFile::open(const string &file) {
+    close();
+
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("open snapshot %s failed:%s", file.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        LOG_ERROR("snapshot %s is truncated", file.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    m_addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m_addr == MAP_FAILED) {
+        LOG_ERROR("mmap snapshot %s failed:%s", file.c_str(), strerror(errno));
+        m_addr = NULL;
+        return false;
+    }
+    m_size = st.st_size;
+
+    const SnapshotHeader *header = (const SnapshotHeader *)m_addr;
+    size_t tableSize = (size_t)header->count * sizeof(SnapshotNode);
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+            || sizeof(SnapshotHeader) + tableSize + header->blobSize != m_size) {
+        LOG_ERROR("%s is not a snapshot or is truncated", file.c_str());
+        close();
+        return false;
+    }
+
+    const char *table = (const char *)m_addr + sizeof(SnapshotHeader);
+    const char *blob = table + tableSize;
+    if (crc32(table, tableSize) != header->tableCrc || crc32(blob, header->blobSize) != header->blobCrc) {
+        LOG_ERROR("snapshot %s fails its checksum", file.c_str());
+        close();
+        return false;
+    }
+
+    //every node lies in the blob and comes after its parent
+    const SnapshotNode *nodes = (const SnapshotNode *)table;
+    for (uint32_t i = 0; i < header->count; ++i) {
+        if (nodes[i].offset + nodes[i].nameLength + nodes[i].dataLength > header->blobSize
+                || (nodes[i].parent != SNAPSHOT_NO_PARENT && nodes[i].parent >= i)) {
+            LOG_ERROR("snapshot %s has a bad node %u", file.c_str(), i);
+            close();
+            return false;
+        }
+    }
+
+    m_nodes = nodes;
+    m_blob = blob;
+    m_count = header->count;
+    return true;
+}
+
+void SnapshotFile::close() {
+    if (m_addr != NULL) {
+        munmap(m_addr, m_size);
+    }
+    m_addr = NULL;
+    m_size = 0;
+    m_nodes = NULL;
+    m_blob = NULL;
+    m_count = 0;
+}
+
+string SnapshotFile::path(uint32_t i) const {
+    if (m_nodes[i].parent == SNAPSHOT_NO_PARENT) {
+        return name(i).str();
+    }
+
+    string parent = path(m_nodes[i].parent);
+    return (parent == "/" ? "" : parent) + "/" + name(i).str();
+}
+
+SnapshotIo::SnapshotIo(const vector<ZooKeeper*> &sessions, int window, int batch)
+    : m_sessions(sessions), m_next(0), m_window(window > 2 ? window : 2), m_batch(batch > 0 ? batch : 1),
+    m_inflight(0), m_existing(0), m_creator(sessions, m_window, ZNODEEXISTS) {}
+
+ZooKeeper *SnapshotIo::next() {
+    return m_sessions[m_next++ % m_sessions.size()];
+}
+
+int SnapshotIo::save(const vector<string> &roots, SnapshotWriter *out) {
+    vector<string> paths(roots);
+    vector<uint32_t> parents(roots.size(), SNAPSHOT_NO_PARENT);
+
+    while (!paths.empty()) {
+        vector<Fetched> fetched(paths.size());
+        fetchLevel(paths, &fetched);
+
+        vector<string> nextPaths;
+        vector<uint32_t> nextParents;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            Fetched &f = fetched[i];
+            //removed since its parent was read, or a root that is not there
+            if (f.code == ZNONODE) {
+                continue;
+            }
+            if (f.code != ZOK) {
+                return f.code;
+            }
+
+            Slice name(paths[i]);
+            if (parents[i] != SNAPSHOT_NO_PARENT) {
+                size_t slash = paths[i].rfind('/');
+                name = Slice(paths[i].data() + slash + 1, paths[i].size() - slash - 1);
+            }
+            uint32_t index = out->add(parents[i], name, f.data, f.flags);
+
+            sort(f.children.begin(), f.children.end());
+            string prefix = paths[i] == "/" ? "/" : paths[i] + "/";
+            for (size_t j = 0; j < f.children.size(); ++j) {
+                nextPaths.push_back(prefix + f.children[j]);
+                nextParents.push_back(index);
+            }
+        }
+
+        paths.swap(nextPaths);
+        parents.swap(nextParents);
+    }
+
+    return ZOK;
+}
+
+void SnapshotIo::fetchLevel(const vector<string> &paths, vector<Fetched> *fetched) {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        while (m_inflight + 2 > m_window) {
+            m_cond.wait(lock);
+        }
+
+        Fetched *f = &(*fetched)[i];
+        f->code = ZOK;
+        f->flags = 0;
+        m_inflight += 2;
+        lock.unlock();
+
+        ZooKeeper *zk = next();
+        int ret = zk->aget(paths[i], boost::bind(&SnapshotIo::onData, this, f, _1, _2, _3, _4));
+        if (ret != ZOK) {
+            done(f, ret);
+        }
+        ret = zk->agetChildren(paths[i], boost::bind(&SnapshotIo::onChildren, this, f, _1, _2));
+        if (ret != ZOK) {
+            done(f, ret);
+        }
+        lock.lock();
+    }
+
+    while (m_inflight > 0) {
+        m_cond.wait(lock);
+    }
+}
+
+int SnapshotIo::restore(const SnapshotFile &snapshot, bool ephemerals) {
+    m_existing = 0;
+    m_creator.reset();
+
+    vector<string> paths(snapshot.count());
+    vector<char> skipped(snapshot.count());
+    uint32_t i = 0;
+    while (i < snapshot.count()) {
+        deque<vector<ZooOp> > batches;
+        uint16_t depth = snapshot.node(i).depth;
+        for (; i < snapshot.count() && snapshot.node(i).depth == depth; ++i) {
+            const SnapshotNode &node = snapshot.node(i);
+            bool root = node.parent == SNAPSHOT_NO_PARENT;
+            if (root) {
+                paths[i] = snapshot.name(i).str();
+            } else {
+                const string &parent = paths[node.parent];
+                paths[i] = (parent == "/" ? "" : parent) + "/" + snapshot.name(i).str();
+            }
+
+            skipped[i] = (!root && skipped[node.parent]) || ((node.flags & SNAPSHOT_EPHEMERAL) && !ephemerals);
+            if (skipped[i]) {
+                continue;
+            }
+
+            //a root may sit below nodes the snapshot does not hold
+            if (root) {
+                int code = next()->create(paths[i], snapshot.data(i).str(), ZOO_OPEN_ACL_UNSAFE, 0, NULL, true);
+                if (code == ZNODEEXISTS) {
+                    ++m_existing;
+                } else if (code != ZOK) {
+                    return code;
+                }
+                continue;
+            }
+
+            if (batches.empty() || batches.back().size() >= m_batch) {
+                batches.push_back(vector<ZooOp>());
+            }
+            batches.back().push_back(ZooOp::create(paths[i], snapshot.data(i).str(), 0));
+        }
+
+        int code = m_creator.send(batches);
+        if (code != ZOK) {
+            return code;
+        }
+    }
+
+    return raiseSequences(snapshot, paths, skipped);
+}
+
+//a sequential create is numbered by the cversion of its parent, which
+//counts the creates and deletes of its children. restored children leave
+//it below their own numbers, so a later sequential create would collide
+//with them. each create and delete of a placeholder raises it by one,
+//until it passes the highest restored number
+int SnapshotIo::raiseSequences(const SnapshotFile &snapshot, const vector<string> &paths,
+        const vector<char> &skipped) {
+    map<uint32_t, int64_t> highest;
+    for (uint32_t i = 0; i < snapshot.count(); ++i) {
+        const SnapshotNode &node = snapshot.node(i);
+        int64_t seq = sequenceOf(snapshot.name(i));
+        if (skipped[i] || node.parent == SNAPSHOT_NO_PARENT || seq < 0) {
+            continue;
+        }
+        int64_t &top = highest[node.parent];
+        top = max(top, seq);
+    }
+
+    deque<vector<ZooOp> > batches;
+    for (map<uint32_t, int64_t>::iterator it = highest.begin(); it != highest.end(); ++it) {
+        const string &parent = paths[it->first];
+        struct Stat stat;
+        int code = next()->exists(parent, false, &stat);
+        if (code != ZOK) {
+            return code;
+        }
+
+        string placeholder = (parent == "/" ? "" : parent) + "/" + SEQUENCE_PLACEHOLDER;
+        for (int64_t gap = it->second + 1 - stat.cversion; gap > 0; gap -= 2) {
+            if (batches.empty() || batches.back().size() + 2 > m_batch) {
+                batches.push_back(vector<ZooOp>());
+            }
+            batches.back().push_back(ZooOp::create(placeholder, "", 0));
+            batches.back().push_back(ZooOp::remove(placeholder));
+        }
+    }
+
+    return m_creator.send(batches);
+}
+
+void SnapshotIo::onData(Fetched *fetched, int code, const char *value, int len, const Stat *stat) {
+    if (code == ZOK) {
+        fetched->data.assign(value, len);
+        fetched->flags = stat->ephemeralOwner != 0 ? SNAPSHOT_EPHEMERAL : 0;
+    }
+    done(fetched, code);
+}
+
+void SnapshotIo::onChildren(Fetched *fetched, int code, const vector<string> *children) {
+    if (code == ZOK) {
+        fetched->children = *children;
+    }
+    done(fetched, code);
+}
+
+void SnapshotIo::done(Fetched *fetched, int code) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    if (fetched->code == ZOK) {
+        fetched->code = code;
+    }
+    --m_inflight;
+    m_cond.notify_one();
+}
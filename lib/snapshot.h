@@ -0,0 +1,160 @@
+/**
+ * Compact snapshot of ZooKeeper trees in one mappable file.
+ *
+ * author: lucusfly
+ */
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+#include "task_format.h"
+#include "zookeeper.h"
+#include "multi_sender.h"
+
+//file layout, the structs as they are in memory on a little endian host:
+//
+//  0  SnapshotHeader
+// 32  node table, count SnapshotNode
+//  .. blob, the name then the data of every node
+//
+//a root's name is its full path, any other name the last component. the
+//nodes are ordered by depth, so every parent comes before its children
+//and a restore creates one depth at a time.
+static const char SNAPSHOT_MAGIC[8] = {'Z', 'K', 'S', 'N', 'A', 'P', '0', '1'};
+static const uint32_t SNAPSHOT_NO_PARENT = 0xffffffff;
+
+//SnapshotNode flags
+static const uint16_t SNAPSHOT_EPHEMERAL = 0x01;
+
+//most requests of a SnapshotIo in flight at once
+static const int SNAPSHOT_WINDOW = 64;
+
+//most creates in one multi of a restore
+static const int SNAPSHOT_BATCH = 500;
+
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t blobSize;
+    uint32_t tableCrc;   //crc32 of the node table
+    uint32_t blobCrc;
+} SnapshotHeader;
+
+typedef struct SnapshotNode {
+    uint64_t offset;      //of the name in the blob, the data follows it
+    uint32_t parent;      //index of the parent, SNAPSHOT_NO_PARENT for a root
+    uint32_t dataLength;
+    uint16_t nameLength;
+    uint16_t depth;
+    uint16_t flags;
+    uint16_t reserved;
+} SnapshotNode;
+
+//collects nodes in memory and writes them out as a snapshot file
+class SnapshotWriter : boost::noncopyable {
+public:
+    //add a node after its parent and every node of a smaller depth,
+    //returns its index
+    uint32_t add(uint32_t parent, const Slice &name, const Slice &data, uint16_t flags);
+
+    //write to file.tmp and rename it into place
+    bool write(const std::string &file) const;
+
+    uint32_t count() const { return m_nodes.size(); }
+
+private:
+    std::vector<SnapshotNode> m_nodes;
+    std::string m_blob;
+};
+
+//a snapshot file mapped read only, the slices point into the mapping
+class SnapshotFile : boost::noncopyable {
+public:
+    SnapshotFile() : m_addr(NULL), m_size(0), m_nodes(NULL), m_blob(NULL), m_count(0) {}
+    ~SnapshotFile() { close(); }
+
+    //map file and check its header, sizes and checksums
+    bool open(const std::string &file);
+    void close();
+
+    uint32_t count() const { return m_count; }
+    const SnapshotNode &node(uint32_t i) const { return m_nodes[i]; }
+    Slice name(uint32_t i) const { return Slice(m_blob + m_nodes[i].offset, m_nodes[i].nameLength); }
+    Slice data(uint32_t i) const {
+        return Slice(m_blob + m_nodes[i].offset + m_nodes[i].nameLength, m_nodes[i].dataLength);
+    }
+
+    //full path of node i, built from its parents
+    std::string path(uint32_t i) const;
+
+private:
+    void *m_addr;
+    size_t m_size;
+    const SnapshotNode *m_nodes;
+    const char *m_blob;
+    uint32_t m_count;
+};
+
+//reads trees into a SnapshotWriter, or creates the trees of a snapshot,
+//with up to window requests in flight, round robin over the sessions.
+//both go one depth at a time: a save gets the data and the children of
+//every node of a depth, a restore creates a depth in multis of up to
+//batch creates.
+class SnapshotIo : boost::noncopyable {
+public:
+    //the sessions are borrowed and must outlive the object
+    SnapshotIo(const std::vector<ZooKeeper*> &sessions, int window = SNAPSHOT_WINDOW,
+            int batch = SNAPSHOT_BATCH);
+
+    //roots that do not exist are left out
+    int save(const std::vector<std::string> &roots, SnapshotWriter *out);
+
+    //ephemeral nodes are left out, or created as persistent ones with
+    //ephemerals. a node that exists already is kept as it is and counted.
+    //the sequence counter of a parent is raised past its highest restored
+    //sequential child, so later sequential creates there do not collide
+    int restore(const SnapshotFile &snapshot, bool ephemerals);
+
+    uint64_t existing() { return m_existing + m_creator.dropped(); }
+
+private:
+    //what a save learns about one node of the current depth
+    typedef struct Fetched {
+        int code;         //the first error of its two requests
+        std::string data;
+        uint16_t flags;
+        std::vector<std::string> children;
+    } Fetched;
+
+    ZooKeeper *next();
+
+    //send requests while the window allows, until every one came back
+    void fetchLevel(const std::vector<std::string> &paths, std::vector<Fetched> *fetched);
+    int raiseSequences(const SnapshotFile &snapshot, const std::vector<std::string> &paths,
+            const std::vector<char> &skipped);
+
+    void onData(Fetched *fetched, int code, const char *value, int len, const Stat *stat);
+    void onChildren(Fetched *fetched, int code, const std::vector<std::string> *children);
+    void done(Fetched *fetched, int code);
+
+private:
+    std::vector<ZooKeeper*> m_sessions;
+    size_t m_next;
+    int m_window;
+    int m_batch;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+    int m_inflight;
+    uint64_t m_existing;   //roots that exist already
+    MultiSender m_creator; //of the restore, keeps nodes that exist already
+};
+
+#endif
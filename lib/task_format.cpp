@@ -0,0 +1,145 @@
+/**
+ * Binary task envelope stored in TASKPATH/<task>.
+ *
+ * author: lucusfly
+ */
+
+#include "task_format.h"
+
+#include <boost/static_assert.hpp>
+
+using std::string;
+
+//every v1 field must fit in the v1 header
+BOOST_STATIC_ASSERT(task_field::PayloadLength::end <= TASK_HEADER_SIZE);
+
+//slicing-by-8: eight tables let the loop fold 8 bytes per step instead of one
+static uint32_t g_crc_table[8][256];
+
+static bool init_crc_table() {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        g_crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int t = 1; t < 8; ++t) {
+            uint32_t c = g_crc_table[t - 1][i];
+            g_crc_table[t][i] = g_crc_table[0][c & 0xff] ^ (c >> 8);
+        }
+    }
+    return true;
+}
+
+static const bool g_crc_ready = init_crc_table();
+
+uint32_t crc32(const char *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t c = 0xffffffff;
+
+    for (; size >= 8; size -= 8, p += 8) {
+        uint32_t lo = c ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        c = g_crc_table[7][lo & 0xff] ^ g_crc_table[6][(lo >> 8) & 0xff] ^
+            g_crc_table[5][(lo >> 16) & 0xff] ^ g_crc_table[4][lo >> 24] ^
+            g_crc_table[3][hi & 0xff] ^ g_crc_table[2][(hi >> 8) & 0xff] ^
+            g_crc_table[1][(hi >> 16) & 0xff] ^ g_crc_table[0][hi >> 24];
+    }
+
+    for (; size > 0; --size, ++p) {
+        c = g_crc_table[0][(c ^ *p) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffff;
+}
+
+template<typename T>
+static void store(string *out, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        out->push_back((char)(value >> (i * 8)));
+    }
+}
+
+const char *task_error(TaskError error) {
+    switch (error) {
+        case TASK_OK: return "ok";
+        case TASK_BAD_MAGIC: return "bad magic";
+        case TASK_BAD_VERSION: return "unsupported version";
+        case TASK_TRUNCATED: return "truncated";
+        case TASK_BAD_CHECKSUM: return "bad checksum";
+    }
+    return "unknown";
+}
+
+TaskError TaskView::parse(const char *data, size_t size) {
+    m_data = data;
+    m_header = 0;
+    m_key = Slice();
+    m_payload = Slice();
+
+    if (size < task_field::Magic::end || load<uint16_t>(data) != TASK_MAGIC) {
+        return TASK_BAD_MAGIC;
+    }
+    if (size < TASK_HEADER_SIZE + TASK_CHECKSUM_SIZE) {
+        return TASK_TRUNCATED;
+    }
+
+    uint8_t version = load<uint8_t>(data + task_field::Version::offset);
+    if (version == 0 || version > TASK_FORMAT_VERSION) {
+        return TASK_BAD_VERSION;
+    }
+
+    size_t header = load<uint8_t>(data + task_field::HeaderLength::offset);
+    if (header < TASK_HEADER_SIZE) {
+        return TASK_TRUNCATED;
+    }
+
+    size_t key = load<uint16_t>(data + task_field::KeyLength::offset);
+    size_t payload = load<uint32_t>(data + task_field::PayloadLength::offset);
+    //sizes are added as 64 bit, a u32 payload length can not wrap them
+    uint64_t total = (uint64_t)header + key + payload + TASK_CHECKSUM_SIZE;
+    if (total != size) {
+        return TASK_TRUNCATED;
+    }
+
+    size_t body = size - TASK_CHECKSUM_SIZE;
+    if (crc32(data, body) != load<uint32_t>(data + body)) {
+        return TASK_BAD_CHECKSUM;
+    }
+
+    m_header = header;
+    m_key = Slice(data + header, key);
+    m_payload = Slice(data + header + key, payload);
+    return TASK_OK;
+}
+
+void TaskView::parseLegacy(const char *data, size_t size) {
+    m_data = data;
+    m_header = 0;
+    m_key = Slice();
+    m_payload = Slice(data, size);
+}
+
+bool encode_task(const TaskHeader &header, const Slice &key, const Slice &payload, string *out) {
+    if (key.size > 0xffff || (uint64_t)payload.size > 0xffffffffULL) {
+        return false;
+    }
+
+    size_t start = out->size();
+    out->reserve(start + TASK_HEADER_SIZE + key.size + payload.size + TASK_CHECKSUM_SIZE);
+
+    store<uint16_t>(out, TASK_MAGIC);
+    store<uint8_t>(out, TASK_FORMAT_VERSION);
+    store<uint8_t>(out, (uint8_t)TASK_HEADER_SIZE);
+    store<uint16_t>(out, header.type);
+    store<uint8_t>(out, header.priority);
+    store<uint8_t>(out, header.flags);
+    store<uint16_t>(out, (uint16_t)key.size);
+    store<uint16_t>(out, 0);
+    store<uint32_t>(out, (uint32_t)payload.size);
+    out->append(key.data, key.size);
+    out->append(payload.data, payload.size);
+    store<uint32_t>(out, crc32(out->data() + start, out->size() - start));
+    return true;
+}
@@ -0,0 +1,138 @@
+/**
+ * Binary task envelope stored in TASKPATH/<task>.
+ *
+ * author: lucusfly
+ */
+#ifndef _TASK_FORMAT_H_
+#define _TASK_FORMAT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+//a byte range inside a buffer owned by someone else
+typedef struct Slice {
+    const char *data;
+    size_t size;
+
+    Slice() : data(NULL), size(0) {}
+    Slice(const char *d, size_t n) : data(d), size(n) {}
+    Slice(const std::string &s) : data(s.data()), size(s.size()) {}
+
+    std::string str() const { return std::string(data, size); }
+} Slice;
+
+//wire layout, little endian:
+//
+//  0  u16 magic "TK"
+//  2  u8  version, bumped only for changes old readers can not skip
+//  3  u8  header length, the key starts here
+//  4  u16 type
+//  6  u8  priority
+//  7  u8  flags
+//  8  u16 key length
+// 10  u16 reserved
+// 12  u32 payload length
+// 16  ... fields added later, key, payload
+// end u32 crc32 of everything before it
+//
+//new fields are appended to the header and raise the header length, not
+//the version. an old reader skips header bytes it does not know, a new
+//reader gets the default 0 for fields an old writer did not send.
+template<typename T, size_t Offset>
+struct TaskField {
+    typedef T type;
+    static const size_t offset = Offset;
+    static const size_t end = Offset + sizeof(T);
+};
+
+//the schema, one typedef per header field
+namespace task_field {
+typedef TaskField<uint16_t, 0> Magic;
+typedef TaskField<uint8_t, 2> Version;
+typedef TaskField<uint8_t, 3> HeaderLength;
+typedef TaskField<uint16_t, 4> Type;
+typedef TaskField<uint8_t, 6> Priority;
+typedef TaskField<uint8_t, 7> Flags;
+typedef TaskField<uint16_t, 8> KeyLength;
+typedef TaskField<uint32_t, 12> PayloadLength;
+}
+
+static const uint16_t TASK_MAGIC = 0x4b54;
+static const uint8_t TASK_FORMAT_VERSION = 1;
+static const size_t TASK_HEADER_SIZE = 16;
+static const size_t TASK_CHECKSUM_SIZE = 4;
+
+enum TaskError {
+    TASK_OK,
+    TASK_BAD_MAGIC,    //not an envelope, e.g. data of an old producer
+    TASK_BAD_VERSION,
+    TASK_TRUNCATED,
+    TASK_BAD_CHECKSUM
+};
+
+const char *task_error(TaskError error);
+
+//fields a producer sets
+typedef struct TaskHeader {
+    uint16_t type;
+    uint8_t priority;
+    uint8_t flags;
+
+    TaskHeader() : type(0), priority(0), flags(0) {}
+} TaskHeader;
+
+//read only view of an envelope parsed in place. key() and payload() point
+//into the parsed buffer, which must outlive the view.
+class TaskView {
+public:
+    TaskView() : m_data(NULL), m_header(0) {}
+
+    //check the envelope in data without copying it
+    TaskError parse(const char *data, size_t size);
+    TaskError parse(const std::string &data) { return parse(data.data(), data.size()); }
+
+    //view data of a pre-envelope producer as a raw payload of type 0
+    void parseLegacy(const char *data, size_t size);
+
+    //a field the writer's header is too short for reads as 0
+    template<typename F>
+    typename F::type get() const {
+        if (F::end > m_header) {
+            return 0;
+        }
+        return load<typename F::type>(m_data + F::offset);
+    }
+
+    uint8_t version() const { return get<task_field::Version>(); }
+    uint16_t type() const { return get<task_field::Type>(); }
+    uint8_t priority() const { return get<task_field::Priority>(); }
+    uint8_t flags() const { return get<task_field::Flags>(); }
+
+    Slice key() const { return m_key; }
+    Slice payload() const { return m_payload; }
+
+private:
+    template<typename T>
+    static T load(const char *p) {
+        T value = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            value |= (T)(uint8_t)p[i] << (i * 8);
+        }
+        return value;
+    }
+
+private:
+    const char *m_data;
+    size_t m_header;
+    Slice m_key;
+    Slice m_payload;
+};
+
+//append an envelope to out, which keeps its capacity across calls.
+//false if the key or payload is too long for its length field
+bool encode_task(const TaskHeader &header, const Slice &key, const Slice &payload, std::string *out);
+
+uint32_t crc32(const char *data, size_t size);
+
+#endif
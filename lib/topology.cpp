@@ -0,0 +1,164 @@
+/**
+ * CPU and NUMA node layout of the host.
+ *
+ * author: lucusfly
+ */
+
+#include "topology.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "clog.h"
+
+using std::string;
+using std::vector;
+
+static const string NODE_DIR = "/sys/devices/system/node";
+
+static bool readFile(const string &path, string *data) {
+    FILE *fp = fopen(path.c_str(), "r");
+    if (fp == NULL) {
+        return false;
+    }
+
+    char buf[4096];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    data->assign(buf, n);
+    return true;
+}
+
+Topology Topology::detect() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        LOG_WARN("sched_getaffinity failed:%s", strerror(errno));
+        for (int i = 0; i < CPU_SETSIZE; ++i) {
+            CPU_SET(i, &allowed);
+        }
+    }
+
+    //node directories in index order, node ids may have holes
+    vector<int> ids;
+    DIR *dir = opendir(NODE_DIR.c_str());
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            int id;
+            char rest;
+            if (sscanf(entry->d_name, "node%d%c", &id, &rest) == 1) {
+                ids.push_back(id);
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(ids.begin(), ids.end());
+
+    Topology topology;
+    for (int i = 0; i < ids.size(); ++i) {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/node%d/cpulist", NODE_DIR.c_str(), ids[i]);
+
+        string list;
+        vector<int> cpus;
+        if (!readFile(path, &list) || !parseCpuList(list, &cpus)) {
+            LOG_WARN("bad cpu list in %s", path);
+            continue;
+        }
+
+        vector<int> usable;
+        for (int j = 0; j < cpus.size(); ++j) {
+            if (cpus[j] < CPU_SETSIZE && CPU_ISSET(cpus[j], &allowed)) {
+                usable.push_back(cpus[j]);
+            }
+        }
+        if (!usable.empty()) {
+            topology.m_nodes.push_back(usable);
+        }
+    }
+
+    if (topology.m_nodes.empty()) {
+        vector<int> usable;
+        for (int i = 0; i < CPU_SETSIZE; ++i) {
+            if (CPU_ISSET(i, &allowed)) {
+                usable.push_back(i);
+            }
+        }
+        topology.m_nodes.push_back(usable);
+    }
+
+    return topology;
+}
+
+int Topology::cpuCount() const {
+    int count = 0;
+    for (int i = 0; i < m_nodes.size(); ++i) {
+        count += m_nodes[i].size();
+    }
+    return count;
+}
+
+bool Topology::parseCpuList(const string &list, vector<int> *cpus) {
+    cpus->clear();
+    const char *p = list.c_str();
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0) {
+            return false;
+        }
+
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first) {
+                return false;
+            }
+            p = end;
+        }
+
+        for (long cpu = first; cpu <= last; ++cpu) {
+            cpus->push_back(cpu);
+        }
+
+        if (*p == ',') {
+            ++p;
+        } else if (*p != '\0' && *p != '\n') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool pin_thread(const vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < cpus.size(); ++i) {
+        CPU_SET(cpus[i], &set);
+    }
+
+    int code = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (code != 0) {
+        LOG_WARN("pin thread failed:%s", strerror(code));
+        return false;
+    }
+    return true;
+}
+
+PinMode parse_pin_mode(const string &mode) {
+    if (mode == "node") {
+        return PIN_NODE;
+    }
+    if (mode == "core") {
+        return PIN_CORE;
+    }
+    return PIN_NONE;
+}
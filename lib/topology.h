@@ -0,0 +1,45 @@
+/**
+ * CPU and NUMA node layout of the host.
+ *
+ * author: lucusfly
+ */
+#ifndef _TOPOLOGY_H_
+#define _TOPOLOGY_H_
+
+#include <string>
+#include <vector>
+
+//how executor threads are bound to cpus
+enum PinMode {
+    PIN_NONE,   //threads float, the scheduler places them
+    PIN_NODE,   //each thread may run on every cpu of one node
+    PIN_CORE    //each thread runs on one cpu
+};
+
+//the nodes of the host and the cpus of each that this process may use.
+//nodes without such cpus, memory only nodes or cpus outside the affinity
+//mask of a taskset or a cgroup, are left out
+class Topology {
+public:
+    //read /sys/devices/system/node, one node with every usable cpu when
+    //the kernel has no numa support
+    static Topology detect();
+
+    int nodes() const { return m_nodes.size(); }
+    const std::vector<int> &cpus(int node) const { return m_nodes[node]; }
+    int cpuCount() const;
+
+    //parse a sysfs cpu list like "0-3,8-11"
+    static bool parseCpuList(const std::string &list, std::vector<int> *cpus);
+
+private:
+    std::vector<std::vector<int> > m_nodes;
+};
+
+//pin the calling thread to cpus, false if the kernel refuses
+bool pin_thread(const std::vector<int> &cpus);
+
+//"none", "node" or "core", PIN_NONE for anything else
+PinMode parse_pin_mode(const std::string &mode);
+
+#endif
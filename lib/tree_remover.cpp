@@ -0,0 +1,163 @@
+/**
+ * Pipelined recursive delete of a ZooKeeper tree.
+ *
+ * author: lucusfly
+ */
+
+#include "tree_remover.h"
+
+#include <sys/time.h>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+using namespace std;
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+TreeRemover::TreeRemover(const vector<ZooKeeper*> &sessions, int window, int batch)
+    : m_sessions(sessions), m_next(0), m_window(window > 0 ? window : 1), m_batch(batch > 0 ? batch : 1),
+    m_interval(0), m_start(0), m_reported(0), m_inflight(0), m_error(ZOK), m_listing(false),
+    m_listed(0), m_sender(sessions, window, ZNONODE) {}
+
+void TreeRemover::setProgress(const ProgressCallback &cb, int intervalMs) {
+    m_progress = cb;
+    m_interval = intervalMs > 0 ? intervalMs : 1000;
+    m_sender.setTick(boost::bind(&TreeRemover::report, this, false), m_interval);
+}
+
+int TreeRemover::remove(const string &path) {
+    m_start = now();
+    m_reported = m_start;
+    m_error = ZOK;
+    m_listed = 0;
+    m_sender.reset();
+
+    m_listing = true;
+    int code = list(path);
+    m_listing = false;
+
+    //children before their parents, "/" itself can not go
+    for (int depth = (int)m_levels.size() - 1; code == ZOK && depth >= 0; --depth) {
+        vector<string> paths;
+        paths.swap(m_levels[depth]);
+        if (depth > 0 || path != "/") {
+            code = removeLevel(paths);
+        }
+    }
+    m_levels.clear();
+
+    report(true);
+    return code;
+}
+
+ZooKeeper *TreeRemover::next() {
+    return m_sessions[m_next++ % m_sessions.size()];
+}
+
+void TreeRemover::wait(boost::unique_lock<boost::mutex> &lock) {
+    if (!m_progress) {
+        m_cond.wait(lock);
+        return;
+    }
+
+    m_cond.timed_wait(lock, boost::posix_time::milliseconds(m_interval));
+    lock.unlock();
+    report(false);
+    lock.lock();
+}
+
+void TreeRemover::report(bool force) {
+    if (!m_progress) {
+        return;
+    }
+
+    double t = now();
+    if (!force && (t - m_reported) * 1000 < m_interval) {
+        return;
+    }
+    m_reported = t;
+
+    RemoveProgress progress;
+    {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        progress.listed = m_listed;
+    }
+    progress.removed = m_sender.applied();
+    progress.listing = m_listing;
+    progress.seconds = t - m_start;
+    m_progress(progress);
+}
+
+int TreeRemover::list(const string &path) {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_levels.assign(1, vector<string>(1, path));
+    m_unlisted.push_back(make_pair(path, 0));
+    m_listed = 1;
+
+    for (;;) {
+        while (m_error == ZOK && m_inflight < m_window && !m_unlisted.empty()) {
+            pair<string, int> node = m_unlisted.front();
+            m_unlisted.pop_front();
+            ++m_inflight;
+
+            lock.unlock();
+            int ret = next()->agetChildren(node.first,
+                    boost::bind(&TreeRemover::onChildren, this, node.first, node.second, _1, _2));
+            lock.lock();
+            if (ret != ZOK) {
+                --m_inflight;
+                if (m_error == ZOK) {
+                    m_error = ret;
+                }
+            }
+        }
+
+        if (m_inflight == 0 && (m_unlisted.empty() || m_error != ZOK)) {
+            break;
+        }
+        wait(lock);
+    }
+
+    m_unlisted.clear();
+    return m_error;
+}
+
+int TreeRemover::removeLevel(const vector<string> &paths) {
+    deque<vector<ZooOp> > batches;
+    for (size_t i = 0; i < paths.size(); i += m_batch) {
+        batches.push_back(vector<ZooOp>());
+        vector<ZooOp> &ops = batches.back();
+        for (size_t j = i; j < paths.size() && j < i + m_batch; ++j) {
+            ops.push_back(ZooOp::remove(paths[j]));
+        }
+    }
+
+    return m_sender.send(batches);
+}
+
+void TreeRemover::onChildren(const string &path, int depth, int code, const vector<string> *children) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    --m_inflight;
+
+    if (code == ZOK) {
+        if (m_levels.size() <= depth + 1) {
+            m_levels.resize(depth + 2);
+        }
+        vector<string> &level = m_levels[depth + 1];
+        string prefix = path == "/" ? "/" : path + "/";
+        for (int i = 0; i < children->size(); ++i) {
+            level.push_back(prefix + (*children)[i]);
+            m_unlisted.push_back(make_pair(level.back(), depth + 1));
+        }
+        m_listed += children->size();
+    } else if ((code != ZNONODE || depth == 0) && m_error == ZOK) {
+        //a node below the root may be removed by someone else meanwhile
+        m_error = code;
+    }
+
+    m_cond.notify_one();
+}
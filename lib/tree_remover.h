@@ -0,0 +1,91 @@
+/**
+ * Pipelined recursive delete of a ZooKeeper tree.
+ *
+ * author: lucusfly
+ */
+#ifndef _TREE_REMOVER_H_
+#define _TREE_REMOVER_H_
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+#include "zookeeper.h"
+#include "multi_sender.h"
+
+//most requests of a TreeRemover in flight at once
+static const int REMOVE_WINDOW = 64;
+
+//most removes in one multi
+static const int REMOVE_BATCH = 500;
+
+typedef struct RemoveProgress {
+    uint64_t listed;     //nodes found so far
+    uint64_t removed;    //nodes removed so far
+    bool listing;        //still walking the tree
+    double seconds;      //since remove started
+} RemoveProgress;
+
+//removes a tree in two passes. the first lists it breadth first, with up
+//to window getChildren in flight. the second removes it a level at a time,
+//deepest first, in multis of up to batch removes with up to window multis
+//in flight. requests go round robin over the sessions, so several
+//sessions spread the load over several servers.
+//
+//a node that disappears meanwhile is skipped. a node created meanwhile
+//fails its parent with ZNOTEMPTY, run again to remove it.
+class TreeRemover : boost::noncopyable {
+public:
+    typedef boost::function<void (const RemoveProgress &)> ProgressCallback;
+
+    //the sessions are borrowed and must outlive the remover
+    TreeRemover(const std::vector<ZooKeeper*> &sessions, int window = REMOVE_WINDOW,
+            int batch = REMOVE_BATCH);
+
+    //called on the thread of remove every intervalMs and once at the end
+    void setProgress(const ProgressCallback &cb, int intervalMs);
+
+    //remove path and everything below it, the codes of ZooKeeper::removeDir
+    int remove(const std::string &path);
+
+private:
+    ZooKeeper *next();
+
+    //wait for a completion or the next progress report
+    void wait(boost::unique_lock<boost::mutex> &lock);
+    void report(bool force);
+
+    int list(const std::string &path);
+    int removeLevel(const std::vector<std::string> &paths);
+
+    //callbacks, on the zookeeper completion threads
+    void onChildren(const std::string &path, int depth, int code, const std::vector<std::string> *children);
+
+private:
+    std::vector<ZooKeeper*> m_sessions;
+    size_t m_next;
+    int m_window;
+    int m_batch;
+
+    ProgressCallback m_progress;
+    int m_interval;
+    double m_start;
+    double m_reported;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+    int m_inflight;
+    int m_error;                  //first error, ZOK if none
+    bool m_listing;
+    uint64_t m_listed;
+    std::deque<std::pair<std::string, int> > m_unlisted;  //(path, depth) to list
+    std::vector<std::vector<std::string> > m_levels;      //paths by depth
+    MultiSender m_sender;                                  //of the removes, skips nodes gone already
+};
+
+#endif
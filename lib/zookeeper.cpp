@@ -12,6 +12,7 @@
 #include <boost/bind.hpp>
 #include <boost/tuple/tuple.hpp>
 #include "clog.h"
+#include "tree_remover.h"
 //#include "path.h"
 
 using namespace boost;
@@ -152,25 +153,8 @@ int ZooKeeper::remove(const string& path, int version)
 }
 
 int ZooKeeper::removeDir(const string& path) {
-    vector<string> children;
-    int code = getChildren(path, false, &children);
-
-    if (code == ZOK) {
-        if (children.empty()) {
-            return remove(path, -1);
-        } else {
-            for (int i = 0; i < children.size(); ++i) {
-                int remove_code = removeDir(path + "/" + children[i]);
-
-                if (remove_code != ZOK)
-                    return remove_code;
-            }
-
-            return remove(path, -1);
-        }
-    } else {
-        return code;
-    }
+    TreeRemover remover(vector<ZooKeeper*>(1, this));
+    return remover.remove(path);
 }
 
 int ZooKeeper::exists(const string& path, bool watch, Stat* stat) {
@@ -220,6 +204,97 @@ int ZooKeeper::get(const string& path, bool watch, string* result, Stat* stat)
     }
 }
 
+//context of one asynchronous call, reused by its retries
+typedef struct AsyncOp {
+    ZooKeeper* zk;
+    zhandle_t* zh;
+    string path;
+    string value;
+    int flags;
+    DataCallback data;
+    StatCallback stat;
+    ChildrenCallback children;
+    CreateCallback created;
+} AsyncOp;
+
+//context of one amulti, it owns the ops the c ops point into
+typedef struct AsyncMulti {
+    ZooKeeper* zk;
+    zhandle_t* zh;
+    vector<ZooOp> ops;
+    vector<zoo_op_t> zops;
+    vector<zoo_op_result_t> zresults;
+    vector<vector<char> > buffers;
+    MultiCallback callback;
+} AsyncMulti;
+
+int ZooKeeper::acreate(const string& path, const string& data, int flags, const CreateCallback& callback)
+{
+    AsyncOp* args = new AsyncOp();
+    args->zk = this;
+    args->zh = zh;
+    args->path = path;
+    args->value = data;
+    args->flags = flags;
+    args->created = callback;
+
+    int ret = zoo_acreate(zh, path.c_str(), data.data(), data.size(), &ZOO_OPEN_ACL_UNSAFE,
+            flags, asyncCreateCompletion, args);
+    if (ret != ZOK) {
+        delete args;
+    }
+
+    return ret;
+}
+
+int ZooKeeper::aget(const string& path, const DataCallback& callback)
+{
+    AsyncOp* args = new AsyncOp();
+    args->zk = this;
+    args->zh = zh;
+    args->path = path;
+    args->data = callback;
+
+    int ret = zoo_aget(zh, path.c_str(), 0, asyncDataCompletion, args);
+    if (ret != ZOK) {
+        delete args;
+    }
+
+    return ret;
+}
+
+int ZooKeeper::aexists(const string& path, const StatCallback& callback)
+{
+    AsyncOp* args = new AsyncOp();
+    args->zk = this;
+    args->zh = zh;
+    args->path = path;
+    args->stat = callback;
+
+    int ret = zoo_aexists(zh, path.c_str(), 0, asyncStatCompletion, args);
+    if (ret != ZOK) {
+        delete args;
+    }
+
+    return ret;
+}
+
+int ZooKeeper::agetChildren(const string& path, const ChildrenCallback& callback)
+{
+    AsyncOp* args = new AsyncOp();
+    args->zk = this;
+    args->zh = zh;
+    args->path = path;
+    args->children = callback;
+
+    int ret = zoo_aget_children(zh, path.c_str(), 0, asyncStringsCompletion, args);
+    if (ret != ZOK) {
+        delete args;
+    }
+
+    return ret;
+}
+
 int ZooKeeper::getChildren(const string& path, bool watch, vector<string>* results)
 {
     promise<int>* pi = new promise<int>();
@@ -270,6 +345,110 @@ int ZooKeeper::set(const string& path, const string& data, int version)
     }
 }
 
+//the c ops of ops, which point into ops and buffers
+static void initOps(const vector<ZooOp>& ops, vector<zoo_op_t>* zops, vector<vector<char> >* buffers)
+{
+    for (int i = 0; i < ops.size(); ++i) {
+        const ZooOp &op = ops[i];
+        switch (op.type) {
+            case ZooOp::CREATE:
+                //room for the sequence suffix
+                (*buffers)[i].resize(op.path.size() + 16);
+                zoo_create_op_init(&(*zops)[i], op.path.c_str(), op.data.data(), op.data.size(),
+                        &ZOO_OPEN_ACL_UNSAFE, op.flags, &(*buffers)[i][0], (*buffers)[i].size());
+                break;
+            case ZooOp::REMOVE:
+                zoo_delete_op_init(&(*zops)[i], op.path.c_str(), op.version);
+                break;
+            case ZooOp::SET:
+                zoo_set_op_init(&(*zops)[i], op.path.c_str(), op.data.data(), op.data.size(),
+                        op.version, NULL);
+                break;
+            case ZooOp::CHECK:
+                zoo_check_op_init(&(*zops)[i], op.path.c_str(), op.version);
+                break;
+        }
+    }
+}
+
+int ZooKeeper::multi(const vector<ZooOp>& ops, vector<int>* results)
+{
+    if (ops.empty()) {
+        if (results != NULL) results->clear();
+        return ZOK;
+    }
+
+    vector<zoo_op_t> zops(ops.size());
+    vector<zoo_op_result_t> zresults(ops.size());
+    vector<vector<char> > buffers(ops.size());
+    initOps(ops, &zops, &buffers);
+
+    promise<int>* pi = new promise<int>();
+    unique_future<int> fi = pi->get_future();
+
+    tuple<promise<int>*>* args = new tuple<promise<int>*>(pi);
+
+    int ret = zoo_amulti(zh, zops.size(), &zops[0], &zresults[0], voidCompletion, args);
+
+    if (ret != ZOK) {
+        delete pi;
+        delete args;
+        return ret;
+    }
+
+    int code = fi.get();
+    if(retryable(code)) {
+        LOG_WARN("got a retry cause %s", zerror(code));
+        return multi(ops, results);
+    }
+
+    if (results != NULL) {
+        results->resize(ops.size());
+        for (int i = 0; i < ops.size(); ++i) {
+            (*results)[i] = zresults[i].err;
+        }
+    }
+
+    return code;
+}
+
+int ZooKeeper::amulti(const vector<ZooOp>& ops, const MultiCallback& callback)
+{
+    if (ops.empty()) {
+        callback(ZOK, vector<int>());
+        return ZOK;
+    }
+
+    AsyncMulti* args = new AsyncMulti();
+    args->zk = this;
+    args->zh = zh;
+    args->ops = ops;
+    args->zops.resize(ops.size());
+    args->zresults.resize(ops.size());
+    args->buffers.resize(ops.size());
+    args->callback = callback;
+    initOps(args->ops, &args->zops, &args->buffers);
+
+    int ret = zoo_amulti(zh, args->zops.size(), &args->zops[0], &args->zresults[0],
+            asyncMultiCompletion, args);
+    if (ret != ZOK) {
+        delete args;
+    }
+
+    return ret;
+}
+
+int ZooKeeper::failedOp(const vector<int>& results)
+{
+    for (int i = 0; i < results.size(); ++i) {
+        if (results[i] != ZOK && results[i] != ZRUNTIMEINCONSISTENCY) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 WatchMsg *ZooKeeper::waitWatch() {
     return msgQ.pop(true);
 }
@@ -390,6 +569,105 @@ string ZooKeeper::message(int code) const
     return string(zerror(code));
 }
 
+void ZooKeeper::asyncDataCompletion(int ret, const char* value, int value_len,
+        const Stat* stat, const void* data)
+{
+    AsyncOp* args = const_cast<AsyncOp*>(reinterpret_cast<const AsyncOp*>(data));
+
+    if (args->zk->retryable(ret)) {
+        LOG_WARN("got a retry cause %s", zerror(ret));
+        ret = zoo_aget(args->zh, args->path.c_str(), 0, asyncDataCompletion, args);
+        if (ret == ZOK) {
+            return;
+        }
+    }
+
+    args->data(ret, ret == ZOK ? value : NULL, ret == ZOK && value_len > 0 ? value_len : 0,
+            ret == ZOK ? stat : NULL);
+    delete args;
+}
+
+void ZooKeeper::asyncStatCompletion(int ret, const Stat* stat, const void* data)
+{
+    AsyncOp* args = const_cast<AsyncOp*>(reinterpret_cast<const AsyncOp*>(data));
+
+    if (args->zk->retryable(ret)) {
+        LOG_WARN("got a retry cause %s", zerror(ret));
+        ret = zoo_aexists(args->zh, args->path.c_str(), 0, asyncStatCompletion, args);
+        if (ret == ZOK) {
+            return;
+        }
+    }
+
+    args->stat(ret, ret == ZOK ? stat : NULL);
+    delete args;
+}
+
+void ZooKeeper::asyncCreateCompletion(int ret, const char* value, const void* data)
+{
+    AsyncOp* args = const_cast<AsyncOp*>(reinterpret_cast<const AsyncOp*>(data));
+
+    if (args->zk->retryable(ret)) {
+        LOG_WARN("got a retry cause %s", zerror(ret));
+        ret = zoo_acreate(args->zh, args->path.c_str(), args->value.data(), args->value.size(),
+                &ZOO_OPEN_ACL_UNSAFE, args->flags, asyncCreateCompletion, args);
+        if (ret == ZOK) {
+            return;
+        }
+    }
+
+    args->created(ret, ret == ZOK ? value : NULL);
+    delete args;
+}
+
+void ZooKeeper::asyncStringsCompletion(int ret, const String_vector* values, const void* data)
+{
+    AsyncOp* args = const_cast<AsyncOp*>(reinterpret_cast<const AsyncOp*>(data));
+
+    if (args->zk->retryable(ret)) {
+        LOG_WARN("got a retry cause %s", zerror(ret));
+        ret = zoo_aget_children(args->zh, args->path.c_str(), 0, asyncStringsCompletion, args);
+        if (ret == ZOK) {
+            return;
+        }
+    }
+
+    if (ret != ZOK) {
+        args->children(ret, NULL);
+        delete args;
+        return;
+    }
+
+    vector<string> children;
+    children.reserve(values->count);
+    for (int i = 0; i < values->count; i++) {
+        children.push_back(values->data[i]);
+    }
+    args->children(ret, &children);
+    delete args;
+}
+
+void ZooKeeper::asyncMultiCompletion(int ret, const void* data)
+{
+    AsyncMulti* args = const_cast<AsyncMulti*>(reinterpret_cast<const AsyncMulti*>(data));
+
+    if (args->zk->retryable(ret)) {
+        LOG_WARN("got a retry cause %s", zerror(ret));
+        ret = zoo_amulti(args->zh, args->zops.size(), &args->zops[0], &args->zresults[0],
+                asyncMultiCompletion, args);
+        if (ret == ZOK) {
+            return;
+        }
+    }
+
+    vector<int> results(args->ops.size());
+    for (int i = 0; i < results.size(); ++i) {
+        results[i] = args->zresults[i].err;
+    }
+    args->callback(ret, results);
+    delete args;
+}
+
 bool ZooKeeper::retryable(int code)
 {
     switch (code) {
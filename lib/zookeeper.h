@@ -13,6 +13,7 @@
 #include <vector>
 
 #include <zookeeper/zookeeper.h>
+#include <boost/function.hpp>
 #include "locking_queue.h"
 
 using std::string;
@@ -28,6 +29,50 @@ typedef struct WatchMsg {
     WatchMsg(int t, int s, const char *p):type(t), state(s), path(p) {}
 } WatchMsg;
 
+//one operation of a ZooKeeper::multi request
+typedef struct ZooOp {
+    enum Type { CREATE, REMOVE, SET, CHECK };
+
+    Type type;
+    string path;
+    string data;
+    int flags;   //create flags
+    int version; //expected version of remove, set and check
+
+    ZooOp(Type t, const string &p, const string &d, int f, int v)
+        :type(t), path(p), data(d), flags(f), version(v) {}
+
+    static ZooOp create(const string &path, const string &data, int flags) {
+        return ZooOp(CREATE, path, data, flags, -1);
+    }
+
+    static ZooOp remove(const string &path, int version = -1) {
+        return ZooOp(REMOVE, path, "", 0, version);
+    }
+
+    static ZooOp set(const string &path, const string &data, int version = -1) {
+        return ZooOp(SET, path, data, 0, version);
+    }
+
+    static ZooOp check(const string &path, int version) {
+        return ZooOp(CHECK, path, "", 0, version);
+    }
+} ZooOp;
+
+//results of ZooKeeper::aget and aexists: the return code and, if it is
+//ZOK, the data and stat. they run on the zookeeper completion thread and
+//must not call the synchronous methods, which wait for that very thread
+typedef boost::function<void (int code, const char *value, int value_len, const Stat *stat)> DataCallback;
+typedef boost::function<void (int code, const Stat *stat)> StatCallback;
+
+//results of ZooKeeper::agetChildren and amulti, called back like aget.
+//children is NULL unless code is ZOK, results holds one code per op
+typedef boost::function<void (int code, const vector<string> *children)> ChildrenCallback;
+typedef boost::function<void (int code, const vector<int> &results)> MultiCallback;
+
+//result of ZooKeeper::acreate, path is the created path if code is ZOK
+typedef boost::function<void (int code, const char *path)> CreateCallback;
+
 //this is a zookeeper c++ client implement. it bases zookeeper 
 //c-binding client and boost. 
 //comparing with c-binding client, some convenience being added:
@@ -79,6 +124,13 @@ public:
    */
   int remove(const string& path, int version);
 
+  /*
+   * asynchronous create with ZOO_OPEN_ACL_UNSAFE, called back like aget.
+   * a create retried after a lost connection may get ZNODEEXISTS for a
+   * node the first attempt created
+   */
+  int acreate(const string& path, const string& data, int flags, const CreateCallback& callback);
+
   /*
    * @return one of the following values is returned:
    * ZOK operation completed succesfully
@@ -89,6 +141,8 @@ public:
    * ZBADARGUMENTS - invalid input parameters
    * ZINVALIDSTATE - state is ZOO_SESSION_EXPIRED_STATE or ZOO_AUTH_FAILED_STATE
    * ZMARSHALLINGERROR - failed to marshall a request; possibly, out of memory
+   *
+   * the tree is listed and removed with pipelined requests, see TreeRemover
    */
   int removeDir(const string &path);
 
@@ -115,6 +169,18 @@ public:
   int get(const string& path, bool watch, string* result,
       Stat* stat);
 
+  /*
+   * asynchronous get without watch. callback is called exactly once, after
+   * retryable errors were retried, so many reads can be in flight at once.
+   *
+   * @return ZOK if the request was sent, otherwise one of the codes of get
+   * and callback is never called
+   */
+  int aget(const string& path, const DataCallback& callback);
+
+  //asynchronous exists without watch, called back like aget
+  int aexists(const string& path, const StatCallback& callback);
+
   /*
    * @return one of the following values is returned:
    * ZOK operation completed successfully
@@ -127,6 +193,9 @@ public:
   int getChildren(const string& path, bool watch, 
           vector<string>* results);
 
+  //asynchronous getChildren without watch, called back like aget
+  int agetChildren(const string& path, const ChildrenCallback& callback);
+
   /*
    * @return one of the following values is returned:
    * ZOK operation completed succesfully
@@ -139,6 +208,25 @@ public:
    */
   int set(const string& path, const string& data, int version);
 
+  /*
+   * run all ops in one transaction, either all of them apply or none does.
+   * create ops always use ZOO_OPEN_ACL_UNSAFE.
+   *
+   * @param results if not NULL, gets one code per op. when the transaction
+   * fails the op that caused it holds its own error, ops before it ZOK
+   * and ops after it ZRUNTIMEINCONSISTENCY
+   *
+   * @return ZOK if every op succeeded, otherwise the error of the first
+   * failed op or one of the codes of the single operations above
+   */
+  int multi(const vector<ZooOp>& ops, vector<int>* results);
+
+  //asynchronous multi, called back like aget with the codes of multi
+  int amulti(const vector<ZooOp>& ops, const MultiCallback& callback);
+
+  //return index of the op that failed a multi, or -1
+  static int failedOp(const vector<int>& results);
+
   //return a message describing the return code, similar with zerrror
   string message(int code) const;
 
@@ -160,6 +248,12 @@ private:
   static void dataCompletion(int ret, const char* value, int value_len,
           const Stat* stat, const void* data);
   static void stringsCompletion(int ret, const String_vector* values,const void* data);
+  static void asyncDataCompletion(int ret, const char* value, int value_len,
+          const Stat* stat, const void* data);
+  static void asyncStatCompletion(int ret, const Stat* stat, const void* data);
+  static void asyncCreateCompletion(int ret, const char* value, const void* data);
+  static void asyncStringsCompletion(int ret, const String_vector* values, const void* data);
+  static void asyncMultiCompletion(int ret, const void* data);
 
   //ZooKeeper instances are not copyable
   ZooKeeper(const ZooKeeper& that);
@@ -1,5 +1,6 @@
 #include <string>
 #include "master.h"
+#include "config.h"
 
 using namespace std;
 
@@ -10,10 +11,25 @@ int main(int argc, char **argv) {
 
     log_init(CLOG_LEVEL_INFO, "log-master");
 
-    string host = "192.168.85.132:2181,192.168.85.132:2182,192.168.85.132:2183";
+    Config conf;
+    conf.load("master.conf");
+    if (conf.getInt("log_binary", 0)) {
+        log_set_binary();
+    }
+    if (conf.getInt("log_async", 0)) {
+        log_set_async(conf.getInt("log_ring_kb", 256) << 10,
+                conf.get("log_overflow", "block") == "drop" ? CLOG_OVERFLOW_DROP : CLOG_OVERFLOW_BLOCK);
+    }
+    log_set_rotate((long long)conf.getInt("log_rotate_mb", 0) << 20, conf.getInt("log_rotate_min", 0) * 60,
+            conf.getInt("log_keep", 5), conf.getInt("log_compress", 0));
+
+    string host = conf.get("host", "192.168.85.132:2181,192.168.85.132:2182,192.168.85.132:2183");
     ZooKeeper zk(host, 10000);
 
     Master m(&zk);
+    m.setCapacity(conf.getInt("capacity", 0));
+    bool pull = conf.getInt("pull", 0) != 0;
+    m.setPull(pull);
     m.startWatchThread();
 
     while(!m.isConnected()) {
@@ -21,10 +37,18 @@ int main(int argc, char **argv) {
     }
 
     m.createMaster();
-    m.checkMaster();
+    if (pull && conf.getInt("partitioned", 0)) {
+        LOG_WARN("pull mode runs a single active master, partitioned ignored");
+    }
+    if (conf.getInt("partitioned", 0) && !pull) {
+        m.runPartitioned();
+    } else {
+        m.checkMaster();
+    }
 
     while(!m.isExpired()) {
         sleep(1);
+        m.tick();
     }
 
     return 0;
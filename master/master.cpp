@@ -1,5 +1,38 @@
 #include "master.h"
-#include <climits>
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+//a task is a straggler once it ran SLOW_FACTOR times the median of its
+//type and longer than the p99, after SLOW_MIN_SAMPLES tasks of that type
+static const int SLOW_FACTOR = 3;
+static const int SLOW_MIN_SAMPLES = 20;
+
+//most backup copies launched by one checkLeases
+static const int MAX_SPECULATE = MULTI_BATCH;
+
+//partitioned masters split the task namespace into this many buckets
+static const int PARTITION_BUCKETS = 1024;
+
+//versioned writes of a booking counter retried after a conflict
+static const int BOOK_RETRIES = 8;
+
+//tasks named by one sequential prefix ("resize-", "task-") share a type,
+//all spilled names share one more
+static uint32_t taskType(NameId task) {
+    return (uint32_t)(task >> 32);
+}
+
+//pull mode queue node of a task
+static string readyPath(const string &task) {
+    return ready_shard(NameTable::hash(task) % READY_SHARDS) + "/" + task;
+}
+
+static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
 
 bool Master::createMaster() {
     string fullpath;
@@ -43,6 +76,11 @@ bool Master::checkMaster() {
     return true;
 }
 
+void Master::process(int type, int state, const string &path) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    Watcher::process(type, state, path);
+}
+
 void Master::deleted(const string &path) {
     LOG_INFO("delete event on path:%s", path.c_str());
     if (path == m_watch_node) {
@@ -52,12 +90,107 @@ void Master::deleted(const string &path) {
 
 void Master::runAsMaster() {
     LOG_INFO("run as master %s", m_master_node.c_str());
+    m_active = true;
 
     initWorkers();
+    if (m_pull) {
+        createReady();
+    }
     initTasks();
 
     workerWatch();
     taskWatch();
+
+    int code = zk->create(STATUSPATH, "", ZOO_OPEN_ACL_UNSAFE, 0, NULL);
+    if (code != ZOK && code != ZNODEEXISTS) {
+        LOG_ERROR("create %s failed:%s", STATUSPATH.c_str(), zerror(code));
+    }
+    updateStatus();
+}
+
+bool Master::runPartitioned() {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    LOG_INFO("run as partitioned master %s", m_master_node.c_str());
+    m_partitioned = true;
+    m_active = true;
+
+    int code = zk->create(STATUSPATH, "", ZOO_OPEN_ACL_UNSAFE, 0, NULL);
+    if (code != ZOK && code != ZNODEEXISTS) {
+        LOG_ERROR("create %s failed:%s", STATUSPATH.c_str(), zerror(code));
+    }
+
+    workerWatch();
+    taskWatch();
+    return updateMasters();
+}
+
+//buckets go to masters by rendezvous hashing, so a master joining or
+//leaving only moves the buckets it takes or gives up
+bool Master::updateMasters() {
+    vector<string> children;
+    int code = zk->getChildren(MASTERPATH, true, &children);
+    NOTOK_RETURN(code);
+
+    sort(children.begin(), children.end());
+    if (children == m_masters) {
+        return true;
+    }
+    m_masters = children;
+
+    vector<uint64_t> seeds(children.size());
+    for (int i = 0; i < children.size(); ++i) {
+        seeds[i] = NameTable::hash(children[i]);
+    }
+
+    vector<char> buckets(PARTITION_BUCKETS, 0);
+    int owned = 0;
+    for (int b = 0; b < PARTITION_BUCKETS; ++b) {
+        int best = 0;
+        uint64_t bestScore = 0;
+        for (int i = 0; i < seeds.size(); ++i) {
+            uint64_t score = mix(seeds[i] ^ (uint64_t)b);
+            if (i == 0 || score > bestScore) {
+                best = i;
+                bestScore = score;
+            }
+        }
+
+        if (!children.empty() && children[best] == m_master_node) {
+            buckets[b] = 1;
+            ++owned;
+        }
+    }
+
+    LOG_INFO("own %d of %d buckets with %d masters", owned, PARTITION_BUCKETS, (int)children.size());
+    if (buckets == m_buckets) {
+        return true;
+    }
+
+    m_buckets.swap(buckets);
+    rebuild();
+    return true;
+}
+
+bool Master::ownsTask(const string &task) const {
+    if (!m_partitioned) {
+        return true;
+    }
+
+    return !m_buckets.empty() && m_buckets[NameTable::hash(task) % PARTITION_BUCKETS];
+}
+
+//forget all tasks and load those of the buckets owned now. a task moving
+//between masters may be assigned twice while both see the old layout,
+//which the first status wins rule already handles
+void Master::rebuild() {
+    m_assign.clear();
+    m_leases.clear();
+    m_workers = WorkerTable();
+    m_names.clear();
+
+    initWorkers();
+    initTasks();
+    updateStatus();
 }
 
 bool Master::initWorkers() {
@@ -70,16 +203,36 @@ bool Master::initWorkers() {
         int code = zk->getChildren(ASSIGNPATH+"/"+workers[i], false, &tasks);
         NOTOK_RETURN(code);
 
-        m_worker[workers[i]] = tasks.size();
+        int worker = m_workers.add(m_names.intern(workers[i]));
+        readReport(worker);
+        readLease(worker);
+        if (m_partitioned) {
+            refreshBooking(worker);
+        } else {
+            m_workers.addLoad(worker, tasks.size());
+        }
+        m_assign.reserve(m_assign.size() + tasks.size());
         for (int j = 0; j < tasks.size(); ++j) {
+            if (!ownsTask(tasks[j])) {
+                continue;
+            }
+            NameId task = m_names.intern(tasks[j]);
+
             //may get one task assigned to multi workers condition
-            if (!m_assign[tasks[j]].empty()) {
+            int *owner = m_assign.find(task);
+            if (owner != NULL && *owner != WorkerTable::NONE) {
                 LOG_ERROR("task %s assigned to two worker %s --- %s", tasks[j].c_str(), 
-                        m_assign[tasks[j]].c_str(), workers[i].c_str());
+                        m_names.name(m_workers.id(*owner)).c_str(), workers[i].c_str());
+            }
+            m_assign[task] = worker;
+            //pull mode has no backups, a lost claim is requeued
+            if (!m_pull) {
+                startLease(task);
             }
-            m_assign[tasks[j]] = workers[i];
         }
     }
+
+    return true;
 }
 
 bool Master::initTasks() {
@@ -87,14 +240,193 @@ bool Master::initTasks() {
     int code = zk->getChildren(TASKPATH, false, &tasks);
     NOTOK_RETURN(code);
 
+    if (m_pull) {
+        FlatMap<NameId, char> ids;
+        ids.reserve(tasks.size());
+        for (int i = 0; i < tasks.size(); ++i) {
+            ids[m_names.intern(tasks[i])] = 1;
+        }
+        initReady(ids);
+    }
+
+    m_assign.reserve(tasks.size());
     for (int i = 0; i < tasks.size(); ++i) {
-        if (m_assign.find(tasks[i]) == m_assign.end()) {
-            m_assign[tasks[i]] = string();
-            LOG_INFO("init add task %s", tasks[i].c_str());
-            addTask(tasks[i]);
+        if (!ownsTask(tasks[i])) {
+            continue;
+        }
+        NameId task = m_names.intern(tasks[i]);
+        if (!m_assign.contains(task)) {
+            m_assign[task] = WorkerTable::NONE;
+            LOG_INFO_RATE(100, 1000, "init add task %s", tasks[i].c_str());
+            addTask(task);
         }
     }
-    
+
+    if (m_pull) {
+        return publishReady();
+    }
+    return true;
+}
+
+bool Master::createReady() {
+    for (int shard = 0; shard < READY_SHARDS; ++shard) {
+        int code = zk->create(ready_shard(shard), "", ZOO_OPEN_ACL_UNSAFE, 0, NULL, true);
+        if (code != ZOK && code != ZNODEEXISTS) {
+            LOG_ERROR("create %s failed:%s", ready_shard(shard).c_str(), zerror(code));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//tasks already waiting in the ready shards are not published again, and
+//ready nodes of tasks that are gone are removed
+bool Master::initReady(const FlatMap<NameId, char> &tasks) {
+    for (int shard = 0; shard < READY_SHARDS; ++shard) {
+        vector<string> children;
+        int code = zk->getChildren(ready_shard(shard), false, &children);
+        NOTOK_RETURN(code);
+
+        for (int i = 0; i < children.size(); ++i) {
+            NameId task = m_names.find(children[i]);
+            if (task != INVALID_NAME && tasks.contains(task)) {
+                if (!m_assign.contains(task)) {
+                    m_assign[task] = WorkerTable::NONE;
+                }
+                continue;
+            }
+
+            LOG_INFO("remove stale ready task %s", children[i].c_str());
+            code = zk->remove(ready_shard(shard)+"/"+children[i], -1);
+            if (code != ZOK && code != ZNONODE) {
+                LOG_ERROR("remove ready task %s failed:%s", children[i].c_str(), zerror(code));
+            }
+        }
+    }
+
+    return true;
+}
+
+//create the ready nodes of new tasks, MULTI_BATCH per multi. a node that
+//exists was published before
+bool Master::publishReady() {
+    vector<NameId> pending;
+    pending.reserve(m_unpublished.size());
+    for (size_t i = 0; i < m_unpublished.capacity(); ++i) {
+        if (m_unpublished.occupied(i)) {
+            pending.push_back(m_unpublished.keyAt(i));
+        }
+    }
+
+    while (!pending.empty()) {
+        size_t count = min(pending.size(), (size_t)MULTI_BATCH);
+        vector<ZooOp> ops;
+        for (size_t i = 0; i < count; ++i) {
+            ops.push_back(ZooOp::create(readyPath(m_names.name(pending[i])), "", 0));
+        }
+
+        vector<int> results;
+        int code = zk->multi(ops, &results);
+        if (code == ZOK) {
+            for (size_t i = 0; i < count; ++i) {
+                m_unpublished.erase(pending[i]);
+            }
+            pending.erase(pending.begin(), pending.begin() + count);
+            continue;
+        }
+
+        int failed = ZooKeeper::failedOp(results);
+        if (failed >= 0 && results[failed] == ZNODEEXISTS) {
+            m_unpublished.erase(pending[failed]);
+            pending.erase(pending.begin() + failed);
+            continue;
+        }
+
+        LOG_ERROR("publish %d tasks failed:%s", (int)count, zerror(code));
+        return false;
+    }
+
+    return true;
+}
+
+//move the claims of a lost worker back to the ready shards, each with a
+//multi that removes the assignment and creates the ready node, so a task
+//is never both claimed and ready
+bool Master::requeue(const string &worker, const vector<string> &tasks) {
+    string dir = ASSIGNPATH+"/"+worker;
+    vector<string> pending(tasks);
+
+    while (!pending.empty()) {
+        size_t count = min(pending.size(), (size_t)MULTI_BATCH / 2);
+        vector<ZooOp> ops;
+        for (size_t i = 0; i < count; ++i) {
+            ops.push_back(ZooOp::remove(dir+"/"+pending[i]));
+            ops.push_back(ZooOp::create(readyPath(pending[i]), "", 0));
+        }
+
+        vector<int> results;
+        int code = zk->multi(ops, &results);
+        if (code == ZOK) {
+            for (size_t i = 0; i < count; ++i) {
+                LOG_INFO_RATE(100, 1000, "requeue task %s of %s", pending[i].c_str(), worker.c_str());
+                NameId task = m_names.find(pending[i]);
+                int *owner = task == INVALID_NAME ? NULL : m_assign.find(task);
+                if (owner != NULL) {
+                    *owner = WorkerTable::NONE;
+                }
+            }
+            pending.erase(pending.begin(), pending.begin() + count);
+            continue;
+        }
+
+        int failed = ZooKeeper::failedOp(results);
+        if (failed < 0) {
+            LOG_ERROR("requeue tasks of %s failed:%s", worker.c_str(), zerror(code));
+            m_orphans.push_back(worker);
+            return false;
+        }
+
+        //a task already ready only loses its stale claim
+        if (failed % 2 == 1) {
+            zk->remove(dir+"/"+pending[failed / 2], -1);
+        }
+        pending.erase(pending.begin() + failed / 2);
+    }
+
+    return true;
+}
+
+//take a deleted task out of its ready shard, or away from the worker that
+//claimed it
+bool Master::withdraw(NameId task, int worker) {
+    if (m_unpublished.erase(task)) {
+        return true;
+    }
+
+    string name = m_names.name(task);
+    int code = zk->remove(readyPath(name), -1);
+    if (code != ZNONODE) {
+        NOTOK_RETURN(code);
+        return true;
+    }
+
+    if (worker != WorkerTable::NONE) {
+        return unassign(task, worker);
+    }
+
+    //claims are not tracked, deletes are rare enough to ask every worker
+    for (int i = 0; i < m_workers.slots(); ++i) {
+        if (!m_workers.alive(i)) {
+            continue;
+        }
+
+        code = zk->remove(ASSIGNPATH+"/"+m_names.name(m_workers.id(i))+"/"+name, -1);
+        if (code == ZOK) {
+            break;
+        }
+    }
+
     return true;
 }
 
@@ -117,7 +449,142 @@ void Master::childChange(const string &path) {
         updateWorkers();
     } else if (path == TASKPATH) {
         updateTasks();
+    } else if (path == STATUSPATH) {
+        updateStatus();
+    } else if (path == MASTERPATH && m_partitioned) {
+        updateMasters();
+    }
+}
+
+void Master::dataChange(const string &path) {
+    bool report = path.compare(0, WORKERPATH.size() + 1, WORKERPATH + "/") == 0;
+    bool lease = path.compare(0, LEASEPATH.size() + 1, LEASEPATH + "/") == 0;
+    if (!report && !lease) {
+        return;
+    }
+
+    NameId id = m_names.find(get_file_name(path));
+    int worker = id == INVALID_NAME ? WorkerTable::NONE : m_workers.find(id);
+    if (worker == WorkerTable::NONE) {
+        return;
+    }
+
+    if (report) {
+        readReport(worker);
+    } else {
+        readLease(worker);
+    }
+}
+
+//a lease node watched before its worker created it
+void Master::created(const string &path) {
+    dataChange(path);
+}
+
+//read the load report of a worker and watch for the next one. workers
+//publish only on a real change, so the watch fires at a bounded rate
+bool Master::readReport(int worker) {
+    string data;
+    int code = zk->get(WORKERPATH+"/"+m_names.name(m_workers.id(worker)), true, &data, NULL);
+    NOTOK_RETURN(code);
+
+    LoadReport report;
+    if (!decode_load(data, &report)) {
+        return true;
+    }
+
+    m_workers.setReport(worker, report.threads, report.busy());
+    bool draining = m_workers.draining(worker);
+    m_workers.setDraining(worker, report.draining);
+    if (report.draining && !draining) {
+        LOG_INFO("worker %s draining", m_names.name(m_workers.id(worker)).c_str());
+        return drainWorker(worker);
     }
+    return true;
+}
+
+//hand the tasks a draining worker has not started to other workers. the
+//worker writes its lease with only the started tasks before it reports
+//draining, and starts nothing after, so the rest are safe to move
+bool Master::drainWorker(int worker) {
+    string name = m_names.name(m_workers.id(worker));
+
+    string lease;
+    int code = zk->get(LEASEPATH+"/"+name, false, &lease, NULL);
+    NOTOK_RETURN(code);
+
+    FlatMap<NameId, char> started;
+    size_t pos = 0;
+    while (pos < lease.size()) {
+        size_t end = lease.find('\n', pos);
+        if (end == string::npos) end = lease.size();
+
+        NameId task = m_names.find(lease.substr(pos, end - pos));
+        if (task != INVALID_NAME) {
+            started[task] = 1;
+        }
+        pos = end + 1;
+    }
+
+    vector<string> children;
+    code = zk->getChildren(ASSIGNPATH+"/"+name, false, &children);
+    NOTOK_RETURN(code);
+
+    vector<string> idle;
+    for (int i = 0; i < children.size(); ++i) {
+        NameId task = m_names.find(children[i]);
+        if (ownsTask(children[i]) && (task == INVALID_NAME || !started.contains(task))) {
+            idle.push_back(children[i]);
+        }
+    }
+    LOG_INFO("worker %s drains %d tasks, moves %d", name.c_str(), (int)(children.size() - idle.size()),
+            (int)idle.size());
+
+    if (m_pull) {
+        return requeue(name, idle);
+    }
+    return moveTasks(worker, idle);
+}
+
+//remove the assignments of a draining worker MULTI_BATCH per multi, then
+//assign the tasks again as if the worker was lost
+bool Master::moveTasks(int worker, const vector<string> &tasks) {
+    string dir = ASSIGNPATH+"/"+m_names.name(m_workers.id(worker));
+    vector<string> pending(tasks);
+
+    while (!pending.empty()) {
+        size_t count = min(pending.size(), (size_t)MULTI_BATCH);
+        vector<ZooOp> ops;
+        for (size_t i = 0; i < count; ++i) {
+            ops.push_back(ZooOp::remove(dir+"/"+pending[i]));
+        }
+
+        vector<int> results;
+        int code = zk->multi(ops, &results);
+        if (code != ZOK) {
+            //a task finished meanwhile is cleaned up as usual
+            int failed = ZooKeeper::failedOp(results);
+            if (failed < 0 || results[failed] != ZNONODE) {
+                LOG_ERROR("move tasks of %s failed:%s", dir.c_str(), zerror(code));
+                return false;
+            }
+            pending.erase(pending.begin() + failed);
+            continue;
+        }
+
+        if (m_partitioned) {
+            releaseBooking(worker, count);
+        } else {
+            m_workers.addLoad(worker, -(int)count);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            LOG_INFO_RATE(100, 1000, "move task %s off %s", pending[i].c_str(), dir.c_str());
+            reassign(m_names.intern(pending[i]), worker);
+        }
+        pending.erase(pending.begin(), pending.begin() + count);
+    }
+
+    return true;
 }
 
 bool Master::updateWorkers() {
@@ -125,105 +592,648 @@ bool Master::updateWorkers() {
     int code = zk->getChildren(WORKERPATH, true, &children);
     NOTOK_RETURN(code);
 
+    vector<NameId> ids(children.size());
+    FlatMap<NameId, char> workers;
+    workers.reserve(children.size());
+    for (int i = 0; i < children.size(); ++i) {
+        ids[i] = m_names.intern(children[i]);
+        workers[ids[i]] = 1;
+    }
+
     //find deleted worker
-    set<string> workers(children.begin(), children.end());
-    for (map<string, int>::iterator it = m_worker.begin(); it != m_worker.end(); ) {
-        if (workers.find(it->first) == workers.end()) {
-            LOG_INFO("delete worker %s", it->first.c_str());
-            deleteWorker(it->first);
-            m_worker.erase(it++);
-        } else {
-            ++it;
+    for (int i = 0; i < m_workers.slots(); ++i) {
+        if (m_workers.alive(i) && !workers.contains(m_workers.id(i))) {
+            LOG_INFO("delete worker %s", m_names.name(m_workers.id(i)).c_str());
+            deleteWorker(i);
         }
     }
 
     //find added worker
     for (int i = 0; i < children.size(); ++i) {
-        if (m_worker.find(children[i]) == m_worker.end()) {
+        if (m_workers.find(ids[i]) == WorkerTable::NONE) {
             LOG_INFO("add worker %s", children[i].c_str());
-            m_worker[children[i]] = 0;
+            int worker = m_workers.add(ids[i]);
+            readReport(worker);
+            readLease(worker);
+            if (m_partitioned) {
+                refreshBooking(worker);
+            }
         }
     }
 
     return true;
 }
 
-bool Master::deleteWorker(const string &work) {
+bool Master::addWorker(const string &worker) {
+    m_workers.add(m_names.intern(worker));
+    return true;
+}
+
+bool Master::deleteWorker(int worker) {
+    NameId id = m_workers.id(worker);
+    string name = m_names.name(id);
+
+    //drop the worker first so its tasks can not be assigned back to it
+    m_workers.remove(worker);
+    m_names.release(id);
+
     vector<string> children;
-    int code = zk->getChildren(ASSIGNPATH+"/"+work, false, &children);
-    NOTOK_RETURN(code);
+    int code = zk->getChildren(ASSIGNPATH+"/"+name, false, &children);
+    if (code != ZOK && m_pull) {
+        LOG_ERROR("get tasks of worker %s failed:%s, requeue later", name.c_str(), zerror(code));
+        m_orphans.push_back(name);
+        return false;
+    }
+    if (code != ZOK) {
+        LOG_ERROR("get tasks of worker %s failed:%s, reassign from memory", name.c_str(), zerror(code));
+        vector<NameId> tasks;
+        for (size_t i = 0; i < m_assign.capacity(); ++i) {
+            if (m_assign.occupied(i) && m_assign.valueAt(i) == worker) {
+                tasks.push_back(m_assign.keyAt(i));
+            }
+        }
+        for (size_t i = 0; i < m_leases.capacity(); ++i) {
+            if (m_leases.occupied(i) && m_leases.valueAt(i).backup == worker) {
+                tasks.push_back(m_leases.keyAt(i));
+            }
+        }
+        for (int i = 0; i < tasks.size(); ++i) {
+            reassign(tasks[i], worker);
+        }
+        return false;
+    }
+
+    if (m_pull) {
+        return requeue(name, children);
+    }
 
     for (int i = 0; i < children.size(); ++i) {
-        m_assign[children[i]] = string();
-        addTask(children[i]);
+        if (ownsTask(children[i])) {
+            reassign(m_names.intern(children[i]), worker);
+        }
     }
     
     return true;
 }
 
+//move a task off a lost worker: a lost backup copy leaves the primary
+//running, a lost primary hands the task to its backup
+void Master::reassign(NameId task, int worker) {
+    Lease *lease = m_leases.find(task);
+    if (lease != NULL && lease->backup == worker) {
+        lease->backup = WorkerTable::NONE;
+        return;
+    }
+
+    int *owner = m_assign.find(task);
+    if (lease != NULL && lease->backup != WorkerTable::NONE && owner != NULL && *owner == worker) {
+        *owner = lease->backup;
+        lease->backup = WorkerTable::NONE;
+        return;
+    }
+
+    m_assign[task] = WorkerTable::NONE;
+    addTask(task);
+}
+
 bool Master::updateTasks() {
     vector<string> children;
     int code = zk->getChildren(TASKPATH, true, &children);
     NOTOK_RETURN(code);
 
+    if (m_partitioned) {
+        vector<string> owned;
+        for (int i = 0; i < children.size(); ++i) {
+            if (ownsTask(children[i])) owned.push_back(children[i]);
+        }
+        children.swap(owned);
+    }
+
+    vector<NameId> ids(children.size());
+    FlatMap<NameId, char> tasks;
+    tasks.reserve(children.size());
+    for (int i = 0; i < children.size(); ++i) {
+        ids[i] = m_names.intern(children[i]);
+        tasks[ids[i]] = 1;
+    }
+
     //find deleted tasks
-    set<string> tasks(children.begin(), children.end());
-    for (map<string, string>::iterator it = m_assign.begin(); it != m_assign.end(); ) {
-        if (tasks.find(it->first) == tasks.end()) {
-            LOG_INFO("delete task %s", it->first.c_str());
-
-            deleteTask(it->first, it->second);
-            //m_worker[it->second]--;
-            m_assign.erase(it++);
-        } else {
-            ++it;
+    vector<NameId> deleted;
+    for (size_t i = 0; i < m_assign.capacity(); ++i) {
+        if (m_assign.occupied(i) && !tasks.contains(m_assign.keyAt(i))) {
+            deleted.push_back(m_assign.keyAt(i));
         }
     }
 
+    for (int i = 0; i < deleted.size(); ++i) {
+        LOG_INFO_RATE(100, 1000, "delete task %s", m_names.name(deleted[i]).c_str());
+
+        deleteTask(deleted[i], *m_assign.find(deleted[i]));
+        m_assign.erase(deleted[i]);
+        m_names.release(deleted[i]);
+    }
+
     for (int i = 0; i < children.size(); ++i) {
-        if (m_assign.find(children[i]) == m_assign.end()) {
-            LOG_INFO("add task %s", children[i].c_str());
+        if (!m_assign.contains(ids[i])) {
+            LOG_INFO_RATE(100, 1000, "add task %s", children[i].c_str());
 
-            m_assign[children[i]] = string();
-            addTask(children[i]);
+            m_assign[ids[i]] = WorkerTable::NONE;
+            addTask(ids[i]);
         }
     }
 
+    if (m_pull) {
+        return publishReady();
+    }
     return true;
 }
 
-bool Master::deleteTask(const string &task, const string &worker) {
-    if (m_worker.find(worker) == m_worker.end())  
+bool Master::deleteTask(NameId task, int worker) {
+    if (m_pull) {
+        return withdraw(task, worker);
+    }
+
+    Lease *lease = m_leases.find(task);
+    if (lease != NULL) {
+        int backup = lease->backup;
+        m_leases.erase(task);
+        unassign(task, backup);
+    }
+
+    return unassign(task, worker);
+}
+
+bool Master::unassign(NameId task, int worker) {
+    if (worker == WorkerTable::NONE || !m_workers.alive(worker))  
         return true;
 
-    int code = zk->remove(ASSIGNPATH+"/"+worker+"/"+task, -1);
+    int code = zk->remove(ASSIGNPATH+"/"+m_names.name(m_workers.id(worker))+"/"+m_names.name(task), -1);
     NOTOK_RETURN(code);
 
-    m_worker[worker]--;
+    if (m_partitioned) {
+        return releaseBooking(worker, 1);
+    }
+
+    m_workers.addLoad(worker, -1);
     return true;
 }
 
-bool Master::addTask(const string &task) {
-    if (m_worker.empty()) {
-        LOG_ERROR("no worker to assign task %s", task.c_str());
-        return false;
+bool Master::addTask(NameId task) {
+    //pull mode publishes new tasks in batches for the workers to claim
+    if (m_pull) {
+        m_unpublished[task] = 1;
+        return true;
     }
 
     //find minimal load worker to assign task
-    int minLoad = INT_MAX;
-    string minWorker;
-    for (map<string, int>::iterator it = m_worker.begin(); it != m_worker.end(); ++it) {
-        if (it->second < minLoad) {
-            minWorker = it->first;
-            minLoad = it->second;
+    int worker = pickWorker(WorkerTable::NONE);
+    if (worker == WorkerTable::NONE) {
+        LOG_ERROR_EVERY_MS(1000, "no worker to assign task %s", m_names.name(task).c_str());
+        return false;
+    }
+
+    if (!assignTo(task, worker)) {
+        return false;
+    }
+
+    m_assign[task] = worker;
+    startLease(task);
+
+    return true;
+}
+
+//least loaded worker with spare capacity, NONE if there is none
+int Master::pickWorker(int exclude) {
+    int worker = m_workers.minLoad(exclude);
+    if (worker != WorkerTable::NONE && m_capacity > 0 && m_workers.load(worker) >= m_capacity) {
+        return WorkerTable::NONE;
+    }
+
+    return worker;
+}
+
+//create the assignment node. partitioned masters share the workers, so
+//the data of /assign/<worker> counts the tasks all of them booked there;
+//it is bumped with a versioned set in the same multi as the create, and a
+//master with a stale count rereads it instead of overbooking the worker
+bool Master::assignTo(NameId task, int worker) {
+    string dir = ASSIGNPATH+"/"+m_names.name(m_workers.id(worker));
+    string path = dir+"/"+m_names.name(task);
+
+    if (!m_partitioned) {
+        int code = zk->create(path, "", ZOO_OPEN_ACL_UNSAFE, 0, NULL);
+        NOTOK_RETURN(code);
+
+        m_workers.addLoad(worker, 1);
+        return true;
+    }
+
+    if (m_workers.version(worker) < 0 && !refreshBooking(worker)) {
+        return false;
+    }
+
+    for (int retry = 0; retry < BOOK_RETRIES; ++retry) {
+        int load = m_workers.load(worker);
+        if (m_capacity > 0 && load >= m_capacity) {
+            LOG_DEBUG("worker %s is full", dir.c_str());
+            return false;
+        }
+
+        vector<ZooOp> ops;
+        ops.push_back(ZooOp::set(dir, boost::lexical_cast<string>(load + 1), m_workers.version(worker)));
+        ops.push_back(ZooOp::create(path, "", 0));
+
+        vector<int> results;
+        int code = zk->multi(ops, &results);
+        if (code == ZOK) {
+            m_workers.setLoad(worker, load + 1);
+            m_workers.setVersion(worker, m_workers.version(worker) + 1);
+            return true;
+        }
+
+        if (results.empty() || results[0] != ZBADVERSION) {
+            LOG_ERROR("assign %s failed:%s", path.c_str(), zerror(code));
+            return false;
+        }
+
+        if (!refreshBooking(worker)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+//read the booking counter of a worker, an unset counter starts from the
+//number of its assignments
+bool Master::refreshBooking(int worker) {
+    string data;
+    struct Stat stat;
+    int code = zk->get(ASSIGNPATH+"/"+m_names.name(m_workers.id(worker)), false, &data, &stat);
+    NOTOK_RETURN(code);
+
+    m_workers.setLoad(worker, data.empty() ? stat.numChildren : atoi(data.c_str()));
+    m_workers.setVersion(worker, stat.version);
+    return true;
+}
+
+bool Master::releaseBooking(int worker, int count) {
+    if (worker == WorkerTable::NONE || !m_workers.alive(worker)) {
+        return true;
+    }
+
+    if (m_workers.version(worker) < 0 && !refreshBooking(worker)) {
+        return false;
+    }
+
+    for (int retry = 0; retry < BOOK_RETRIES; ++retry) {
+        int load = max(m_workers.load(worker) - count, 0);
+        int code = zk->set(ASSIGNPATH+"/"+m_names.name(m_workers.id(worker)),
+                boost::lexical_cast<string>(load), m_workers.version(worker));
+        if (code == ZOK) {
+            m_workers.setLoad(worker, load);
+            m_workers.setVersion(worker, m_workers.version(worker) + 1);
+            return true;
         }
+
+        if (code != ZBADVERSION || !refreshBooking(worker)) {
+            NOTOK_RETURN(code);
+        }
+    }
+
+    return false;
+}
+
+//retry tasks left unassigned for lack of a worker or of capacity, in pull
+//mode publishes and requeues that failed before
+void Master::assignPending() {
+    if (m_pull) {
+        vector<string> orphans;
+        orphans.swap(m_orphans);
+        for (int i = 0; i < orphans.size(); ++i) {
+            vector<string> children;
+            int code = zk->getChildren(ASSIGNPATH+"/"+orphans[i], false, &children);
+            if (code == ZNONODE) {
+                continue;
+            }
+            if (code != ZOK) {
+                m_orphans.push_back(orphans[i]);
+                continue;
+            }
+            requeue(orphans[i], children);
+        }
+
+        publishReady();
+        return;
     }
 
-    int code = zk->create(ASSIGNPATH+"/"+minWorker+"/"+task, "", ZOO_OPEN_ACL_UNSAFE, 0, NULL);
+    if (pickWorker(WorkerTable::NONE) == WorkerTable::NONE) {
+        return;
+    }
+
+    vector<NameId> pending;
+    for (size_t i = 0; i < m_assign.capacity(); ++i) {
+        if (m_assign.occupied(i) && m_assign.valueAt(i) == WorkerTable::NONE) {
+            pending.push_back(m_assign.keyAt(i));
+        }
+    }
+
+    for (int i = 0; i < pending.size(); ++i) {
+        if (!addTask(pending[i])) {
+            break;
+        }
+    }
+}
+
+bool Master::updateStatus() {
+    vector<string> children;
+    int code = zk->getChildren(STATUSPATH, true, &children);
     NOTOK_RETURN(code);
 
-    m_worker[minWorker]++;
-    m_assign[task] = minWorker;
+    if (m_partitioned) {
+        vector<string> owned;
+        for (int i = 0; i < children.size(); ++i) {
+            if (ownsTask(children[i])) owned.push_back(children[i]);
+        }
+        children.swap(owned);
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < children.size(); i += MULTI_BATCH) {
+        size_t end = min(i + MULTI_BATCH, children.size());
+        vector<string> batch(children.begin() + i, children.begin() + end);
+        ok = cleanupTasks(batch) && ok;
+    }
+
+    return ok;
+}
+
+//remove task, assignment and status znodes of finished tasks in one multi.
+//a task that makes the transaction fail is cleaned up alone and the rest
+//is retried without it.
+bool Master::cleanupTasks(const vector<string> &tasks) {
+    vector<string> pending(tasks);
+    bool ok = true;
+    int conflicts = 0;
+
+    while (!pending.empty()) {
+        vector<ZooOp> ops;
+        vector<int> owner;
+        for (int i = 0; i < pending.size(); ++i) {
+            taskOps(pending[i], &ops);
+            owner.resize(ops.size(), i);
+        }
+
+        //partitioned masters release the bookings in the same transaction
+        map<int, int> booked;
+        if (m_partitioned) {
+            for (int i = 0; i < pending.size(); ++i) {
+                NameId id = m_names.find(pending[i]);
+                int *worker = id == INVALID_NAME ? NULL : m_assign.find(id);
+                const Lease *lease = id == INVALID_NAME ? NULL : m_leases.find(id);
+                if (worker != NULL && *worker != WorkerTable::NONE) booked[*worker]++;
+                if (lease != NULL && lease->backup != WorkerTable::NONE) booked[lease->backup]++;
+            }
+
+            for (map<int, int>::iterator it = booked.begin(); it != booked.end(); ++it) {
+                if (m_workers.version(it->first) < 0) refreshBooking(it->first);
+                ops.push_back(ZooOp::set(ASSIGNPATH+"/"+m_names.name(m_workers.id(it->first)),
+                            boost::lexical_cast<string>(max(m_workers.load(it->first) - it->second, 0)),
+                            m_workers.version(it->first)));
+            }
+            owner.resize(ops.size(), -1);
+        }
+
+        vector<int> results;
+        int code = zk->multi(ops, &results);
+        if (code == ZOK) {
+            for (map<int, int>::iterator it = booked.begin(); it != booked.end(); ++it) {
+                m_workers.setLoad(it->first, max(m_workers.load(it->first) - it->second, 0));
+                m_workers.setVersion(it->first, m_workers.version(it->first) + 1);
+            }
+            for (int i = 0; i < pending.size(); ++i) {
+                finishTask(pending[i]);
+            }
+            break;
+        }
+
+        int failed = ZooKeeper::failedOp(results);
+        if (failed < 0) {
+            LOG_ERROR("cleanup of %d tasks failed:%s", (int)pending.size(), zerror(code));
+            return false;
+        }
+
+        int task = owner[failed];
+        if (task < 0) {
+            //another master moved a booking counter, reread and retry
+            if (++conflicts > BOOK_RETRIES) {
+                LOG_ERROR("cleanup of %d tasks kept conflicting", (int)pending.size());
+                return false;
+            }
+            for (map<int, int>::iterator it = booked.begin(); it != booked.end(); ++it) {
+                refreshBooking(it->first);
+            }
+            continue;
+        }
+
+        ok = cleanupTask(pending[task]) && ok;
+        pending.erase(pending.begin() + task);
+    }
+
+    return ok;
+}
+
+void Master::taskOps(const string &task, vector<ZooOp> *ops) {
+    ops->push_back(ZooOp::remove(TASKPATH+"/"+task));
+
+    NameId id = m_names.find(task);
+    int *worker = id == INVALID_NAME ? NULL : m_assign.find(id);
+    //a claiming worker removes its own assignment with the status
+    if (worker != NULL && *worker != WorkerTable::NONE && !m_pull) {
+        ops->push_back(ZooOp::remove(ASSIGNPATH+"/"+m_names.name(m_workers.id(*worker))+"/"+task));
+    }
+
+    const Lease *lease = id == INVALID_NAME ? NULL : m_leases.find(id);
+    if (lease != NULL && lease->backup != WorkerTable::NONE) {
+        ops->push_back(ZooOp::remove(ASSIGNPATH+"/"+m_names.name(m_workers.id(lease->backup))+"/"+task));
+    }
+
+    ops->push_back(ZooOp::remove(STATUSPATH+"/"+task));
+}
+
+//clean up one task node by node, tolerating nodes already gone
+bool Master::cleanupTask(const string &task) {
+    vector<ZooOp> ops;
+    taskOps(task, &ops);
+
+    for (int i = 0; i < ops.size(); ++i) {
+        int code = zk->remove(ops[i].path, -1);
+        if (code != ZOK && code != ZNONODE) {
+            LOG_ERROR("remove %s failed:%s", ops[i].path.c_str(), zerror(code));
+            return false;
+        }
+    }
+
+    if (m_partitioned) {
+        NameId id = m_names.find(task);
+        int *worker = id == INVALID_NAME ? NULL : m_assign.find(id);
+        const Lease *lease = id == INVALID_NAME ? NULL : m_leases.find(id);
+        if (worker != NULL) releaseBooking(*worker, 1);
+        if (lease != NULL) releaseBooking(lease->backup, 1);
+    }
+
+    finishTask(task);
+    return true;
+}
+
+void Master::finishTask(const string &task) {
+    LOG_DEBUG("finish task %s", task.c_str());
+
+    NameId id = m_names.find(task);
+    if (id == INVALID_NAME) {
+        return;
+    }
+
+    int *worker = m_assign.find(id);
+    if (worker == NULL) {
+        return;
+    }
+
+    //partitioned masters already released the booking counters
+    if (*worker != WorkerTable::NONE && !m_partitioned) {
+        m_workers.addLoad(*worker, -1);
+    }
+
+    Lease *lease = m_leases.find(id);
+    if (lease != NULL) {
+        m_latency[taskType(id)].add(now_ms() - lease->start);
+        if (lease->backup != WorkerTable::NONE && !m_partitioned) {
+            m_workers.addLoad(lease->backup, -1);
+        }
+        m_leases.erase(id);
+    }
+
+    m_assign.erase(id);
+    m_names.release(id);
+}
+
+void Master::startLease(NameId task) {
+    Lease &lease = m_leases[task];
+    lease.start = now_ms();
+    lease.expire = lease.start + LEASE_TIMEOUT_MS;
+    lease.backup = WorkerTable::NONE;
+}
+
+void Master::tick() {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    if (!m_active) {
+        return;
+    }
+
+    checkLeases();
+    assignPending();
+}
+
+//back up expired or slow tasks on another worker
+void Master::checkLeases() {
+    int64_t now = now_ms();
+
+    vector<NameId> late;
+    for (size_t i = 0; i < m_leases.capacity() && late.size() < MAX_SPECULATE; ++i) {
+        if (!m_leases.occupied(i)) {
+            continue;
+        }
+
+        const Lease &lease = m_leases.valueAt(i);
+        if (lease.backup != WorkerTable::NONE) {
+            continue;
+        }
+
+        NameId task = m_leases.keyAt(i);
+        if (lease.expire < now || isStraggler(task, now - lease.start)) {
+            late.push_back(task);
+        }
+    }
+
+    for (int i = 0; i < late.size(); ++i) {
+        speculate(late[i], now);
+    }
+}
+
+//each worker rewrites LEASEPATH/<worker> with the names of its running
+//tasks, one line each; a new version renews all of them at once. the
+//node is read on its data watch, so the tick sends no requests for it
+bool Master::readLease(int worker) {
+    string path = LEASEPATH+"/"+m_names.name(m_workers.id(worker));
+    string data;
+    struct Stat stat;
+    int code = zk->get(path, true, &data, &stat);
+    if (code == ZNONODE) {
+        //the worker creates it after its WORKERPATH node, watch for it
+        code = zk->exists(path, true, NULL);
+        if (code == ZOK) {
+            return readLease(worker);
+        }
+        return code == ZNONODE;
+    }
+    NOTOK_RETURN(code);
+
+    if (stat.mzxid == m_workers.leaseZxid(worker)) {
+        return true;
+    }
+    m_workers.setLeaseZxid(worker, stat.mzxid);
+    renewLeases(worker, data, now_ms());
+    return true;
+}
+
+void Master::renewLeases(int worker, const string &data, int64_t now) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t end = data.find('\n', pos);
+        if (end == string::npos) end = data.size();
+
+        NameId task = m_names.find(data.substr(pos, end - pos));
+        Lease *lease = task == INVALID_NAME ? NULL : m_leases.find(task);
+        if (lease != NULL) {
+            int *owner = m_assign.find(task);
+            if ((owner != NULL && *owner == worker) || lease->backup == worker) {
+                lease->expire = now + LEASE_TIMEOUT_MS;
+            }
+        }
+
+        pos = end + 1;
+    }
+}
+
+bool Master::isStraggler(NameId task, int64_t elapsed) const {
+    map<uint32_t, Histogram>::const_iterator it = m_latency.find(taskType(task));
+    if (it == m_latency.end() || it->second.count() < SLOW_MIN_SAMPLES) {
+        return false;
+    }
+
+    uint64_t limit = max(it->second.percentile(0.99), it->second.percentile(0.5) * SLOW_FACTOR);
+    return elapsed > (int64_t)limit;
+}
+
+//run a copy of a late task on another worker, the first status wins
+bool Master::speculate(NameId task, int64_t now) {
+    int *owner = m_assign.find(task);
+    Lease *lease = m_leases.find(task);
+    if (owner == NULL || *owner == WorkerTable::NONE || lease == NULL) {
+        return false;
+    }
+
+    int worker = pickWorker(*owner);
+    if (worker == WorkerTable::NONE || !assignTo(task, worker)) {
+        return false;
+    }
+
+    string name = m_names.name(task);
+    LOG_WARN("task %s late on %s for %lldms, backup on %s", name.c_str(),
+            m_names.name(m_workers.id(*owner)).c_str(), (long long)(now - lease->start),
+            m_names.name(m_workers.id(worker)).c_str());
 
+    lease->backup = worker;
+    lease->expire = now + LEASE_TIMEOUT_MS;
     return true;
 }
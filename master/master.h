@@ -5,41 +5,119 @@
 #include "zookeeper.h"
 #include "common.h"
 #include <map>
+#include "name_table.h"
+#include "worker_table.h"
+#include "histogram.h"
+#include "load_report.h"
+#include <boost/thread/mutex.hpp>
 
 using namespace std;
 
+//lease of an assigned task, renewed by the heartbeats of its workers
+typedef struct Lease {
+    int64_t start;  //ms when assigned
+    int64_t expire; //ms when the lease runs out
+    int backup;     //worker slot of the speculative copy or NONE
+} Lease;
+
 class Master : public Watcher {
 public:
-    Master(ZooKeeper *zk) : Watcher(zk) {}
+    Master(ZooKeeper *zk) : Watcher(zk), m_active(false), m_partitioned(false), m_capacity(0),
+        m_pull(false) {}
 
     bool createMaster();
     bool checkMaster();
 
     void runAsMaster();
 
+    //run together with every other live master, each one scheduling the
+    //tasks that hash into its share of the buckets
+    bool runPartitioned();
+
+    //most tasks booked on one worker by all masters, 0 for no limit
+    void setCapacity(int capacity) { m_capacity = capacity; }
+
+    //publish tasks to the READYPATH shards for the workers to claim, and
+    //only put back the tasks of lost workers. not for partitioned masters
+    void setPull(bool pull) { m_pull = pull; }
+
+    //lease checks and retry of unassigned tasks, called periodically
+    void tick();
+
     bool updateWorkers();
     bool updateTasks();
+    bool updateStatus();
 
     bool addWorker(const string &worker);
-    bool deleteWorker(const string &worker);
-    bool addTask(const string &task);
-    bool deleteTask(const string &task, const string &worker);
+    bool deleteWorker(int worker);
+    bool addTask(NameId task);
+    bool deleteTask(NameId task, int worker);
+    bool cleanupTasks(const vector<string> &tasks);
 
 private:
     bool initTasks();
     bool initWorkers();
 
+    void process(int type, int state, const string &path);
     void deleted(const string &path);
     void childChange(const string &path);
+    void dataChange(const string &path);
+    void created(const string &path);
+    bool readReport(int worker);
+    bool drainWorker(int worker);
+    bool moveTasks(int worker, const vector<string> &tasks);
 
     bool taskWatch();
     bool workerWatch();
 
+    void taskOps(const string &task, vector<ZooOp> *ops);
+    bool cleanupTask(const string &task);
+    void finishTask(const string &task);
+    bool unassign(NameId task, int worker);
+    void reassign(NameId task, int worker);
+
+    int pickWorker(int exclude);
+    bool assignTo(NameId task, int worker);
+    bool refreshBooking(int worker);
+    bool releaseBooking(int worker, int count);
+    void assignPending();
+
+    bool createReady();
+    bool initReady(const FlatMap<NameId, char> &tasks);
+    bool publishReady();
+    bool requeue(const string &worker, const vector<string> &tasks);
+    bool withdraw(NameId task, int worker);
+
+    bool updateMasters();
+    bool ownsTask(const string &task) const;
+    void rebuild();
+
+    void checkLeases();
+    void startLease(NameId task);
+    bool readLease(int worker);
+    void renewLeases(int worker, const string &data, int64_t now);
+    bool isStraggler(NameId task, int64_t elapsed) const;
+    bool speculate(NameId task, int64_t now);
+
 private:
-    map<string, string> m_assign; //map<task, worker>
-    map<string, int> m_worker;    //map<worker, load>
+    NameTable m_names;            //task and worker names
+    FlatMap<NameId, int> m_assign; //task -> worker slot, NONE if unassigned
+    WorkerTable m_workers;        //worker slot -> name, load
+    FlatMap<NameId, Lease> m_leases; //assigned task -> lease
+    map<uint32_t, Histogram> m_latency; //task type -> run time in ms
+    boost::mutex m_mutex;         //watch thread against tick
+    bool m_active;
+
+    bool m_partitioned;
+    int m_capacity;
+    vector<string> m_masters;     //sorted live masters
+    vector<char> m_buckets;       //bucket -> owned by this master
     string m_master_node;
     string m_watch_node;
+
+    bool m_pull;
+    FlatMap<NameId, char> m_unpublished; //tasks not in READYPATH yet
+    vector<string> m_orphans;     //lost workers whose claims are not requeued
 };
 
 #endif
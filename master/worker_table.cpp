@@ -0,0 +1,86 @@
+#include "worker_table.h"
+#include <climits>
+
+const int WorkerTable::NONE;
+
+int WorkerTable::add(NameId worker) {
+    int *slot = m_index.find(worker);
+    if (slot != NULL) {
+        return *slot;
+    }
+
+    int index;
+    if (!m_free.empty()) {
+        index = m_free.back();
+        m_free.pop_back();
+        m_id[index] = worker;
+        m_load[index] = 0;
+        m_alive[index] = 1;
+        m_version[index] = -1;
+        m_lease_zxid[index] = 0;
+        m_threads[index] = 0;
+        m_busy[index] = 0;
+        m_draining[index] = 0;
+    } else {
+        index = m_id.size();
+        m_id.push_back(worker);
+        m_load.push_back(0);
+        m_alive.push_back(1);
+        m_version.push_back(-1);
+        m_lease_zxid.push_back(0);
+        m_threads.push_back(0);
+        m_busy.push_back(0);
+        m_draining.push_back(0);
+    }
+
+    m_index[worker] = index;
+    ++m_count;
+    return index;
+}
+
+void WorkerTable::remove(int slot) {
+    if (slot < 0 || slot >= slots() || !m_alive[slot]) {
+        return;
+    }
+
+    m_index.erase(m_id[slot]);
+    m_alive[slot] = 0;
+    m_load[slot] = 0;
+    m_free.push_back(slot);
+    --m_count;
+}
+
+int WorkerTable::find(NameId worker) const {
+    const int *slot = m_index.find(worker);
+    return slot == NULL ? NONE : *slot;
+}
+
+//load per thread compared by cross multiplying, unknown threads count as one
+static bool lighter(int load, int threads, int minLoad, int minThreads) {
+    return (int64_t)load * (minThreads > 0 ? minThreads : 1)
+        < (int64_t)minLoad * (threads > 0 ? threads : 1);
+}
+
+int WorkerTable::minLoad(int exclude) const {
+    int minSlot = NONE;
+    int minBusy = NONE;
+    for (int i = 0; i < slots(); ++i) {
+        if (!m_alive[i] || m_draining[i] || i == exclude) {
+            continue;
+        }
+
+        int &best = m_busy[i] ? minBusy : minSlot;
+        if (best == NONE || lighter(m_load[i], m_threads[i], m_load[best], m_threads[best])) {
+            best = i;
+        }
+    }
+
+    return minSlot != NONE ? minSlot : minBusy;
+}
+
+size_t WorkerTable::memoryUsage() const {
+    return m_id.capacity() * sizeof(NameId) + m_load.capacity() * sizeof(int)
+        + m_alive.capacity() + m_version.capacity() * sizeof(int) + m_lease_zxid.capacity() * sizeof(int64_t)
+        + m_threads.capacity() * sizeof(int) + m_busy.capacity() + m_draining.capacity()
+        + m_free.capacity() * sizeof(int) + m_index.memoryUsage();
+}
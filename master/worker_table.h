@@ -0,0 +1,77 @@
+#ifndef _WORKER_TABLE_H_
+#define _WORKER_TABLE_H_
+
+#include <stdint.h>
+#include <vector>
+#include "name_table.h"
+
+//workers known by the master, stored as parallel arrays indexed by a slot
+//number. tasks refer to their worker by slot, so the hot scan for the least
+//loaded worker only walks the load and alive arrays.
+class WorkerTable {
+public:
+    static const int NONE = -1;
+
+    WorkerTable() : m_count(0) {}
+
+    //return the slot of worker, adding it with zero load if needed
+    int add(NameId worker);
+
+    //free the slot of worker, it may be reused by the next add
+    void remove(int slot);
+
+    //return the slot of worker or NONE
+    int find(NameId worker) const;
+
+    //return the alive slot with minimal load per thread or NONE, skipping
+    //exclude and draining workers. busy workers are only returned if every
+    //worker is busy
+    int minLoad(int exclude = NONE) const;
+
+    NameId id(int slot) const { return m_id[slot]; }
+    int load(int slot) const { return m_load[slot]; }
+    void addLoad(int slot, int delta) { m_load[slot] += delta; }
+    void setLoad(int slot, int load) { m_load[slot] = load; }
+    bool alive(int slot) const { return m_alive[slot] != 0; }
+
+    //data version of the booking counter in the assign node of the worker
+    int version(int slot) const { return m_version[slot]; }
+    void setVersion(int slot, int version) { m_version[slot] = version; }
+
+    //mzxid of the last lease node read from the worker
+    int64_t leaseZxid(int slot) const { return m_lease_zxid[slot]; }
+    void setLeaseZxid(int slot, int64_t zxid) { m_lease_zxid[slot] = zxid; }
+
+    //capacity signals of the last load report, threads 0 if unknown
+    int threads(int slot) const { return m_threads[slot]; }
+    bool busy(int slot) const { return m_busy[slot] != 0; }
+    void setReport(int slot, int threads, bool busy) { m_threads[slot] = threads; m_busy[slot] = busy; }
+
+    //a draining worker gets no new tasks
+    bool draining(int slot) const { return m_draining[slot] != 0; }
+    void setDraining(int slot, bool draining) { m_draining[slot] = draining; }
+
+    //number of slots, alive or not
+    int slots() const { return m_id.size(); }
+
+    //number of alive workers
+    int size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+
+    size_t memoryUsage() const;
+
+private:
+    std::vector<NameId> m_id;
+    std::vector<int> m_load;
+    std::vector<char> m_alive;
+    std::vector<int> m_version;
+    std::vector<int64_t> m_lease_zxid;
+    std::vector<int> m_threads;
+    std::vector<char> m_busy;
+    std::vector<char> m_draining;
+    std::vector<int> m_free;
+    FlatMap<NameId, int> m_index; //worker id -> slot
+    int m_count;
+};
+
+#endif
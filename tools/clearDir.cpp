@@ -1,25 +1,47 @@
 #include "zookeeper.h"
+#include "tree_remover.h"
 #include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
 
 using namespace std;
 
+static void progress(const RemoveProgress &p) {
+    uint64_t done = p.listing ? p.listed : p.removed;
+    printf("%s listed:%llu removed:%llu %.1fs %.0f nodes/s\n", p.listing ? "listing" : "removing",
+            (unsigned long long)p.listed, (unsigned long long)p.removed, p.seconds,
+            p.seconds > 0 ? done / p.seconds : 0.0);
+    fflush(stdout);
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
+    if (argc < 2 || argc > 5) {
         cout << "please input dir" << endl;
-        cout << "\t usage:./clearDir dir" << endl;
+        cout << "\t usage:./clearDir dir [sessions] [window] [batch]" << endl;
+        cout << "\t sessions: zookeeper sessions to spread the requests over, default 1" << endl;
+        cout << "\t window: requests in flight, default " << REMOVE_WINDOW << endl;
+        cout << "\t batch: removes per multi, default " << REMOVE_BATCH << endl;
         return 0;
     }
 
     string host = "192.168.85.132:2181,192.168.85.132:2182,192.168.85.132:2183";
-    
-    ZooKeeper *zk = new ZooKeeper(host, 10000);
+    int sessions = argc > 2 ? atoi(argv[2]) : 1;
+    int window = argc > 3 ? atoi(argv[3]) : REMOVE_WINDOW;
+    int batch = argc > 4 ? atoi(argv[4]) : REMOVE_BATCH;
+
+    vector<ZooKeeper*> zks;
+    for (int i = 0; i < (sessions > 0 ? sessions : 1); ++i) {
+        zks.push_back(new ZooKeeper(host, 10000));
+    }
 
-    int code = zk->removeDir(string(argv[1]));
+    TreeRemover remover(zks, window, batch);
+    remover.setProgress(progress, 1000);
+    int code = remover.remove(string(argv[1]));
 
     if (code == ZOK) {
-        cout << "clear /assign success" << endl;
+        cout << "clear " << argv[1] << " success" << endl;
     } else {
-        cout << "clear /assign error: " << zerror(code) << endl;
+        cout << "clear " << argv[1] << " error: " << zerror(code) << endl;
     }
 }
@@ -0,0 +1,326 @@
+#include "clog_binary.h"
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const char *LEVELS[] = {"LOG_INVALID", "LOG_ERROR", "LOG_WARN", "LOG_INFO", "LOG_DEBUG"};
+
+typedef struct Site {
+    uint32_t line;
+    string file;
+    string format;
+} Site;
+
+//sites are numbered per process, a file may hold several runs
+typedef map<pair<int, uint32_t>, Site> SiteMap;
+
+static bool validRecord(const string &data, size_t pos, ClogRecord *record) {
+    if (pos + sizeof(ClogRecord) > data.size()) {
+        return false;
+    }
+
+    memcpy(record, data.data() + pos, sizeof(ClogRecord));
+    return record->size >= sizeof(ClogRecord) && pos + record->size <= data.size()
+        && record->kind >= CLOG_RECORD_START && record->kind <= CLOG_RECORD_TEXT
+        && record->level <= 4;
+}
+
+//the next START record, skipping text lines or a torn tail of an earlier run
+static size_t findStart(const string &data, size_t from) {
+    size_t pos = from;
+    while ((pos = data.find(CLOG_BINARY_MAGIC, pos)) != string::npos) {
+        ClogRecord record;
+        if (pos >= sizeof(ClogRecord) && pos - sizeof(ClogRecord) >= from
+                && validRecord(data, pos - sizeof(ClogRecord), &record) && record.kind == CLOG_RECORD_START) {
+            return pos - sizeof(ClogRecord);
+        }
+        ++pos;
+    }
+
+    return string::npos;
+}
+
+//u32 line, u16 length, file
+static size_t readLocation(const string &data, size_t pos, size_t end, uint32_t *line, string *file) {
+    if (pos + 6 > end) {
+        return end;
+    }
+
+    uint16_t len;
+    memcpy(line, data.data() + pos, 4);
+    memcpy(&len, data.data() + pos + 4, 2);
+    pos += 6;
+    if (pos + len > end) {
+        len = end - pos;
+    }
+    file->assign(data, pos, len);
+    return pos + len;
+}
+
+static string jsonString(const string &s) {
+    string out = "\"";
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+template <typename T>
+static bool take(const string &data, size_t *pos, size_t end, T *value) {
+    if (*pos + sizeof(T) > end) {
+        return false;
+    }
+    memcpy(value, data.data() + *pos, sizeof(T));
+    *pos += sizeof(T);
+    return true;
+}
+
+template <typename T>
+static string print(const string &spec, T value) {
+    int n = snprintf(NULL, 0, spec.c_str(), value);
+    vector<char> buf(n + 1);
+    snprintf(&buf[0], buf.size(), spec.c_str(), value);
+    return string(&buf[0], n);
+}
+
+//literal text of a format, "%%" becomes '%'
+static void appendLiteral(const char *p, const char *end, string *out) {
+    while (p < end) {
+        if (p[0] == '%' && p + 1 < end && p[1] == '%') {
+            ++p;
+        }
+        *out += *p++;
+    }
+}
+
+//format the raw arguments of a LOG record with the format of its site
+static bool expand(const string &format, const string &data, size_t pos, size_t end,
+        string *message, vector<string> *args) {
+    ClogSpec spec;
+    const char *p = format.c_str();
+    while (clog_next_spec(p, &spec)) {
+        appendLiteral(p, spec.start, message);
+
+        //'*' width and precision are printed into the spec
+        string conv;
+        for (const char *c = spec.start; c < spec.end; ++c) {
+            if (*c != '*') {
+                conv += *c;
+                continue;
+            }
+            int star;
+            if (!take(data, &pos, end, &star)) {
+                return false;
+            }
+            conv += print("%d", star);
+        }
+
+        //json numbers are printed plain, without width or sign flags
+        char last = conv[conv.size() - 1];
+        string value;
+        string json;
+        switch (spec.type) {
+        case CLOG_ARG_INT: {
+            int v;
+            if (!take(data, &pos, end, &v)) return false;
+            value = print(conv, v);
+            json = last == 'u' ? print("%u", v) : print("%d", v);
+            break;
+        }
+        case CLOG_ARG_LONG: {
+            long long v;
+            if (!take(data, &pos, end, &v)) return false;
+            value = print(conv, v);
+            json = last == 'u' ? print("%llu", v) : print("%lld", v);
+            break;
+        }
+        case CLOG_ARG_DOUBLE: {
+            double v;
+            if (!take(data, &pos, end, &v)) return false;
+            value = print(conv, v);
+            json = print("%.17g", v);
+            break;
+        }
+        case CLOG_ARG_LDOUBLE: {
+            long double v;
+            if (!take(data, &pos, end, &v)) return false;
+            value = print(conv, v);
+            json = print("%.21Lg", v);
+            break;
+        }
+        case CLOG_ARG_PTR: {
+            uint64_t v;
+            if (!take(data, &pos, end, &v)) return false;
+            value = print(conv, (void *)(uintptr_t)v);
+            json = jsonString(value);
+            break;
+        }
+        case CLOG_ARG_STRING: {
+            uint16_t len;
+            if (!take(data, &pos, end, &len) || pos + len > end) return false;
+            string s(data, pos, len);
+            pos += len;
+            value = print(conv, s.c_str());
+            json = jsonString(s);
+            break;
+        }
+        default:
+            return false;
+        }
+
+        //a hex or octal number or a char keeps its printed form
+        if (last == 'x' || last == 'X' || last == 'o' || last == 'c') {
+            json = jsonString(value);
+        }
+        *message += value;
+        args->push_back(json);
+        p = spec.end;
+    }
+
+    appendLiteral(p, p + strlen(p), message);
+    return true;
+}
+
+static string timeString(uint64_t us) {
+    time_t sec = us / 1000000;
+    struct tm lt;
+    localtime_r(&sec, &lt);
+    char buf[64];
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &lt);
+    snprintf(buf + n, sizeof(buf) - n, ".%06d", (int)(us % 1000000));
+    return buf;
+}
+
+static void output(bool json, const ClogRecord &record, int pid, uint32_t line, const string &file,
+        const string &message, const vector<string> &args) {
+    if (!json) {
+        cout << timeString(record.time) << " [" << pid << ":" << record.tid << "][" << LEVELS[record.level]
+            << "][" << file << ":" << line << "] " << message << "\n";
+        return;
+    }
+
+    ostringstream out;
+    out << "{\"time\":" << jsonString(timeString(record.time)) << ",\"us\":" << record.time
+        << ",\"pid\":" << pid << ",\"tid\":" << record.tid << ",\"level\":" << jsonString(LEVELS[record.level] + 4)
+        << ",\"file\":" << jsonString(file) << ",\"line\":" << line << ",\"message\":" << jsonString(message);
+    if (record.kind == CLOG_RECORD_LOG) {
+        out << ",\"args\":[";
+        for (int i = 0; i < args.size(); ++i) {
+            out << (i > 0 ? "," : "") << args[i];
+        }
+        out << "]";
+    }
+    out << "}\n";
+    cout << out.str();
+}
+
+//SITE records of one thread may come after LOG records of another, so the
+//sites are read in a first pass
+static int decode(const string &data, bool json) {
+    SiteMap sites;
+    int bad = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        int session = -1;
+        int pid = 0;
+        size_t pos = findStart(data, 0);
+        while (pos != string::npos && pos < data.size()) {
+            ClogRecord record;
+            if (!validRecord(data, pos, &record)) {
+                bad += pass;
+                pos = findStart(data, pos + 1);
+                continue;
+            }
+
+            size_t body = pos + sizeof(ClogRecord);
+            size_t end = pos + record.size;
+            pos = end;
+
+            if (record.kind == CLOG_RECORD_START) {
+                ++session;
+                pid = record.tid;
+                continue;
+            }
+
+            if (record.kind == CLOG_RECORD_SITE) {
+                if (pass == 0) {
+                    Site site;
+                    size_t at = readLocation(data, body, end, &site.line, &site.file);
+                    uint16_t len = 0;
+                    if (at + 2 <= end) {
+                        memcpy(&len, data.data() + at, 2);
+                        at += 2;
+                    }
+                    site.format.assign(data, at, min((size_t)len, end - at));
+                    sites[make_pair(session, record.site)] = site;
+                }
+                continue;
+            }
+
+            if (pass == 0) {
+                continue;
+            }
+
+            vector<string> args;
+            if (record.kind == CLOG_RECORD_TEXT) {
+                uint32_t line;
+                string file;
+                size_t at = readLocation(data, body, end, &line, &file);
+                output(json, record, pid, line, file, data.substr(at, end - at), args);
+                continue;
+            }
+
+            SiteMap::const_iterator it = sites.find(make_pair(session, record.site));
+            string message;
+            if (it == sites.end() || !expand(it->second.format, data, body, end, &message, &args)) {
+                ++bad;
+                continue;
+            }
+            output(json, record, pid, it->second.line, it->second.file, message, args);
+        }
+    }
+
+    if (bad > 0) {
+        cerr << bad << " records could not be decoded" << endl;
+    }
+    return bad > 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    bool json = argc == 3 && string(argv[1]) == "-json";
+    if (argc != 2 && !json) {
+        cout << "expand a binary clog file to text or json lines" << endl;
+        cout << "\t usage:./clogDecode [-json] file" << endl;
+        return 1;
+    }
+
+    ifstream in(argv[argc - 1], ios::binary);
+    if (!in) {
+        cerr << "can not open " << argv[argc - 1] << endl;
+        return 1;
+    }
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    return decode(data, json);
+}
@@ -0,0 +1,192 @@
+//submit tasks under /tasks to load the master. every request is one async
+//create, or with batch > 1 a multi of batch creates, and up to window
+//requests are in flight. with a rate the requests are spread to that many
+//tasks per second, otherwise they go as fast as the window allows.
+//
+//the payload of a task is random bytes, of the given size (fixed), of 0
+//to twice the size (uniform) or exponential with the size as its mean
+//(exp), at most PAYLOAD_INLINE_LIMIT.
+//
+//usage: ./taskGen tasks [rate] [batch] [window] [payload bytes] [fixed|uniform|exp] [host]
+
+#include "zookeeper.h"
+#include "clog.h"
+#include "common.h"
+#include "histogram.h"
+#include "payload_store.h"
+#include "task_format.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+using namespace std;
+
+enum SizeDist { DIST_FIXED, DIST_UNIFORM, DIST_EXP };
+
+static boost::mutex g_mutex;
+static boost::condition_variable g_cond;
+static int g_inflight = 0;
+static uint64_t g_done = 0;
+static uint64_t g_failed = 0;
+static Histogram g_latency;    //us per request
+
+static void finish(int64_t start, int count, bool ok) {
+    boost::lock_guard<boost::mutex> guard(g_mutex);
+    --g_inflight;
+    if (ok) {
+        g_done += count;
+    } else {
+        g_failed += count;
+    }
+    g_latency.add(now_us() - start);
+    g_cond.notify_one();
+}
+
+//a create retried after a lost connection may find its own node
+static void onCreated(int64_t start, int code, const char *path) {
+    if (code != ZOK && code != ZNODEEXISTS) {
+        LOG_ERROR_EVERY_MS(1000, "create task failed:%s", zerror(code));
+    }
+    finish(start, 1, code == ZOK || code == ZNODEEXISTS);
+}
+
+static void onMulti(int64_t start, int count, int code, const vector<int> &results) {
+    if (code != ZOK) {
+        LOG_ERROR_EVERY_MS(1000, "create %d tasks failed:%s", count, zerror(code));
+    }
+    finish(start, count, code == ZOK);
+}
+
+static size_t payloadSize(SizeDist dist, size_t size) {
+    double n = size;
+    if (dist == DIST_UNIFORM) {
+        n = 2.0 * size * rand() / RAND_MAX;
+    } else if (dist == DIST_EXP) {
+        n = -log((rand() + 1.0) / (RAND_MAX + 2.0)) * size;
+    }
+    return n < PAYLOAD_INLINE_LIMIT ? (size_t)n : PAYLOAD_INLINE_LIMIT;
+}
+
+static void printProgress(uint64_t sent, int64_t start) {
+    uint64_t done;
+    uint64_t failed;
+    {
+        boost::lock_guard<boost::mutex> guard(g_mutex);
+        done = g_done;
+        failed = g_failed;
+    }
+    double elapsed = (now_us() - start) / 1e6;
+    printf("sent:%llu done:%llu failed:%llu %.1fs %.0f tasks/s\n", (unsigned long long)sent,
+            (unsigned long long)done, (unsigned long long)failed, elapsed, done / elapsed);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 8) {
+        cout << "submit tasks under " << TASKPATH << endl;
+        cout << "\t usage:./taskGen tasks [rate] [batch] [window] [payload bytes] [fixed|uniform|exp] [host]" << endl;
+        cout << "\t rate: tasks per second, 0 for as fast as possible, default 0" << endl;
+        cout << "\t batch: creates per multi, 1 for single async creates, default 1" << endl;
+        cout << "\t window: requests in flight, default 64" << endl;
+        cout << "\t payload: payload bytes and their distribution, default 128 fixed" << endl;
+        return 0;
+    }
+
+    uint64_t ntask = strtoull(argv[1], NULL, 10);
+    double rate = argc > 2 ? atof(argv[2]) : 0;
+    int batch = argc > 3 ? atoi(argv[3]) : 1;
+    int window = argc > 4 ? atoi(argv[4]) : 64;
+    size_t size = argc > 5 ? strtoul(argv[5], NULL, 10) : 128;
+    string dist = argc > 6 ? argv[6] : "fixed";
+    string host = argc > 7 ? argv[7] : "192.168.85.132:2181,192.168.85.132:2182,192.168.85.132:2183";
+    batch = batch > 0 ? batch : 1;
+    window = window > 0 ? window : 1;
+    SizeDist sizeDist = dist == "uniform" ? DIST_UNIFORM : dist == "exp" ? DIST_EXP : DIST_FIXED;
+
+    ZooKeeper zk(host, 10000);
+    int code = zk.create(TASKPATH, "", ZOO_OPEN_ACL_UNSAFE, 0, NULL);
+    if (code != ZOK && code != ZNODEEXISTS) {
+        cout << "create " << TASKPATH << " error: " << zerror(code) << endl;
+        return 1;
+    }
+
+    //payloads are cut from one random buffer
+    srand(time(NULL));
+    string random(PAYLOAD_INLINE_LIMIT * 2, '\0');
+    for (size_t i = 0; i < random.size(); ++i) {
+        random[i] = (char)rand();
+    }
+
+    //names of this run do not collide with an earlier one
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "gen-%ld-", (long)time(NULL));
+
+    int64_t start = now_us();
+    int64_t lastReport = start;
+    uint64_t sent = 0;
+    string data;
+    boost::unique_lock<boost::mutex> lock(g_mutex);
+    while (sent < ntask || g_inflight > 0) {
+        int64_t now = now_us();
+        if (now - lastReport >= 1000000) {
+            lastReport = now;
+            lock.unlock();
+            printProgress(sent, start);
+            lock.lock();
+        }
+
+        //the time the next request is due at the given rate
+        int64_t due = rate > 0 ? start + (int64_t)(sent * 1e6 / rate) : now;
+        if (sent >= ntask || g_inflight >= window || due > now) {
+            int64_t wait = sent < ntask && g_inflight < window ? due - now : 1000000;
+            g_cond.timed_wait(lock, boost::posix_time::microseconds(wait < 1000000 ? wait : 1000000));
+            continue;
+        }
+
+        int count = ntask - sent < (uint64_t)batch ? (int)(ntask - sent) : batch;
+        ++g_inflight;
+        lock.unlock();
+
+        vector<ZooOp> ops;
+        for (int i = 0; i < count; ++i) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s%010llu", prefix, (unsigned long long)(sent + i));
+            size_t n = payloadSize(sizeDist, size);
+            data.clear();
+            encode_task(TaskHeader(), Slice(name, strlen(name)),
+                    Slice(random.data() + rand() % (random.size() - n + 1), n), &data);
+            ops.push_back(ZooOp::create(TASKPATH + "/" + name, data, 0));
+        }
+
+        int64_t sentAt = now_us();
+        int ret = count == 1
+            ? zk.acreate(ops[0].path, ops[0].data, 0, boost::bind(&onCreated, sentAt, _1, _2))
+            : zk.amulti(ops, boost::bind(&onMulti, sentAt, count, _1, _2));
+
+        lock.lock();
+        if (ret != ZOK) {
+            LOG_ERROR_EVERY_MS(1000, "send %d tasks failed:%s", count, zerror(ret));
+            --g_inflight;
+            g_failed += count;
+        }
+        sent += count;
+    }
+    lock.unlock();
+
+    double elapsed = (now_us() - start) / 1e6;
+    printf("tasks:%llu failed:%llu elapsed:%.3fs %.0f tasks/s\n", (unsigned long long)g_done,
+            (unsigned long long)g_failed, elapsed, g_done / elapsed);
+    printf("request latency us, %d tasks per request: p50:%llu p90:%llu p99:%llu p999:%llu max:%llu\n", batch,
+            (unsigned long long)g_latency.percentile(0.5), (unsigned long long)g_latency.percentile(0.9),
+            (unsigned long long)g_latency.percentile(0.99), (unsigned long long)g_latency.percentile(0.999),
+            (unsigned long long)g_latency.max());
+    return g_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+#include "zookeeper.h"
+#include "common.h"
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+
+using namespace std;
+
+static const char *DEFAULT_HOST = "192.168.85.132:2181,192.168.85.132:2182,192.168.85.132:2183";
+
+static vector<ZooKeeper*> connect(const string &host, int sessions) {
+    vector<ZooKeeper*> zks;
+    for (int i = 0; i < (sessions > 0 ? sessions : 1); ++i) {
+        zks.push_back(new ZooKeeper(host, 10000));
+    }
+    return zks;
+}
+
+static int save(const string &file, int sessions, const string &host) {
+    const string roots[] = {MASTERPATH, WORKERPATH, ASSIGNPATH, TASKPATH, STATUSPATH, LEASEPATH, READYPATH};
+    vector<ZooKeeper*> zks = connect(host, sessions);
+
+    int64_t start = now_ms();
+    SnapshotWriter writer;
+    SnapshotIo io(zks);
+    int code = io.save(vector<string>(roots, roots + sizeof(roots) / sizeof(roots[0])), &writer);
+    if (code != ZOK) {
+        cout << "read tree error: " << zerror(code) << endl;
+        return 1;
+    }
+    if (!writer.write(file)) {
+        cout << "write " << file << " failed" << endl;
+        return 1;
+    }
+
+    double elapsed = (now_ms() - start) / 1000.0;
+    printf("saved %u nodes to %s in %.3fs, %.0f nodes/s\n", writer.count(), file.c_str(),
+            elapsed, writer.count() / (elapsed > 0 ? elapsed : 1));
+    return 0;
+}
+
+static int restore(const string &file, int sessions, bool ephemerals, const string &host) {
+    SnapshotFile snapshot;
+    if (!snapshot.open(file)) {
+        cout << "open " << file << " failed" << endl;
+        return 1;
+    }
+    vector<ZooKeeper*> zks = connect(host, sessions);
+
+    int64_t start = now_ms();
+    SnapshotIo io(zks);
+    int code = io.restore(snapshot, ephemerals);
+    if (code != ZOK) {
+        cout << "restore error: " << zerror(code) << endl;
+        return 1;
+    }
+
+    double elapsed = (now_ms() - start) / 1000.0;
+    printf("restored %u nodes from %s in %.3fs, %.0f nodes/s, %llu existed already\n", snapshot.count(),
+            file.c_str(), elapsed, snapshot.count() / (elapsed > 0 ? elapsed : 1),
+            (unsigned long long)io.existing());
+    return 0;
+}
+
+static int show(const string &file) {
+    SnapshotFile snapshot;
+    if (!snapshot.open(file)) {
+        cout << "open " << file << " failed" << endl;
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < snapshot.count(); ++i) {
+        printf("%s %u%s\n", snapshot.path(i).c_str(), (unsigned)snapshot.data(i).size,
+                snapshot.node(i).flags & SNAPSHOT_EPHEMERAL ? " ephemeral" : "");
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    string cmd = argc > 2 ? argv[1] : "";
+    if ((cmd != "save" && cmd != "restore" && cmd != "show") || argc > 6) {
+        cout << "save the master-worker trees to a snapshot file or restore them" << endl;
+        cout << "\t usage:./zkSnapshot save file [sessions] [host]" << endl;
+        cout << "\t       ./zkSnapshot restore file [sessions] [ephemerals] [host]" << endl;
+        cout << "\t       ./zkSnapshot show file" << endl;
+        cout << "\t ephemerals: 1 restores ephemeral nodes as persistent ones, default 0 leaves them out" << endl;
+        cout << "\t restore raises the sequence counter of each parent past its restored sequential children" << endl;
+        return 0;
+    }
+
+    string file = argv[2];
+    int sessions = argc > 3 ? atoi(argv[3]) : 1;
+    if (cmd == "save") {
+        return save(file, sessions, argc > 4 ? argv[4] : DEFAULT_HOST);
+    }
+    if (cmd == "restore") {
+        return restore(file, sessions, argc > 4 && atoi(argv[4]) != 0, argc > 5 ? argv[5] : DEFAULT_HOST);
+    }
+    return show(file);
+}
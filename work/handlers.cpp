@@ -0,0 +1,91 @@
+#include "handlers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include "clog.h"
+
+const uint16_t LogHandler::TYPE;
+const int LogHandler::CONCURRENCY;
+const bool LogHandler::ASYNC;
+const uint16_t SleepHandler::TYPE;
+const int SleepHandler::CONCURRENCY;
+const bool SleepHandler::ASYNC;
+const uint16_t WaitHandler::TYPE;
+const int WaitHandler::CONCURRENCY;
+const bool WaitHandler::ASYNC;
+
+//sleep in steps of this, checking for cancellation between them
+static const int SLEEP_STEP_MS = 100;
+
+TaskState LogHandler::run(TaskContext &ctx, string *result) {
+    const TaskView &view = ctx.view();
+    LOG_INFO("run task:%s, type:%d priority:%d key:%.*s payload:%d bytes", ctx.name().c_str(),
+            view.type(), view.priority(), (int)ctx.key().size, ctx.key().data,
+            (int)ctx.payload().size);
+    return TASK_DONE;
+}
+
+TaskState SleepHandler::run(TaskContext &ctx, string *result) {
+    int total = atoi(ctx.payload().str().c_str());
+    int slept = atoi(ctx.resumeFrom().c_str());
+
+    while (slept < total) {
+        if (ctx.cancelled()) {
+            return TASK_FAILED;
+        }
+
+        int step = std::min(SLEEP_STEP_MS, total - slept);
+        boost::this_thread::sleep(boost::posix_time::milliseconds(step));
+        slept += step;
+        ctx.checkpoint(boost::lexical_cast<string>(slept));
+    }
+
+    *result = boost::lexical_cast<string>(slept);
+    return TASK_DONE;
+}
+
+//one step of a WaitHandler task, rescheduled on the reactor until done
+static void waitStep(const AsyncTaskPtr &task, int total, int waited) {
+    if (task->cancelled()) {
+        task->finish(TASK_FAILED, "");
+        return;
+    }
+
+    if (waited >= total) {
+        task->finish(TASK_DONE, boost::lexical_cast<string>(waited));
+        return;
+    }
+
+    if (waited > 0) {
+        task->checkpoint(boost::lexical_cast<string>(waited));
+    }
+
+    int step = std::min(SLEEP_STEP_MS, total - waited);
+    task->reactor().after(step, boost::bind(&waitStep, task, total, waited + step));
+}
+
+void WaitHandler::start(const AsyncTaskPtr &task) {
+    waitStep(task, atoi(task->payload().str().c_str()), atoi(task->resumeFrom().c_str()));
+}
+
+#ifdef BENCH_HANDLERS
+const uint16_t StampHandler::TYPE;
+const int StampHandler::CONCURRENCY;
+const bool StampHandler::ASYNC;
+int StampHandler::s_fd = -1;
+
+TaskState StampHandler::run(TaskContext &ctx, string *result) {
+    char line[128];
+    int len = snprintf(line, sizeof(line), "%s %lld\n", ctx.name().c_str(), (long long)now_us());
+    //one write below PIPE_BUF is never interleaved with another worker's
+    if (s_fd >= 0 && len < (int)sizeof(line) && write(s_fd, line, len) != len) {
+        *result = "stamp write failed";
+        return TASK_FAILED;
+    }
+    return TASK_DONE;
+}
+#endif
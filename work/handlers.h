@@ -0,0 +1,71 @@
+#ifndef _HANDLERS_H_
+#define _HANDLERS_H_
+
+#include "task_handler.h"
+
+//type 0, also the raw payload of a pre-envelope producer: log it and succeed
+class LogHandler {
+public:
+    static const uint16_t TYPE = 0;
+    static const int CONCURRENCY = HANDLER_UNLIMITED;
+    static const bool ASYNC = false;
+    static const char *name() { return "log"; }
+
+    TaskState run(TaskContext &ctx, string *result);
+};
+
+//type 1: sleep for the milliseconds in the payload, checkpointing the time
+//already slept and stopping early when cancelled
+class SleepHandler {
+public:
+    static const uint16_t TYPE = 1;
+    static const int CONCURRENCY = 4;
+    static const bool ASYNC = false;
+    static const char *name() { return "sleep"; }
+
+    TaskState run(TaskContext &ctx, string *result);
+};
+
+//type 2: like sleep, but waits on reactor timers and holds no thread, so
+//any number of these wait at once
+class WaitHandler {
+public:
+    static const uint16_t TYPE = 2;
+    static const int CONCURRENCY = HANDLER_UNLIMITED;
+    static const bool ASYNC = true;
+    static const char *name() { return "wait"; }
+
+    void start(const AsyncTaskPtr &task);
+};
+
+#ifdef BENCH_HANDLERS
+//type 3, built into benchmarks only: writes "<task> <monotonic us>\n" to
+//the fd set with setOutput when it starts, so a benchmark on the same host
+//can time scheduling up to the start of a task
+class StampHandler {
+public:
+    static const uint16_t TYPE = 3;
+    static const int CONCURRENCY = HANDLER_UNLIMITED;
+    static const bool ASYNC = false;
+    static const char *name() { return "stamp"; }
+
+    static void setOutput(int fd) { s_fd = fd; }
+
+    TaskState run(TaskContext &ctx, string *result);
+
+private:
+    static int s_fd;
+};
+
+typedef HandlerList<StampHandler, HandlerListEnd> BenchHandlers;
+#else
+typedef HandlerListEnd BenchHandlers;
+#endif
+
+//every handler the worker runs, add new ones here
+typedef HandlerList<LogHandler,
+        HandlerList<SleepHandler,
+        HandlerList<WaitHandler,
+        BenchHandlers> > > TaskHandlers;
+
+#endif
@@ -0,0 +1,111 @@
+#include "load_reporter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//a backlog change counts if it is this large and this share of the old one
+static const int LOAD_MIN_DELTA = 2;
+static const int LOAD_DELTA_PERCENT = 25;
+
+static const int CPU_DELTA = 15;
+static const int MEM_DELTA = 10;
+
+LoadReporter::LoadReporter() : m_cpu_total(0), m_cpu_idle(0), m_last_time(0) {
+    sampleCpu();
+}
+
+LoadReport LoadReporter::sample(int queued, int running, int threads) {
+    LoadReport report;
+    report.queued = queued > 0xffff ? 0xffff : queued;
+    report.running = running > 0xffff ? 0xffff : running;
+    report.threads = threads > 0xffff ? 0xffff : threads;
+    report.cpu = sampleCpu();
+    report.mem = sampleMem();
+    return report;
+}
+
+bool LoadReporter::due(const LoadReport &report, int64_t now) const {
+    if (m_last_time == 0 || now - m_last_time >= LOAD_REFRESH_MS) {
+        return true;
+    }
+
+    //the master must stop routing to a draining worker at once
+    if (report.draining != m_last.draining) {
+        return true;
+    }
+    if (now - m_last_time < LOAD_MIN_INTERVAL_MS) {
+        return false;
+    }
+
+    //a worker going from busy to not or back is always worth a write
+    if (report.busy() != m_last.busy() || report.threads != m_last.threads) {
+        return true;
+    }
+
+    int backlog = report.queued + report.running;
+    int last = m_last.queued + m_last.running;
+    int delta = abs(backlog - last);
+    if (delta >= LOAD_MIN_DELTA && delta * 100 >= last * LOAD_DELTA_PERCENT) {
+        return true;
+    }
+
+    return abs(report.cpu - m_last.cpu) >= CPU_DELTA || abs(report.mem - m_last.mem) >= MEM_DELTA;
+}
+
+void LoadReporter::published(const LoadReport &report, int64_t now) {
+    m_last = report;
+    m_last_time = now;
+}
+
+//busy share of all jiffies since the last call, from the first line of /proc/stat
+int LoadReporter::sampleCpu() {
+    FILE *fp = fopen("/proc/stat", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    unsigned long long v[8] = {0};
+    int n = fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+            &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+    fclose(fp);
+    if (n < 4) {
+        return 0;
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < 8; ++i) {
+        total += v[i];
+    }
+    uint64_t idle = v[3] + v[4]; //idle + iowait
+
+    uint64_t dt = total - m_cpu_total;
+    uint64_t di = idle - m_cpu_idle;
+    m_cpu_total = total;
+    m_cpu_idle = idle;
+
+    return dt == 0 || di > dt ? 0 : (int)((dt - di) * 100 / dt);
+}
+
+//percent of MemTotal not in MemAvailable
+int LoadReporter::sampleMem() {
+    FILE *fp = fopen("/proc/meminfo", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    unsigned long long total = 0, avail = 0, value;
+    char line[128], key[64];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%63[^:]: %llu", key, &value) != 2) {
+            continue;
+        }
+        if (!strcmp(key, "MemTotal")) {
+            total = value;
+        } else if (!strcmp(key, "MemAvailable")) {
+            avail = value;
+        }
+    }
+    fclose(fp);
+
+    return total == 0 || avail > total ? 0 : (int)((total - avail) * 100 / total);
+}
@@ -0,0 +1,37 @@
+#ifndef _LOAD_REPORTER_H_
+#define _LOAD_REPORTER_H_
+
+#include <stdint.h>
+#include "load_report.h"
+
+//a report is published at most this often, and at least this often
+static const int LOAD_MIN_INTERVAL_MS = 1000;
+static const int LOAD_REFRESH_MS = 30000;
+
+//samples the machine and decides when a new report is worth a write.
+//small changes are held back until LOAD_REFRESH_MS, so the write rate to
+//zookeeper stays bounded however often the worker state flips.
+class LoadReporter {
+public:
+    LoadReporter();
+
+    //fill a report with the executor counts and the cpu and memory use
+    LoadReport sample(int queued, int running, int threads);
+
+    //true if report moved far enough from the published one, or that is old
+    bool due(const LoadReport &report, int64_t now) const;
+
+    void published(const LoadReport &report, int64_t now);
+
+private:
+    int sampleCpu();
+    int sampleMem();
+
+private:
+    uint64_t m_cpu_total; //jiffies at the last sample
+    uint64_t m_cpu_idle;
+    LoadReport m_last;
+    int64_t m_last_time;  //ms of the last publish, 0 if none
+};
+
+#endif
@@ -1,21 +1,65 @@
 #include <string>
 #include "worker.h"
 #include "common.h"
+#include "config.h"
+#include "payload_store.h"
+#include <boost/scoped_ptr.hpp>
 
 using namespace std;
 
+static volatile sig_atomic_t g_drain = 0;
+
+static void onTerm(int) {
+    g_drain = 1;
+}
+
 int main(int argc, char **argv) {
-    if (process(argc, argv)) {
+    if (process(argc, argv, true)) {
         return 1;
     }
 
     log_init(CLOG_LEVEL_INFO, "log-worker");
 
-    string host = "192.168.85.132:2181,192.168.85.132:2182,192.168.85.132:2183";
+    //SIGTERM, also sent by -drain, drains instead of killing
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onTerm;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+
+    Config conf;
+    conf.load("worker.conf");
+    if (conf.getInt("log_binary", 0)) {
+        log_set_binary();
+    }
+    if (conf.getInt("log_async", 0)) {
+        log_set_async(conf.getInt("log_ring_kb", 256) << 10,
+                conf.get("log_overflow", "block") == "drop" ? CLOG_OVERFLOW_DROP : CLOG_OVERFLOW_BLOCK);
+    }
+    log_set_rotate((long long)conf.getInt("log_rotate_mb", 0) << 20, conf.getInt("log_rotate_min", 0) * 60,
+            conf.getInt("log_keep", 5), conf.getInt("log_compress", 0));
+
+    string host = conf.get("host", "192.168.85.132:2181,192.168.85.132:2182,192.168.85.132:2183");
     
     ZooKeeper zk(host, 10000);
 
-    Worker w(&zk);
+    //outlives the worker, which only borrows it
+    boost::scoped_ptr<PayloadStore> store;
+    string payloadDir = conf.get("payload_dir", "");
+    if (!payloadDir.empty()) {
+        store.reset(new FilePayloadStore(payloadDir));
+    }
+
+    Worker w(&zk, conf.getInt("threads", 0), conf.getInt("fetch_window", FETCH_WINDOW),
+            conf.getInt("io_threads", 1), parse_pin_mode(conf.get("pin", "none")));
+    w.setPayloadStore(store.get());
+    if (conf.getInt("pull", 0)) {
+        w.setPull(conf.getInt("claim_batch", CLAIM_BATCH));
+    }
+    string journal = conf.get("journal", "");
+    if (!journal.empty()) {
+        w.openJournal(journal);
+    }
     w.startWatchThread();
 
     while(!w.isConnected()) {
@@ -25,9 +69,28 @@ int main(int argc, char **argv) {
     w.createWorkspace();
     w.createWorker();
     w.getTasks();
+    w.claimTasks();
 
+    int64_t drainTimeout = conf.getInt("drain_timeout", DRAIN_TIMEOUT) * 1000LL;
+    int64_t drainDeadline = 0;
     while(!w.isExpired()) {
         sleep(1);
+        if (g_drain && drainDeadline == 0) {
+            drainDeadline = now_ms() + drainTimeout;
+            w.drain();
+        }
+        w.tick();
+
+        if (drainDeadline != 0 && w.drained()) {
+            LOG_INFO("drained, exit");
+            break;
+        }
+        if (drainDeadline != 0 && now_ms() > drainDeadline) {
+            //running handlers may not return, leave them to the master
+            LOG_WARN("drain timed out, exit");
+            log_flush();
+            _exit(1);
+        }
     }
 
     return 0;
@@ -0,0 +1,193 @@
+#ifndef _TASK_HANDLER_H_
+#define _TASK_HANDLER_H_
+
+#include <stdint.h>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+#include "common.h"
+#include "executor.h"
+#include "reactor.h"
+#include "task_format.h"
+#include "task_journal.h"
+#include "task_pool.h"
+
+using std::string;
+
+//what a handler sees of the task it runs
+class TaskContext {
+public:
+    TaskContext(Job &job, const string &task, const TaskInfo &info, TaskJournal *journal)
+        : m_job(job), m_task(task), m_info(info), m_journal(journal) {}
+
+    const string &name() const { return m_task; }
+    const TaskView &view() const { return m_info.view; }
+    Slice key() const { return m_info.view.key(); }
+    Slice payload() const { return m_info.payload(); }
+
+    //progress saved by an earlier run of this task, empty if none
+    const string &resumeFrom() const { return m_info.checkpoint; }
+
+    //true once the assignment is deleted, a long handler should poll it
+    bool cancelled() const { return m_job.cancelled(); }
+
+    //save progress, a restarted worker hands it back through resumeFrom()
+    bool checkpoint(const string &data) const {
+        return m_journal != NULL && m_journal->recordCheckpoint(m_task, data);
+    }
+
+private:
+    Job &m_job;
+    const string &m_task;
+    const TaskInfo &m_info;
+    TaskJournal *m_journal;
+};
+
+class AsyncTask;
+typedef boost::shared_ptr<AsyncTask> AsyncTaskPtr;
+typedef boost::function<void (AsyncTask &task, TaskState state, const string &result)> AsyncDone;
+
+//what an async handler sees of its task. the handler keeps it, and any
+//state of its own, alive by binding it into the reactor callbacks it
+//registers, and ends the task with finish() from one of them
+class AsyncTask : boost::noncopyable {
+public:
+    AsyncTask(const TaskInfoPtr &info, TaskJournal *journal, Reactor &reactor, const AsyncDone &done)
+        : m_info(info), m_journal(journal), m_reactor(reactor), m_done(done), m_cancelled(false),
+        m_finished(false) {}
+
+    const string &name() const { return m_info->name; }
+    const TaskView &view() const { return m_info->view; }
+    Slice key() const { return m_info->view.key(); }
+    Slice payload() const { return m_info->payload(); }
+    const string &resumeFrom() const { return m_info->checkpoint; }
+
+    //true once the assignment is deleted, checked between I/O steps
+    bool cancelled() const { return m_cancelled.load(boost::memory_order_relaxed); }
+    void cancel() { m_cancelled.store(true, boost::memory_order_relaxed); }
+
+    bool checkpoint(const string &data) const {
+        return m_journal != NULL && m_journal->recordCheckpoint(m_info->name, data);
+    }
+
+    //the loop to wait on, callbacks must not block it
+    Reactor &reactor() const { return m_reactor; }
+
+    //end the task, only the first call counts
+    void finish(TaskState state, const string &result) {
+        if (!m_finished.exchange(true)) {
+            m_done(*this, state, result);
+        }
+    }
+
+private:
+    TaskInfoPtr m_info;
+    TaskJournal *m_journal;
+    Reactor &m_reactor;
+    AsyncDone m_done;
+    boost::atomic<bool> m_cancelled;
+    boost::atomic<bool> m_finished;
+};
+
+//calls the entry point a handler has: run() for a handler that blocks its
+//executor thread, start() for an async one
+template<typename H, bool Async>
+struct HandlerCall {
+    static TaskState run(TaskContext &ctx, string *result) {
+        H handler;
+        return handler.run(ctx, result);
+    }
+
+    static void start(const AsyncTaskPtr &task) {
+        task->finish(TASK_FAILED, "not an async handler");
+    }
+};
+
+template<typename H>
+struct HandlerCall<H, true> {
+    static TaskState run(TaskContext &, string *result) {
+        *result = "async handler run synchronously";
+        return TASK_FAILED;
+    }
+
+    static void start(const AsyncTaskPtr &task) {
+        H handler;
+        handler.start(task);
+    }
+};
+
+//no limit on the tasks of one type running at once
+static const int HANDLER_UNLIMITED = 0;
+
+//compile time registry of handler classes. a handler is a default
+//constructible class with
+//
+//    static const uint16_t TYPE;      //task type it runs
+//    static const int CONCURRENCY;    //most running at once, or HANDLER_UNLIMITED
+//    static const bool ASYNC;         //which of the two below it has
+//    static const char *name();
+//    TaskState run(TaskContext &ctx, string *result);
+//    void start(const AsyncTaskPtr &task);
+//
+//run() holds an executor thread until the task ends. start() returns at
+//once, the task then waits on reactor fds and timers and its CONCURRENCY
+//counts tasks in flight, so thousands of I/O bound tasks fit a few threads.
+//
+//and the registry is a list of them:
+//
+//    typedef HandlerList<A, HandlerList<B, HandlerListEnd> > TaskHandlers;
+//
+//a task type is resolved to an index once when the task arrives, and
+//run(index) unrolls into a chain of compares with the handler calls
+//inlined, so there is no virtual call and no lookup by name per task.
+struct HandlerListEnd {
+    enum { SIZE = 0 };
+
+    static int index(uint16_t, int) { return -1; }
+    static int concurrency(int) { return HANDLER_UNLIMITED; }
+    static bool async(int) { return false; }
+    static const char *name(int) { return "none"; }
+    static TaskState run(int, TaskContext &, string *) { return TASK_FAILED; }
+    static void start(int, const AsyncTaskPtr &task) { task->finish(TASK_FAILED, "no handler"); }
+};
+
+template<typename H, typename Next>
+struct HandlerList {
+    enum { SIZE = 1 + Next::SIZE };
+
+    //index of the handler of type, -1 if none takes it
+    static int index(uint16_t type, int base = 0) {
+        return type == H::TYPE ? base : Next::index(type, base + 1);
+    }
+
+    static int concurrency(int index) {
+        return index == 0 ? H::CONCURRENCY : Next::concurrency(index - 1);
+    }
+
+    static bool async(int index) {
+        return index == 0 ? H::ASYNC : Next::async(index - 1);
+    }
+
+    static const char *name(int index) {
+        return index == 0 ? H::name() : Next::name(index - 1);
+    }
+
+    static TaskState run(int index, TaskContext &ctx, string *result) {
+        if (index == 0) {
+            return HandlerCall<H, H::ASYNC>::run(ctx, result);
+        }
+        return Next::run(index - 1, ctx, result);
+    }
+
+    static void start(int index, const AsyncTaskPtr &task) {
+        if (index == 0) {
+            HandlerCall<H, H::ASYNC>::start(task);
+            return;
+        }
+        Next::start(index - 1, task);
+    }
+};
+
+#endif
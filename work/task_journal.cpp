@@ -0,0 +1,357 @@
+#include "task_journal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "clog.h"
+
+using std::map;
+using std::set;
+using std::string;
+
+static const size_t RECORD_HEADER = 28;
+static const size_t JOURNAL_MIN_SIZE = 4 << 20;
+
+//compact once dead records are this share of the file and at least this big
+static const int DEAD_PERCENT = 50;
+static const size_t DEAD_MIN_BYTES = 16 << 20;
+
+static void put32(char *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (char)(v >> (i * 8));
+}
+
+static void put64(char *p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (char)(v >> (i * 8));
+}
+
+static uint32_t get32(const char *p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= (uint32_t)(uint8_t)p[i] << (i * 8);
+    return v;
+}
+
+static uint64_t get64(const char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= (uint64_t)(uint8_t)p[i] << (i * 8);
+    return v;
+}
+
+TaskJournal::TaskJournal() : m_fd(-1), m_base(NULL), m_capacity(0), m_end(0), m_live(0) {
+}
+
+TaskJournal::~TaskJournal() {
+    close();
+}
+
+bool TaskJournal::open(const string &path) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    m_path = path;
+
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (m_fd < 0) {
+        LOG_ERROR("open journal %s failed:%s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0) {
+        LOG_ERROR("stat journal %s failed:%s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    size_t capacity = st.st_size < (off_t)JOURNAL_MIN_SIZE ? JOURNAL_MIN_SIZE : st.st_size;
+    return remap(capacity) && replay();
+}
+
+void TaskJournal::close() {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    unmap();
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_entries.clear();
+}
+
+//size the file to capacity and map all of it
+bool TaskJournal::remap(size_t capacity) {
+    unmap();
+
+    if (ftruncate(m_fd, capacity) != 0) {
+        LOG_ERROR("resize journal %s failed:%s", m_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    void *addr = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR("mmap journal %s failed:%s", m_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    m_base = (char *)addr;
+    m_capacity = capacity;
+    return true;
+}
+
+void TaskJournal::unmap() {
+    if (m_base != NULL) {
+        munmap(m_base, m_capacity);
+        m_base = NULL;
+        m_capacity = 0;
+    }
+}
+
+bool TaskJournal::replay() {
+    m_entries.clear();
+    m_end = 0;
+    m_live = 0;
+
+    size_t records = 0;
+    while (m_end + RECORD_HEADER <= m_capacity) {
+        const char *p = m_base + m_end;
+        uint32_t size = get32(p);
+        if (size == 0) {
+            break;
+        }
+
+        size_t bytes = 8 + (size_t)size;
+        size_t names = (uint8_t)p[10] | (uint8_t)p[11] << 8;
+        if (size < RECORD_HEADER - 8 + names || m_end + bytes > m_capacity
+                || crc32(p + 8, size) != get32(p + 4)) {
+            LOG_WARN("journal %s torn at %zu, dropping the tail", m_path.c_str(), m_end);
+            memset(m_base + m_end, 0, m_capacity - m_end);
+            break;
+        }
+
+        string task(p + RECORD_HEADER, names);
+        size_t body = m_end + RECORD_HEADER + names;
+        apply((RecordType)p[8], task, get64(p + 12), get64(p + 20), body, m_end + bytes - body, bytes);
+
+        m_end += bytes;
+        ++records;
+    }
+
+    LOG_INFO("journal %s replayed %zu records, %zu tasks, %zu of %zu bytes live",
+            m_path.c_str(), records, m_entries.size(), m_live, m_end);
+    return true;
+}
+
+//update the index with one record at its place in the file
+void TaskJournal::apply(RecordType type, const string &task, int64_t czxid, int64_t mzxid,
+        size_t body, size_t size, size_t bytes) {
+    if (type == DONE) {
+        map<string, Entry>::iterator it = m_entries.find(task);
+        if (it != m_entries.end()) {
+            m_live -= it->second.bytes;
+            m_entries.erase(it);
+        }
+        return;
+    }
+    if (type != FETCHED && type != CHECKPOINT) {
+        return;
+    }
+
+    Entry &entry = m_entries[task];
+    if (type == FETCHED) {
+        //fetched again, everything recorded before is stale
+        m_live -= entry.bytes;
+        entry = Entry();
+        entry.czxid = czxid;
+        entry.mzxid = mzxid;
+        entry.data = body;
+        entry.data_size = size;
+        entry.bytes = bytes;
+        m_live += bytes;
+    } else if (type == CHECKPOINT) {
+        //only the last checkpoint is live, its size replaces the previous one
+        size_t old = entry.checkpoint != 0 ? RECORD_HEADER + task.size() + entry.checkpoint_size : 0;
+        entry.checkpoint = body;
+        entry.checkpoint_size = size;
+        entry.bytes = entry.bytes - old + bytes;
+        m_live = m_live - old + bytes;
+    }
+}
+
+bool TaskJournal::append(RecordType type, const string &task, int64_t czxid, int64_t mzxid, const Slice &body) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    if (m_base == NULL || task.size() > 0xffff) {
+        return false;
+    }
+
+    size_t bytes = RECORD_HEADER + task.size() + body.size;
+    if (m_end + bytes + RECORD_HEADER > m_capacity) {
+        size_t capacity = m_capacity * 2;
+        while (m_end + bytes + RECORD_HEADER > capacity) {
+            capacity *= 2;
+        }
+        if (!remap(capacity)) {
+            return false;
+        }
+    }
+
+    char *p = m_base + m_end;
+    p[8] = (char)type;
+    p[9] = 0;
+    p[10] = (char)task.size();
+    p[11] = (char)(task.size() >> 8);
+    put64(p + 12, czxid);
+    put64(p + 20, mzxid);
+    memcpy(p + RECORD_HEADER, task.data(), task.size());
+    memcpy(p + RECORD_HEADER + task.size(), body.data, body.size);
+    put32(p + 4, crc32(p + 8, bytes - 8));
+    //the size goes last, so a record is never seen before it is complete
+    put32(p, bytes - 8);
+
+    size_t start = m_end;
+    m_end += bytes;
+    apply(type, task, czxid, mzxid, start + RECORD_HEADER + task.size(), body.size, bytes);
+    return true;
+}
+
+bool TaskJournal::recordFetched(const string &task, int64_t czxid, int64_t mzxid, const Slice &data) {
+    return append(FETCHED, task, czxid, mzxid, data);
+}
+
+bool TaskJournal::recordCheckpoint(const string &task, const Slice &data) {
+    if (!contains(task)) {
+        return false;
+    }
+    return append(CHECKPOINT, task, 0, 0, data);
+}
+
+bool TaskJournal::recordDone(const string &task) {
+    if (!contains(task)) {
+        return true;
+    }
+    return append(DONE, task, 0, 0, Slice());
+}
+
+bool TaskJournal::contains(const string &task) const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    return m_entries.find(task) != m_entries.end();
+}
+
+bool TaskJournal::fetched(const string &task, int64_t czxid, int64_t mzxid, string *data) const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    map<string, Entry>::const_iterator it = m_entries.find(task);
+    if (it == m_entries.end() || it->second.data == 0
+            || it->second.czxid != czxid || it->second.mzxid != mzxid) {
+        return false;
+    }
+
+    //a copy, the mapping moves when the file grows
+    data->assign(m_base + it->second.data, it->second.data_size);
+    return true;
+}
+
+bool TaskJournal::checkpoint(const string &task, string *data) const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    map<string, Entry>::const_iterator it = m_entries.find(task);
+    if (it == m_entries.end() || it->second.checkpoint == 0) {
+        return false;
+    }
+
+    data->assign(m_base + it->second.checkpoint, it->second.checkpoint_size);
+    return true;
+}
+
+bool TaskJournal::needsCompaction() const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    size_t dead = m_end - m_live;
+    return dead >= DEAD_MIN_BYTES && dead * 100 >= m_end * DEAD_PERCENT;
+}
+
+//write the live records to path.compact, then rename it over the journal,
+//so a crash during compaction leaves the old journal intact
+bool TaskJournal::compact(const set<string> *keep) {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    if (m_base == NULL) {
+        return false;
+    }
+
+    string tmp = m_path + ".compact";
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("open %s failed:%s", tmp.c_str(), strerror(errno));
+        return false;
+    }
+
+    //copy each live record as it is, fetched data before its checkpoint
+    string out;
+    size_t before = m_end;
+    for (map<string, Entry>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (keep != NULL && keep->find(it->first) == keep->end()) {
+            continue;
+        }
+
+        const Entry &entry = it->second;
+        size_t offsets[2] = {entry.data, entry.checkpoint};
+        for (int i = 0; i < 2; ++i) {
+            if (offsets[i] == 0) {
+                continue;
+            }
+            const char *record = m_base + offsets[i] - RECORD_HEADER - it->first.size();
+            out.append(record, 8 + get32(record));
+        }
+    }
+
+    bool ok = true;
+    size_t done = 0;
+    while (ok && done < out.size()) {
+        ssize_t n = write(fd, out.data() + done, out.size() - done);
+        if (n < 0 && errno != EINTR) {
+            ok = false;
+        } else if (n > 0) {
+            done += n;
+        }
+    }
+    ok = ok && fsync(fd) == 0;
+    if (!ok || rename(tmp.c_str(), m_path.c_str()) != 0) {
+        LOG_ERROR("compact journal %s failed:%s", m_path.c_str(), strerror(errno));
+        ::close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    unmap();
+    ::close(m_fd);
+    m_fd = fd;
+
+    size_t capacity = JOURNAL_MIN_SIZE;
+    while (capacity < out.size() * 2) {
+        capacity *= 2;
+    }
+    if (!remap(capacity) || !replay()) {
+        return false;
+    }
+
+    LOG_INFO("journal %s compacted from %zu to %zu bytes", m_path.c_str(), before, m_end);
+    return true;
+}
+
+void TaskJournal::sync() {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    //MS_ASYNC only schedules the writeback, a machine crash could still
+    //lose records that sync() returned for
+    if (m_base != NULL && msync(m_base, m_end, MS_SYNC) != 0) {
+        LOG_ERROR("sync journal %s failed:%s", m_path.c_str(), strerror(errno));
+    }
+}
+
+size_t TaskJournal::tasks() const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    return m_entries.size();
+}
+
+size_t TaskJournal::fileSize() const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    return m_end;
+}
+
+size_t TaskJournal::liveBytes() const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    return m_live;
+}
@@ -0,0 +1,94 @@
+#ifndef _TASK_JOURNAL_H_
+#define _TASK_JOURNAL_H_
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+#include "task_format.h"
+
+//local append-only journal of the task data a worker fetched and the
+//checkpoints its tasks wrote, in one memory-mapped file. after a restart
+//it is replayed, and a task assigned again is resumed from its journaled
+//data and last checkpoint instead of being read from zookeeper again.
+//
+//a record is a 28 byte header (size, crc32, type, name length, czxid,
+//mzxid) followed by the task name and a body. a zero size ends the
+//journal, a bad crc marks a torn tail, which replay cuts off.
+//
+//writes go to the page cache through the mapping, so they survive a
+//crash of the process at once and a crash of the machine after sync().
+class TaskJournal : boost::noncopyable {
+public:
+    TaskJournal();
+    ~TaskJournal();
+
+    //map path, creating it if needed, and replay it
+    bool open(const std::string &path);
+    void close();
+
+    bool recordFetched(const std::string &task, int64_t czxid, int64_t mzxid, const Slice &data);
+    bool recordCheckpoint(const std::string &task, const Slice &data);
+
+    //the task is finished or gone, forget it
+    bool recordDone(const std::string &task);
+
+    bool contains(const std::string &task) const;
+
+    //copy the journaled data of task if it was fetched from the same znode
+    bool fetched(const std::string &task, int64_t czxid, int64_t mzxid, std::string *data) const;
+
+    //copy the last checkpoint of task, false if there is none
+    bool checkpoint(const std::string &task, std::string *data) const;
+
+    //true once most of the file is records of finished tasks
+    bool needsCompaction() const;
+
+    //rewrite the file with the live records only. with keep, tasks not in
+    //it are dropped too, e.g. those not assigned again after a restart
+    bool compact(const std::set<std::string> *keep);
+
+    //write the mapping to disk and wait for it, writers block meanwhile
+    void sync();
+
+    size_t tasks() const;
+    size_t fileSize() const;
+    size_t liveBytes() const;
+
+private:
+    enum RecordType { FETCHED = 1, CHECKPOINT = 2, DONE = 3 };
+
+    typedef struct Entry {
+        int64_t czxid;
+        int64_t mzxid;
+        size_t data;       //offset of the fetched body, 0 if none
+        size_t data_size;
+        size_t checkpoint; //offset of the last checkpoint body, 0 if none
+        size_t checkpoint_size;
+        size_t bytes;      //record bytes still live
+
+        Entry() : czxid(0), mzxid(0), data(0), data_size(0), checkpoint(0), checkpoint_size(0), bytes(0) {}
+    } Entry;
+
+    bool append(RecordType type, const std::string &task, int64_t czxid, int64_t mzxid, const Slice &body);
+    void apply(RecordType type, const std::string &task, int64_t czxid, int64_t mzxid,
+            size_t body, size_t size, size_t bytes);
+    bool replay();
+    bool remap(size_t capacity);
+    void unmap();
+
+private:
+    mutable boost::mutex m_mutex;
+    std::string m_path;
+    int m_fd;
+    char *m_base;
+    size_t m_capacity;   //mapped file size
+    size_t m_end;        //offset of the next record
+    size_t m_live;       //bytes of records still needed
+    std::map<std::string, Entry> m_entries;
+};
+
+#endif
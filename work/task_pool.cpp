@@ -0,0 +1,79 @@
+#include "task_pool.h"
+
+//objects carved at once when the free list runs dry
+static const size_t POOL_SLAB = 64;
+
+//a string buffer larger than this is released on recycle
+static const size_t POOL_RETAIN_BYTES = 64 * 1024;
+
+void intrusive_ptr_add_ref(TaskInfo *info) {
+    info->m_refs.fetch_add(1, boost::memory_order_relaxed);
+}
+
+void intrusive_ptr_release(TaskInfo *info) {
+    if (info->m_refs.fetch_sub(1, boost::memory_order_acq_rel) == 1) {
+        info->m_pool->recycle(info);
+    }
+}
+
+static void clearBuffer(std::string *s) {
+    if (s->capacity() > POOL_RETAIN_BYTES) {
+        std::string().swap(*s);
+    } else {
+        s->clear();
+    }
+}
+
+TaskPool::~TaskPool() {
+    for (size_t i = 0; i < m_slabs.size(); ++i) {
+        delete[] m_slabs[i];
+    }
+}
+
+TaskInfoPtr TaskPool::acquire() {
+    TaskInfo *info;
+    {
+        boost::lock_guard<boost::mutex> guard(m_mutex);
+        if (m_free.empty()) {
+            TaskInfo *slab = new TaskInfo[POOL_SLAB];
+            m_slabs.push_back(slab);
+            m_free.reserve(m_slabs.size() * POOL_SLAB);
+            for (size_t i = 0; i < POOL_SLAB; ++i) {
+                slab[i].m_pool = this;
+                m_free.push_back(&slab[i]);
+            }
+        }
+
+        info = m_free.back();
+        m_free.pop_back();
+    }
+
+    return TaskInfoPtr(info);
+}
+
+void TaskPool::recycle(TaskInfo *info) {
+    info->id = INVALID_NAME;
+    clearBuffer(&info->name);
+    clearBuffer(&info->data);
+    clearBuffer(&info->checkpoint);
+    info->view = TaskView();
+    info->blob.reset();
+    info->requested = 0;
+    info->czxid = 0;
+    info->mzxid = 0;
+    info->prepared = false;
+    info->handler = -1;
+
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    m_free.push_back(info);
+}
+
+size_t TaskPool::allocated() const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    return m_slabs.size() * POOL_SLAB;
+}
+
+size_t TaskPool::available() const {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+    return m_free.size();
+}
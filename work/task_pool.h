@@ -0,0 +1,80 @@
+#ifndef _TASK_POOL_H_
+#define _TASK_POOL_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+#include "name_table.h"
+#include "task_format.h"
+#include "payload_store.h"
+
+class TaskPool;
+
+//fetched task data and the envelope parsed in place over it. taken from a
+//TaskPool and handed back when the last reference goes
+typedef struct TaskInfo {
+    NameId id;
+    std::string name;
+    std::string data;
+    TaskView view;
+    PayloadPtr blob; //mapped payload of a TASK_FLAG_PAYLOAD_REF task
+    int64_t requested; //us when its read was sent
+    int64_t czxid;     //of the znode it was read from, 0 for a journal copy
+    int64_t mzxid;
+    bool prepared;     //payload mapped and journaled, on its first run
+    std::string checkpoint; //last checkpoint of a task resumed from the journal
+    int handler;       //index in TaskHandlers, -1 if no handler takes its type
+
+    TaskInfo() : id(INVALID_NAME), requested(0), czxid(0), mzxid(0), prepared(false), handler(-1),
+        m_refs(0), m_pool(NULL) {}
+
+    Slice payload() const { return blob ? blob->data() : view.payload(); }
+
+private:
+    friend class TaskPool;
+    friend void intrusive_ptr_add_ref(TaskInfo *info);
+    friend void intrusive_ptr_release(TaskInfo *info);
+
+    boost::atomic<int> m_refs;
+    TaskPool *m_pool;
+} TaskInfo;
+
+void intrusive_ptr_add_ref(TaskInfo *info);
+void intrusive_ptr_release(TaskInfo *info);
+
+//the count lives in the object, so a reference costs no control block
+typedef boost::intrusive_ptr<TaskInfo> TaskInfoPtr;
+
+//free list of TaskInfo objects carved from slabs. a recycled object keeps
+//the capacity of its strings, so once the pool is warm a task whose name,
+//data and checkpoint fit the buffers of an earlier one allocates nothing.
+//buffers grown past POOL_RETAIN_BYTES are freed instead of kept.
+//
+//the pool must outlive every TaskInfoPtr it handed out.
+class TaskPool : boost::noncopyable {
+public:
+    TaskPool() {}
+    ~TaskPool();
+
+    TaskInfoPtr acquire();
+
+    //objects ever carved and those free now
+    size_t allocated() const;
+    size_t available() const;
+
+private:
+    friend void intrusive_ptr_release(TaskInfo *info);
+    void recycle(TaskInfo *info);
+
+private:
+    mutable boost::mutex m_mutex;
+    std::vector<TaskInfo*> m_free;
+    std::vector<TaskInfo*> m_slabs;
+};
+
+#endif
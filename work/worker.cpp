@@ -1,5 +1,36 @@
 #include "worker.h"
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
+
+//executor metrics are logged this often
+static const int STATS_INTERVAL_MS = 60000;
+
+//multi requests of one claim retried after another worker took a task
+static const int CLAIM_RETRIES = 8;
+
+//journaled tasks of an earlier run not assigned again by then are dropped
+static const int JOURNAL_GRACE_MS = 60000;
+
+Worker::Worker(ZooKeeper *zk, int threads, int window, int ioThreads, PinMode pin) : Watcher(zk), m_store(NULL),
+    m_journal_start(0), m_journal_pruned(false), m_claim_batch(0), m_next_shard(0),
+    m_window(window > 0 ? window : 1), m_inflight(0), m_handlers(TaskHandlers::SIZE),
+    m_draining(false), m_stopping(false),
+    m_lease_time(0), m_stats_time(now_ms()), m_reactor(ioThreads), m_executor(threads, pin) {
+    m_reporter = boost::thread(boost::bind(&Worker::reportLoop, this));
+}
+
+Worker::~Worker() {
+    m_executor.stop();
+    m_reactor.stop();
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_done_mutex);
+        m_stopping = true;
+    }
+    m_done_cond.notify_all();
+    m_reporter.join();
+}
 
 bool Worker::createWorkspace() {
     string fullpath;
@@ -7,6 +38,11 @@ bool Worker::createWorkspace() {
             ZOO_SEQUENCE, &fullpath, true);
 
     LOG_INFO("worker node:%s", fullpath.c_str());
+
+    int status_code = zk->create(STATUSPATH, "", ZOO_OPEN_ACL_UNSAFE, 0, NULL);
+    if (status_code != ZOK && status_code != ZNODEEXISTS) {
+        LOG_ERROR("create %s failed:%s", STATUSPATH.c_str(), zerror(status_code));
+    }
     m_worker_node = get_file_name(fullpath);
 
     if (code == ZOK) {
@@ -20,11 +56,19 @@ bool Worker::createWorkspace() {
 bool Worker::createWorker() {
     int code = zk->create(WORKERPATH+"/"+m_worker_node, "", ZOO_OPEN_ACL_UNSAFE,
             ZOO_EPHEMERAL, NULL, true);
+    if (code != ZOK) {
+        return false;
+    }
+
+    code = zk->create(LEASEPATH+"/"+m_worker_node, "", ZOO_OPEN_ACL_UNSAFE,
+            ZOO_EPHEMERAL, NULL, true);
 
     return code == ZOK;
 }
 
 bool Worker::getTasks() {
+    boost::lock_guard<boost::mutex> guard(m_assign_mutex);
+
     vector<string> children;
     int code = zk->getChildren(m_assign_dir, true, &children);
 
@@ -32,60 +76,802 @@ bool Worker::getTasks() {
 
     if (code != ZOK) return false;
 
+    boost::unique_lock<boost::mutex> lock(m_tasks_mutex);
+
+    vector<NameId> ids(children.size());
+    FlatMap<NameId, char> assigned;
+    assigned.reserve(children.size());
+    for (int i = 0; i < children.size(); ++i) {
+        ids[i] = m_names.intern(children[i]);
+        assigned[ids[i]] = 1;
+    }
+
     //find deleted task
-    set<string> tasks(children.begin(), children.end());
-    for (map<string, Task*>::iterator it = m_tasks.begin(); it != m_tasks.end(); ) {
-        if (tasks.find(it->first) == tasks.end()) {
-            //deleted task
-            delete it->second;
-            LOG_INFO("delete task:%s", it->first.c_str());
-            m_tasks.erase(it++);
-        } else {
-            ++it;
+    vector<NameId> deleted;
+    for (size_t i = 0; i < m_tasks.capacity(); ++i) {
+        if (m_tasks.occupied(i) && !assigned.contains(m_tasks.keyAt(i))) {
+            deleted.push_back(m_tasks.keyAt(i));
         }
     }
 
-    //find added task
+    for (int i = 0; i < deleted.size(); ++i) {
+        //deleted task, stop it if it is still queued or running
+        NameId id = deleted[i];
+        string task = m_names.name(id);
+        LOG_INFO("delete task:%s", task.c_str());
+
+        m_executor.cancel(id);
+        {
+            boost::lock_guard<boost::mutex> guard(m_async_mutex);
+            AsyncTaskPtr *task = m_async.find(id);
+            if (task != NULL) {
+                (*task)->cancel();
+            }
+        }
+        if (m_journal) {
+            m_journal->recordDone(task);
+        }
+
+        {
+            boost::lock_guard<boost::mutex> guard(m_done_mutex);
+            m_running.erase(id);
+            m_started.erase(id);
+        }
+        m_tasks.erase(id);
+        m_names.release(id);
+    }
+
+    //find added task, its read is sent by pumpFetches
     for (int i = 0; i < children.size(); ++i) {
-        if (m_tasks.find(children[i]) == m_tasks.end()) {
-            Task *info = getTaskInfo(children[i]);
-            if (info != NULL) {
-                //new task
-                LOG_INFO("add task:%s", children[i].c_str());
-                m_tasks[children[i]] = info;
-                RunTask(children[i]);
+        if (!m_tasks.contains(ids[i])) {
+            LOG_INFO("add task:%s", children[i].c_str());
+            m_tasks[ids[i]] = TaskInfoPtr();
+            m_fetch_queue.push_back(ids[i]);
+        }
+    }
+
+    lock.unlock();
+    pumpFetches();
+    return true;
+}
+
+string Worker::taskName(NameId id) {
+    boost::lock_guard<boost::mutex> guard(m_tasks_mutex);
+    return m_names.name(id);
+}
+
+//reads of up to m_window tasks are in flight at once, and each task is
+//queued on the executor as soon as its own data arrives, so a batch of
+//assignments costs about one round trip instead of one per task and the
+//next tasks are fetched while earlier ones run
+void Worker::pumpFetches() {
+    for (;;) {
+        NameId id;
+        string task;
+        {
+            boost::lock_guard<boost::mutex> guard(m_tasks_mutex);
+            if (m_inflight >= m_window || m_fetch_queue.empty()) {
+                return;
+            }
+
+            id = m_fetch_queue.front();
+            m_fetch_queue.pop_front();
+            if (!m_tasks.contains(id)) {
+                //deleted before its read was sent
+                continue;
+            }
+            task = m_names.name(id);
+            ++m_inflight;
+        }
+
+        //a journaled task only needs its stat to prove the data is current
+        int code;
+        if (m_journal && m_journal->contains(task)) {
+            code = zk->aexists(TASKPATH+"/"+task,
+                    boost::bind(&Worker::onStat, this, id, now_us(), _1, _2));
+        } else {
+            code = zk->aget(TASKPATH+"/"+task,
+                    boost::bind(&Worker::onFetched, this, id, now_us(), _1, _2, _3, _4));
+        }
+        if (code != ZOK) {
+            LOG_ERROR("read task %s failed:%s", task.c_str(), zerror(code));
+
+            //forget it, the next assignment change retries it
+            boost::lock_guard<boost::mutex> guard(m_tasks_mutex);
+            --m_inflight;
+            TaskInfoPtr *info = m_tasks.find(id);
+            if (info != NULL && !*info) {
+                m_tasks.erase(id);
+            }
+        }
+    }
+}
+
+//runs on the zookeeper completion thread
+void Worker::onFetched(NameId id, int64_t requested, int code, const char *value, int len,
+        const Stat *stat) {
+    TaskInfoPtr info;
+    if (code == ZOK) {
+        info = parseTaskInfo(id, value, len);
+        if (info) {
+            info->czxid = stat->czxid;
+            info->mzxid = stat->mzxid;
+        }
+    } else {
+        LOG_ERROR("read task %s failed:%s", taskName(id).c_str(), zerror(code));
+    }
+
+    deliver(id, requested, info);
+}
+
+//runs on the zookeeper completion thread. the journal copy is used if the
+//task znode is the one it was read from, otherwise the data is read again
+void Worker::onStat(NameId id, int64_t requested, int code, const Stat *stat) {
+    string task = taskName(id);
+    string data;
+    if (code == ZOK && m_journal->fetched(task, stat->czxid, stat->mzxid, &data)) {
+        LOG_INFO("task %s resumed from journal", task.c_str());
+        deliver(id, requested, parseTaskInfo(id, data.data(), data.size()));
+        return;
+    }
+
+    code = zk->aget(TASKPATH+"/"+task,
+            boost::bind(&Worker::onFetched, this, id, requested, _1, _2, _3, _4));
+    if (code != ZOK) {
+        LOG_ERROR("read task %s failed:%s", task.c_str(), zerror(code));
+        deliver(id, requested, TaskInfoPtr());
+    }
+}
+
+//hand a fetched task to the executor, or forget it if info is NULL
+void Worker::deliver(NameId id, int64_t requested, const TaskInfoPtr &info) {
+    int64_t now = now_us();
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_tasks_mutex);
+        --m_inflight;
+
+        TaskInfoPtr *slot = m_tasks.find(id);
+        if (slot != NULL && !*slot) {
+            if (info) {
+                info->requested = requested;
+                *slot = info;
+                RunTask(info);
+            } else {
+                //forget it, the next assignment change retries it
+                m_tasks.erase(id);
             }
+        } else if (info && m_journal) {
+            //deleted while it was read
+            m_journal->recordDone(info->name);
         }
     }
 
+    {
+        boost::lock_guard<boost::mutex> guard(m_latency_mutex);
+        m_fetch_latency.add(now - requested);
+    }
+
+    pumpFetches();
+}
+
+//fill a pooled TaskInfo, whose buffers usually fit the data already
+TaskInfoPtr Worker::parseTaskInfo(NameId id, const char *value, int len) {
+    TaskInfoPtr info = m_pool.acquire();
+    info->id = id;
+    info->name = taskName(id);
+    info->data.assign(value, len);
+
+    //the view points into info->data, which never moves from here on
+    TaskError error = info->view.parse(info->data);
+    if (error == TASK_BAD_MAGIC) {
+        info->view.parseLegacy(info->data.data(), info->data.size());
+    } else if (error != TASK_OK) {
+        LOG_ERROR("task %s rejected:%s", info->name.c_str(), task_error(error));
+        return TaskInfoPtr();
+    }
+
+    info->handler = TaskHandlers::index(info->view.type());
+    return info;
+}
+
+//the disk work of a task before it runs, on its executor thread so a slow
+//disk holds up this task and not every zookeeper callback. a payload that
+//can not be mapped leaves the task to be read again on the next change
+bool Worker::prepare(const TaskInfoPtr &info) {
+    if (info->view.flags() & TASK_FLAG_PAYLOAD_REF) {
+        string ref = info->view.payload().str();
+        info->blob = m_store != NULL ? m_store->get(ref) : PayloadPtr();
+        if (!info->blob) {
+            LOG_ERROR("task %s payload %s unavailable", info->name.c_str(), ref.c_str());
+            forget(info);
+            return false;
+        }
+    }
+
+    if (m_journal) {
+        if (info->czxid != 0) {
+            m_journal->recordFetched(info->name, info->czxid, info->mzxid, info->data);
+        }
+        m_journal->checkpoint(info->name, &info->checkpoint);
+    }
+    info->prepared = true;
     return true;
 }
 
-Task *Worker::getTaskInfo(const string &task) {
-    string info;
-    int code = zk->get(TASKPATH+"/"+task, false, &info, NULL);
+//drop a task that was handed to the executor, unless it was deleted
+//and assigned again meanwhile
+void Worker::forget(const TaskInfoPtr &info) {
+    {
+        boost::lock_guard<boost::mutex> guard(m_done_mutex);
+        m_running.erase(info->id);
+    }
+
+    boost::lock_guard<boost::mutex> guard(m_tasks_mutex);
+    TaskInfoPtr *current = m_tasks.find(info->id);
+    if (current != NULL && *current == info) {
+        m_tasks.erase(info->id);
+    }
+}
 
-    if (code != ZOK || info.size() == sizeof(Task)) {
-        return NULL;
+void Worker::RunTask(const TaskInfoPtr &info) {
+    {
+        boost::lock_guard<boost::mutex> guard(m_done_mutex);
+        m_running[info->id] = 1;
     }
 
-    Task *taskInfo = new Task();
-    memcpy(taskInfo, info.data(), info.size());
-    return taskInfo;
+    m_executor.submit(info->id, boost::bind(&Worker::execute, this, _1, info));
 }
 
-bool Worker::setLoad(int load) {
-    int code = zk->set(WORKERPATH+"/"+m_worker_node, boost::lexical_cast<string>(load), -1);
+//runs on an executor thread, info stays alive even if the task is deleted
+void Worker::execute(Job &job, TaskInfoPtr info) {
+    const string &task = info->name;
 
-    return code == ZOK;
+    if (job.cancelled()) {
+        return;
+    }
+
+    //a parked task comes back here, it was prepared the first time
+    if (!info->prepared && !prepare(info)) {
+        return;
+    }
+    if (job.cancelled()) {
+        //deleted while it was journaled
+        if (m_journal) {
+            m_journal->recordDone(task);
+        }
+        return;
+    }
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_latency_mutex);
+        m_start_latency.add(now_us() - info->requested);
+    }
+
+    if (info->handler < 0) {
+        LOG_ERROR("task %s has type %d, no handler takes it", task.c_str(), info->view.type());
+        completeTask(info, TASK_FAILED, "no handler for type " + boost::lexical_cast<string>(info->view.type()));
+        return;
+    }
+
+    if (!acquire(info)) {
+        return;
+    }
+
+    //a draining worker starts nothing, the master moves what is left
+    bool draining;
+    {
+        boost::lock_guard<boost::mutex> guard(m_done_mutex);
+        draining = m_draining;
+        if (!draining) {
+            m_started[info->id] = 1;
+        }
+    }
+    if (draining) {
+        release(info->handler, -1);
+        return;
+    }
+
+    if (!info->checkpoint.empty()) {
+        LOG_INFO("task %s resumes from a %d byte checkpoint", task.c_str(), (int)info->checkpoint.size());
+    }
+
+    if (TaskHandlers::async(info->handler)) {
+        startAsync(info);
+        return;
+    }
+
+    TaskContext ctx(job, task, *info, m_journal.get());
+    string result;
+    TaskState state = TASK_FAILED;
+    int64_t start = now_us();
+    try {
+        state = TaskHandlers::run(info->handler, ctx, &result);
+    } catch (const std::exception &e) {
+        LOG_ERROR("task %s threw:%s", task.c_str(), e.what());
+        result = e.what();
+    }
+    release(info->handler, now_us() - start);
+
+    if (job.cancelled()) {
+        LOG_INFO("task %s cancelled", task.c_str());
+        return;
+    }
+
+    countResult(info->handler, state);
+    completeTask(info, state, result);
+}
+
+//an async handler returns at once and ends the task from a reactor
+//callback, so no thread is held while the task waits
+void Worker::startAsync(const TaskInfoPtr &info) {
+    AsyncTaskPtr task(new AsyncTask(info, m_journal.get(), m_reactor,
+                boost::bind(&Worker::finishAsync, this, info, now_us(), _1, _2, _3)));
+    {
+        boost::lock_guard<boost::mutex> guard(m_async_mutex);
+        m_async[info->id] = task;
+    }
+
+    try {
+        TaskHandlers::start(info->handler, task);
+    } catch (const std::exception &e) {
+        LOG_ERROR("task %s threw:%s", info->name.c_str(), e.what());
+        task->finish(TASK_FAILED, e.what());
+    }
+}
+
+//runs where the handler finished the task, usually a reactor thread
+void Worker::finishAsync(const TaskInfoPtr &info, int64_t start, AsyncTask &task, TaskState state,
+        const string &result) {
+    release(info->handler, now_us() - start);
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_async_mutex);
+        AsyncTaskPtr *current = m_async.find(info->id);
+        if (current != NULL && current->get() == &task) {
+            m_async.erase(info->id);
+        }
+    }
+
+    if (task.cancelled()) {
+        LOG_INFO("task %s cancelled", info->name.c_str());
+        return;
+    }
+
+    countResult(info->handler, state);
+    completeTask(info, state, result);
+}
+
+void Worker::countResult(int index, TaskState state) {
+    boost::lock_guard<boost::mutex> guard(m_handlers_mutex);
+    HandlerState &handler = m_handlers[index];
+    if (state == TASK_DONE) {
+        ++handler.done;
+    } else {
+        ++handler.failed;
+    }
+}
+
+//a task over the concurrency limit of its type returns its executor
+//thread and waits in the parked queue of the type. release hands the slot
+//of a finished task to the oldest parked one
+bool Worker::acquire(const TaskInfoPtr &info) {
+    int limit = TaskHandlers::concurrency(info->handler);
+
+    boost::lock_guard<boost::mutex> guard(m_handlers_mutex);
+    HandlerState &handler = m_handlers[info->handler];
+    if (limit != HANDLER_UNLIMITED && handler.running >= limit) {
+        handler.parked.push_back(info);
+        return false;
+    }
+
+    ++handler.running;
+    return true;
+}
+
+//m_handlers_mutex is taken before m_tasks_mutex
+void Worker::release(int index, int64_t elapsed) {
+    boost::lock_guard<boost::mutex> guard(m_handlers_mutex);
+    HandlerState &handler = m_handlers[index];
+    --handler.running;
+    if (elapsed >= 0) {
+        handler.run.add(elapsed);
+    }
+
+    //run the oldest parked task again, skipping those deleted while parked
+    boost::lock_guard<boost::mutex> tasksGuard(m_tasks_mutex);
+    while (!handler.parked.empty()) {
+        TaskInfoPtr next = handler.parked.front();
+        handler.parked.pop_front();
+
+        TaskInfoPtr *current = m_tasks.find(next->id);
+        if (current != NULL && *current == next) {
+            m_executor.submit(next->id, boost::bind(&Worker::execute, this, _1, next));
+            return;
+        }
+    }
+}
+
+void Worker::completeTask(const TaskInfoPtr &info, TaskState state, const string &result) {
+    if (m_journal) {
+        m_journal->recordDone(info->name);
+    }
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_done_mutex);
+        m_running.erase(info->id);
+        m_started.erase(info->id);
+        m_completed.push_back(ZooOp::create(STATUSPATH+"/"+info->name, encode_status(state, result), 0));
+        if (m_claim_batch > 0) {
+            //claimed tasks are unassigned by their worker, not the master
+            m_completed.push_back(ZooOp::remove(m_assign_dir+"/"+info->name));
+        }
+    }
+    m_done_cond.notify_one();
+}
+
+//completions that arrive while one batch is written go out together in
+//the next, so the write rate adapts to the completion rate
+void Worker::reportLoop() {
+    for (;;) {
+        vector<ZooOp> batch;
+        {
+            boost::mutex::scoped_lock lock(m_done_mutex);
+            while (m_completed.empty() && !m_stopping) {
+                m_done_cond.wait(lock);
+            }
+            if (m_completed.empty()) {
+                return;
+            }
+            batch.swap(m_completed);
+        }
+
+        if (flush(batch)) {
+            continue;
+        }
+
+        //keep what was not reported in front of newer completions
+        bool stopping;
+        {
+            boost::lock_guard<boost::mutex> guard(m_done_mutex);
+            m_completed.insert(m_completed.begin(), batch.begin(), batch.end());
+            stopping = m_stopping;
+        }
+        if (stopping) {
+            return;
+        }
+        boost::this_thread::sleep(boost::posix_time::seconds(1));
+    }
+}
+
+//report states with multi creates of up to MULTI_BATCH. a status that
+//already exists was reported before and an assignment already gone was
+//withdrawn, both are dropped; on other failures the unreported rest stays
+//in batch
+bool Worker::flush(vector<ZooOp> &batch) {
+    while (!batch.empty()) {
+        size_t count = min(batch.size(), (size_t)MULTI_BATCH);
+        vector<ZooOp> ops(batch.begin(), batch.begin() + count);
+
+        vector<int> results;
+        int code = zk->multi(ops, &results);
+        if (code == ZOK) {
+            batch.erase(batch.begin(), batch.begin() + count);
+            continue;
+        }
+
+        int failed = ZooKeeper::failedOp(results);
+        if (failed >= 0 && results[failed] == ZNODEEXISTS) {
+            LOG_WARN("status %s already reported", ops[failed].path.c_str());
+            batch.erase(batch.begin() + failed);
+            continue;
+        }
+        if (failed >= 0 && results[failed] == ZNONODE && ops[failed].type == ZooOp::REMOVE) {
+            batch.erase(batch.begin() + failed);
+            continue;
+        }
+
+        LOG_ERROR("report %d task status failed:%s", (int)count, zerror(code));
+        return false;
+    }
+
+    return true;
+}
+
+//the lease is written before the report, so when the master sees the
+//worker draining it already knows which tasks were started here
+void Worker::drain() {
+    {
+        boost::lock_guard<boost::mutex> guard(m_done_mutex);
+        if (m_draining) {
+            return;
+        }
+        m_draining = true;
+    }
+    LOG_INFO("worker %s draining", m_worker_node.c_str());
+
+    m_lease_time = 0;
+    renewLease();
+    publishLoad();
+}
+
+//the master removes the assignment of a task once its status is reported
+//or it moved the task away, so an empty task table means nothing is left
+bool Worker::drained() {
+    {
+        boost::lock_guard<boost::mutex> guard(m_done_mutex);
+        if (!m_draining) {
+            return false;
+        }
+    }
+
+    boost::lock_guard<boost::mutex> guard(m_tasks_mutex);
+    return m_tasks.empty();
+}
+
+void Worker::tick() {
+    claimTasks();
+    renewLease();
+    publishLoad();
+    maintainJournal();
+
+    int64_t now = now_ms();
+    if (now - m_stats_time >= STATS_INTERVAL_MS) {
+        m_stats_time = now;
+        logStats();
+    }
+}
+
+bool Worker::renewLease() {
+    int64_t now = now_ms();
+    if (m_worker_node.empty() || now - m_lease_time < LEASE_RENEW_MS) {
+        return true;
+    }
+
+    //one write renews every running task. a draining worker lists only
+    //the started ones, the master moves the others
+    vector<NameId> running;
+    {
+        boost::lock_guard<boost::mutex> guard(m_done_mutex);
+        const FlatMap<NameId, char> &tasks = m_draining ? m_started : m_running;
+        running.reserve(tasks.size());
+        for (size_t i = 0; i < tasks.capacity(); ++i) {
+            if (tasks.occupied(i)) {
+                running.push_back(tasks.keyAt(i));
+            }
+        }
+    }
+
+    string data;
+    {
+        boost::lock_guard<boost::mutex> guard(m_tasks_mutex);
+        for (int i = 0; i < running.size(); ++i) {
+            if (m_tasks.contains(running[i])) {
+                data += m_names.name(running[i]);
+                data += '\n';
+            }
+        }
+    }
+
+    int code = zk->set(LEASEPATH+"/"+m_worker_node, data, -1);
+    NOTOK_RETURN(code);
+
+    m_lease_time = now;
+    return true;
+}
+
+bool Worker::openJournal(const string &path) {
+    m_journal.reset(new TaskJournal());
+    if (!m_journal->open(path)) {
+        m_journal.reset();
+        return false;
+    }
+
+    m_journal_start = now_ms();
+    return true;
 }
 
-void Worker::RunTask(const string &taskNode) {
-    LOG_INFO("run task:%s, task info:%s", taskNode.c_str(), m_tasks[taskNode]->info);
+bool Worker::checkpoint(const string &task, const string &data) {
+    return m_journal && m_journal->recordCheckpoint(task, data);
+}
+
+//flush the journal, and compact it once most of it is dead. the first
+//compaction after the grace period also drops what the last run left for
+//tasks that were not assigned here again
+void Worker::maintainJournal() {
+    if (!m_journal) {
+        return;
+    }
+
+    m_journal->sync();
+
+    bool prune = !m_journal_pruned && now_ms() - m_journal_start >= JOURNAL_GRACE_MS;
+    if (!prune && !m_journal->needsCompaction()) {
+        return;
+    }
+
+    set<string> keep;
+    {
+        boost::lock_guard<boost::mutex> guard(m_tasks_mutex);
+        for (size_t i = 0; i < m_tasks.capacity(); ++i) {
+            if (m_tasks.occupied(i)) {
+                keep.insert(m_names.name(m_tasks.keyAt(i)));
+            }
+        }
+    }
+
+    if (m_journal->compact(&keep)) {
+        m_journal_pruned = true;
+    }
+}
+
+bool Worker::publishLoad() {
+    if (m_worker_node.empty()) {
+        return true;
+    }
+
+    int64_t now = now_ms();
+    LoadReport report = m_load.sample(m_executor.queued(), m_executor.running(), m_executor.threads());
+    {
+        boost::lock_guard<boost::mutex> guard(m_done_mutex);
+        report.draining = m_draining;
+    }
+    if (!m_load.due(report, now)) {
+        return true;
+    }
+
+    int code = zk->set(WORKERPATH+"/"+m_worker_node, encode_load(report), -1);
+    NOTOK_RETURN(code);
+
+    m_load.published(report, now);
+    return true;
+}
+
+void Worker::logStats() {
+    {
+        boost::lock_guard<boost::mutex> guard(m_latency_mutex);
+        LOG_INFO("task fetch p50/p99:%llu/%lluus fetch-to-start p50/p99:%llu/%lluus",
+                (unsigned long long)m_fetch_latency.percentile(0.5),
+                (unsigned long long)m_fetch_latency.percentile(0.99),
+                (unsigned long long)m_start_latency.percentile(0.5),
+                (unsigned long long)m_start_latency.percentile(0.99));
+    }
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_handlers_mutex);
+        for (int i = 0; i < m_handlers.size(); ++i) {
+            const HandlerState &handler = m_handlers[i];
+            LOG_INFO("handler %s running:%d parked:%d done:%llu failed:%llu run p50/p99:%llu/%lluus",
+                    TaskHandlers::name(i), handler.running, (int)handler.parked.size(),
+                    (unsigned long long)handler.done, (unsigned long long)handler.failed,
+                    (unsigned long long)handler.run.percentile(0.5),
+                    (unsigned long long)handler.run.percentile(0.99));
+        }
+    }
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_async_mutex);
+        LOG_INFO("async tasks in flight:%d reactor threads:%d timers:%d fds:%d", (int)m_async.size(),
+                m_reactor.threads(), (int)m_reactor.timers(), (int)m_reactor.watches());
+    }
+
+    ExecutorStats stats = m_executor.stats();
+    LOG_INFO("executor threads:%d queued:%d running:%d done:%llu cancelled:%llu steals:%llu "
+            "wait p50/p99:%llu/%lluus run p50/p99:%llu/%lluus", stats.threads, stats.queued,
+            stats.running, (unsigned long long)stats.done, (unsigned long long)stats.cancelled,
+            (unsigned long long)stats.steals,
+            (unsigned long long)stats.wait.percentile(0.5), (unsigned long long)stats.wait.percentile(0.99),
+            (unsigned long long)stats.run.percentile(0.5), (unsigned long long)stats.run.percentile(0.99));
 }
 
 void Worker::childChange(const string &path) {
     if (path == m_assign_dir) {
         getTasks();
+        //finished tasks leave the assignment dir and free room
+        claimTasks();
+    } else if (m_claim_batch > 0 && path.compare(0, READYPATH.size() + 1, READYPATH + "/") == 0) {
+        claimTasks(atoi(path.c_str() + path.rfind('-') + 1));
     }
 }
+
+//pull mode: the worker takes tasks from the ready shards itself. a claim
+//removes the ready node and creates the assignment node in one multi, so
+//of the workers racing for a task exactly one gets it. shards are read
+//with a watch, so a worker with room hears of new tasks without polling
+bool Worker::claimTasks(int first) {
+    if (m_claim_batch <= 0 || m_assign_dir.empty()) {
+        return true;
+    }
+
+    {
+        boost::lock_guard<boost::mutex> guard(m_done_mutex);
+        if (m_draining) {
+            return true;
+        }
+    }
+
+    boost::lock_guard<boost::mutex> guard(m_assign_mutex);
+
+    int want;
+    {
+        boost::lock_guard<boost::mutex> guard(m_tasks_mutex);
+        want = m_claim_batch - (int)m_tasks.size();
+    }
+    if (want < (m_claim_batch + 1) / 2) {
+        return true;
+    }
+
+    if (first < 0 || first >= READY_SHARDS) {
+        first = m_next_shard;
+    }
+
+    //stay on the last shard that had tasks, then look at the others
+    for (int i = 0; i < READY_SHARDS && want > 0; ++i) {
+        int shard = (first + i) % READY_SHARDS;
+        int claimed = claimFrom(shard, want);
+        if (claimed > 0) {
+            want -= claimed;
+            m_next_shard = shard;
+        }
+    }
+
+    pumpFetches();
+    return true;
+}
+
+int Worker::claimFrom(int shard, int want) {
+    string dir = ready_shard(shard);
+    vector<string> children;
+    int code = zk->getChildren(dir, true, &children);
+    if (code != ZOK) {
+        LOG_ERROR("read %s failed:%s", dir.c_str(), zerror(code));
+        return 0;
+    }
+    if (children.empty()) {
+        return 0;
+    }
+
+    //oldest first. workers racing on one shard start at different offsets
+    //of its head, so they mostly claim disjoint tasks
+    sort(children.begin(), children.end());
+    size_t offset = 0;
+    if (children.size() > want) {
+        offset = NameTable::hash(m_worker_node) % (children.size() - want + 1);
+    }
+    vector<string> batch(children.begin() + offset,
+            children.begin() + offset + min(children.size(), (size_t)want));
+
+    for (int retry = 0; retry < CLAIM_RETRIES && !batch.empty(); ++retry) {
+        vector<ZooOp> ops;
+        for (int i = 0; i < batch.size(); ++i) {
+            ops.push_back(ZooOp::remove(dir+"/"+batch[i]));
+            ops.push_back(ZooOp::create(m_assign_dir+"/"+batch[i], "", 0));
+        }
+
+        vector<int> results;
+        code = zk->multi(ops, &results);
+        if (code == ZOK) {
+            boost::lock_guard<boost::mutex> guard(m_tasks_mutex);
+            for (int i = 0; i < batch.size(); ++i) {
+                LOG_DEBUG("claim task:%s", batch[i].c_str());
+                NameId id = m_names.intern(batch[i]);
+                if (!m_tasks.contains(id)) {
+                    m_tasks[id] = TaskInfoPtr();
+                    m_fetch_queue.push_back(id);
+                }
+            }
+            return batch.size();
+        }
+
+        int failed = ZooKeeper::failedOp(results);
+        if (failed < 0) {
+            LOG_ERROR("claim from %s failed:%s", dir.c_str(), zerror(code));
+            return 0;
+        }
+
+        //another worker claimed it first
+        batch.erase(batch.begin() + failed / 2);
+    }
+
+    return 0;
+}
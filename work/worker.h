@@ -4,29 +4,175 @@
 #include "watcher.h"
 #include "zookeeper.h"
 #include "common.h"
+#include "executor.h"
+#include "name_table.h"
+#include "task_format.h"
+#include "payload_store.h"
+#include "handlers.h"
+#include "histogram.h"
+#include "load_reporter.h"
+#include "task_journal.h"
+#include "task_pool.h"
+#include <deque>
 #include <map>
+#include <set>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 using namespace std;
 
+//most task reads in flight at once
+static const int FETCH_WINDOW = 64;
+
+//most tasks a pull mode worker claims at once
+static const int CLAIM_BATCH = 32;
+
+//seconds a draining worker waits for its running tasks before exiting anyway
+static const int DRAIN_TIMEOUT = 600;
+
 class Worker : public Watcher{
 public:
-    Worker(ZooKeeper *zk) : Watcher(zk) {}
+    //threads <= 0 runs one task per core, window bounds the task reads in
+    //flight, ioThreads run the reactor of async handlers
+    Worker(ZooKeeper *zk, int threads = 0, int window = FETCH_WINDOW, int ioThreads = 1,
+            PinMode pin = PIN_NONE);
+    ~Worker();
 
     bool createWorkspace();
     bool createWorker();
     bool getTasks();
-    bool setLoad(int load);
-    Task* getTaskInfo(const string& task);
 
-    void RunTask(const string& taskNode);
+    //claim tasks from the READYPATH shards in batches of up to batch
+    //instead of waiting for the master to assign them, 0 turns it off
+    void setPull(int batch) { m_claim_batch = batch; }
+
+    //claim tasks if fewer than half a batch are held, pull mode only
+    bool claimTasks(int first = -1);
+
+    //resolve payload references through store, not owned
+    void setPayloadStore(PayloadStore *store) { m_store = store; }
+
+    //journal fetched tasks and checkpoints in path, replaying what an
+    //earlier run left there
+    bool openJournal(const string& path);
+
+    //save the progress of a running task, it is resumed from here if the
+    //worker restarts and gets the task again
+    bool checkpoint(const string& task, const string& data);
+
+    //queue the final state of a task for the reporter thread
+    void completeTask(const TaskInfoPtr& info, TaskState state, const string& result);
+
+    //start no more tasks and report draining, so the master moves the
+    //tasks not started yet to other workers
+    void drain();
+
+    //true once draining and every task is reported and unassigned
+    bool drained();
+
+    //lease renewal, load report and executor metrics, called periodically
+    void tick();
+
+    //rewrite the lease node with the running tasks every LEASE_RENEW_MS
+    bool renewLease();
+
+    //write a load report to WORKERPATH/<worker> if it changed enough
+    bool publishLoad();
     
 private:
     void childChange(const std::string& path);
 
+    //claim up to want tasks of one shard, return how many were claimed
+    int claimFrom(int shard, int want);
+
+    //send reads of queued tasks while the window has room
+    void pumpFetches();
+    void onFetched(NameId id, int64_t requested, int code, const char* value, int len,
+            const Stat* stat);
+    void onStat(NameId id, int64_t requested, int code, const Stat* stat);
+    void deliver(NameId id, int64_t requested, const TaskInfoPtr& info);
+    TaskInfoPtr parseTaskInfo(NameId id, const char* value, int len);
+    bool prepare(const TaskInfoPtr& info);
+    void forget(const TaskInfoPtr& info);
+    string taskName(NameId id);
+    void maintainJournal();
+
+    //queue a fetched task on the executor, m_tasks_mutex held
+    void RunTask(const TaskInfoPtr& info);
+
+    void execute(Job& job, TaskInfoPtr info);
+    void startAsync(const TaskInfoPtr& info);
+    void finishAsync(const TaskInfoPtr& info, int64_t start, AsyncTask& task, TaskState state,
+            const string& result);
+    void countResult(int handler, TaskState state);
+
+    //take a running slot of the task type, or park the task until one frees
+    bool acquire(const TaskInfoPtr& info);
+    void release(int handler, int64_t elapsed);
+    void reportLoop();
+    bool flush(vector<ZooOp>& batch);
+    void logStats();
+
 private:
     string m_assign_dir;
     string m_worker_node;
-    map<string, Task*> m_tasks;
+    PayloadStore *m_store;
+    boost::scoped_ptr<TaskJournal> m_journal;
+    int64_t m_journal_start;    //ms when the journal was opened
+    bool m_journal_pruned;      //tasks of the last run not assigned again are dropped
+
+    TaskPool m_pool;            //before every holder of a TaskInfoPtr
+
+    //serializes getTasks and claims, so a children list read before a
+    //claim never drops the tasks it added
+    boost::mutex m_assign_mutex;
+    int m_claim_batch;          //0 unless in pull mode
+    int m_next_shard;           //shard the next claim starts from
+
+    boost::mutex m_tasks_mutex; //guards the members up to m_inflight
+    FlatMap<NameId, TaskInfoPtr> m_tasks; //NULL while the task is fetched
+    NameTable m_names;          //task name <-> id, the key of every table
+    deque<NameId> m_fetch_queue; //tasks whose read is not sent yet
+    int m_window;
+    int m_inflight;
+
+    boost::mutex m_latency_mutex;
+    Histogram m_fetch_latency;  //us from read sent to data
+    Histogram m_start_latency;  //us from read sent to task start
+
+    //per handler of TaskHandlers
+    typedef struct HandlerState {
+        int running;
+        deque<TaskInfoPtr> parked; //waiting for a running slot
+        Histogram run;   //us per run
+        uint64_t done;
+        uint64_t failed;
+
+        HandlerState() : running(0), done(0), failed(0) {}
+    } HandlerState;
+
+    boost::mutex m_handlers_mutex;
+    vector<HandlerState> m_handlers;
+
+    boost::mutex m_async_mutex;
+    FlatMap<NameId, AsyncTaskPtr> m_async; //async tasks in flight
+
+    boost::mutex m_done_mutex; //guards the members up to m_stopping
+    boost::condition_variable m_done_cond;
+    vector<ZooOp> m_completed; //status creates not reported yet
+    FlatMap<NameId, char> m_running; //tasks whose lease is renewed
+    FlatMap<NameId, char> m_started; //tasks a handler was called for
+    bool m_draining;
+    bool m_stopping;
+
+    LoadReporter m_load;
+    int64_t m_lease_time;      //ms of the last renewal
+    int64_t m_stats_time;      //ms of the last metrics line
+    boost::thread m_reporter;
+    Reactor m_reactor;         //async handlers wait here
+    Executor m_executor;       //last, its threads use everything above
 };
 
 #endif